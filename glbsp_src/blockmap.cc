@@ -48,7 +48,8 @@ static int block_count;
 static int block_mid_x = 0;
 static int block_mid_y = 0;
 
-static uint16_g ** block_lines;
+static uint16_g *block_lines;
+static int *block_start;
 
 static uint16_g *block_ptrs;
 static uint16_g *block_dups;
@@ -144,46 +145,49 @@ int CheckLinedefInsideBox(int xmin, int ymin, int xmax, int ymax,
 
 /* ----- create blockmap ------------------------------------ */
 
-#define BK_NUM    0
-#define BK_MAX    1
-#define BK_XOR    2
-#define BK_FIRST  3
+//
+// The blockmap is first built as a list of (block, line) pairs, which
+// are sorted into block order afterwards.  The sorted pairs give the
+// line lists of every block stored one after the other, where the
+// lines of block N are block_lines[block_start[N] ... block_start[N+1]-1].
+//
+
+typedef struct block_pair_s
+{
+  int blk_num;
+  int line_index;
+}
+block_pair_t;
+
+static block_pair_t *block_pairs;
+static int num_block_pairs;
+static int max_block_pairs;
 
-#define BK_QUANTUM  32
+// rank of each linedef in the block lists (see CreateBlockmap)
+static int *line_ranks;
 
 static void BlockAdd(int blk_num, int line_index)
 {
-  uint16_g *cur = block_lines[blk_num];
-
 # if DEBUG_BLOCKMAP
   PrintDebug("Block %d has line %d\n", blk_num, line_index);
 # endif
 
   if (blk_num < 0 || blk_num >= block_count)
     InternalError("BlockAdd: bad block number %d", blk_num);
-    
-  if (! cur)
-  {
-    // create empty block
-    block_lines[blk_num] = cur = (uint16_g *)UtilCalloc(BK_QUANTUM * sizeof(uint16_g));
-    cur[BK_NUM] = 0;
-    cur[BK_MAX] = BK_QUANTUM;
-    cur[BK_XOR] = 0x1234;
-  }
 
-  if (BK_FIRST + cur[BK_NUM] == cur[BK_MAX])
+  if (num_block_pairs == max_block_pairs)
   {
-    // no more room, so allocate some more...
-    cur[BK_MAX] += BK_QUANTUM;
+    // no more room, so double the size
+    max_block_pairs = max_block_pairs ? max_block_pairs * 2 : 4096;
 
-    block_lines[blk_num] = cur = (uint16_g *)UtilRealloc(cur, cur[BK_MAX] * sizeof(uint16_g));
+    block_pairs = (block_pair_t *)UtilRealloc(block_pairs,
+        max_block_pairs * sizeof(block_pair_t));
   }
 
-  // compute new checksum
-  cur[BK_XOR] = ((cur[BK_XOR] << 4) | (cur[BK_XOR] >> 12)) ^ line_index;
+  block_pairs[num_block_pairs].blk_num    = blk_num;
+  block_pairs[num_block_pairs].line_index = line_index;
 
-  cur[BK_FIRST + cur[BK_NUM]] = UINT16(line_index);
-  cur[BK_NUM]++;
+  num_block_pairs++;
 }
 
 static void BlockAddLine(linedef_t *L)
@@ -256,11 +260,38 @@ static void BlockAddLine(linedef_t *L)
   }
 }
 
+static int LineRankCompare(const void *p1, const void *p2)
+{
+  int line1 = ((const int *) p1)[0];
+  int line2 = ((const int *) p2)[0];
+
+  // lines touching the fewest blocks come first
+  if (line_ranks[line1] != line_ranks[line2])
+    return line_ranks[line1] - line_ranks[line2];
+
+  return line1 - line2;
+}
+
+static int BlockPairCompare(const void *p1, const void *p2)
+{
+  const block_pair_t *A = (const block_pair_t *) p1;
+  const block_pair_t *B = (const block_pair_t *) p2;
+
+  if (A->blk_num != B->blk_num)
+    return A->blk_num - B->blk_num;
+
+  return line_ranks[A->line_index] - line_ranks[B->line_index];
+}
+
 static void CreateBlockmap(void)
 {
   int i;
+  int *line_order;
+
+  num_block_pairs = 0;
+  max_block_pairs = 0;
 
-  block_lines = (uint16_g **) UtilCalloc(block_count * sizeof(uint16_g *));
+  block_pairs = NULL;
 
   DisplayTicker();
 
@@ -274,34 +305,105 @@ static void CreateBlockmap(void)
 
     BlockAddLine(L);
   }
+
+  // choose the order of lines within each block.  Lines which
+  // touch many blocks go last, so that when the lines of one
+  // block are a subset of another's, they usually form the
+  // tail of the other list and can share its storage (see
+  // CompressBlockmap).  The ranks give the same order in every
+  // block.
+
+  line_ranks = (int *) UtilCalloc((num_linedefs + 1) * sizeof(int));
+  line_order = (int *) UtilCalloc((num_linedefs + 1) * sizeof(int));
+
+  for (i=0; i < num_block_pairs; i++)
+    line_ranks[block_pairs[i].line_index] += 1;
+
+  for (i=0; i < num_linedefs; i++)
+    line_order[i] = i;
+
+  qsort(line_order, num_linedefs, sizeof(int), LineRankCompare);
+
+  for (i=0; i < num_linedefs; i++)
+    line_ranks[line_order[i]] = i;
+
+  UtilFree(line_order);
+
+  // sort the pairs into block order, then lines by their rank
+
+  DisplayTicker();
+
+  qsort(block_pairs, num_block_pairs, sizeof(block_pair_t), BlockPairCompare);
+
+  block_lines = (uint16_g *) UtilCalloc((num_block_pairs + 1) * sizeof(uint16_g));
+  block_start = (int *) UtilCalloc((block_count + 1) * sizeof(int));
+
+  for (i=0; i < num_block_pairs; i++)
+  {
+    block_lines[i] = UINT16(block_pairs[i].line_index);
+    block_start[block_pairs[i].blk_num + 1] += 1;
+  }
+
+  for (i=0; i < block_count; i++)
+    block_start[i+1] += block_start[i];
+
+  if (block_pairs)
+    UtilFree(block_pairs);
+
+  UtilFree(line_ranks);
+
+  block_pairs = NULL;
+  line_ranks  = NULL;
 }
 
 
+#define BLOCK_NUM(blk)    (block_start[(blk)+1] - block_start[blk])
+#define BLOCK_LAST(blk)   (block_lines + block_start[(blk)+1] - 1)
+
+//
+// BlockCompare
+//
+// Compares the line lists of two blocks backwards, starting from the
+// last line.  After sorting with this, a list which is the tail of
+// another list is followed by another list with the same tail.
+//
 static int BlockCompare(const void *p1, const void *p2)
 {
   int blk_num1 = ((const uint16_g *) p1)[0];
   int blk_num2 = ((const uint16_g *) p2)[0];
 
-  const uint16_g *A = block_lines[blk_num1];
-  const uint16_g *B = block_lines[blk_num2];
+  int num1 = BLOCK_NUM(blk_num1);
+  int num2 = BLOCK_NUM(blk_num2);
 
-  if (A == B)
-    return 0;
+  const uint16_g *A = BLOCK_LAST(blk_num1);
+  const uint16_g *B = BLOCK_LAST(blk_num2);
 
-  if (A == NULL) return -1;
-  if (B == NULL) return +1;
+  int k;
 
-  if (A[BK_NUM] != B[BK_NUM])
+  for (k=0; k < num1 && k < num2; k++, A--, B--)
   {
-    return A[BK_NUM] - B[BK_NUM];
+    if (*A != *B)
+      return (int)*A - (int)*B;
   }
- 
-  if (A[BK_XOR] != B[BK_XOR])
-  {
-    return A[BK_XOR] - B[BK_XOR];
-  }
- 
-  return memcmp(A+BK_FIRST, B+BK_FIRST, A[BK_NUM] * sizeof(uint16_g));
+
+  return num1 - num2;
+}
+
+//
+// BlockIsTail
+//
+// Returns TRUE if the line list of block A is the same as the end of
+// the line list of block B (which includes A being identical to B).
+//
+static int BlockIsTail(int blk_A, int blk_B)
+{
+  int num_A = BLOCK_NUM(blk_A);
+
+  if (num_A > BLOCK_NUM(blk_B))
+    return FALSE;
+
+  return memcmp(BLOCK_LAST(blk_A) - num_A + 1, BLOCK_LAST(blk_B) - num_A + 1,
+      num_A * sizeof(uint16_g)) == 0;
 }
 
 static void CompressBlockmap(void)
@@ -312,20 +414,49 @@ static void CompressBlockmap(void)
 
   int orig_size, new_size;
 
+  // block which holds the storage shared by each block
+  int *block_owners;
+
   block_ptrs = (uint16_g *)UtilCalloc(block_count * sizeof(uint16_g));
   block_dups = (uint16_g *)UtilCalloc(block_count * sizeof(uint16_g));
 
+  block_owners = (int *)UtilCalloc(block_count * sizeof(int));
+
   DisplayTicker();
 
-  // sort duplicate-detecting array.  After the sort, all duplicates
-  // will be next to each other.  The duplicate array gives the order
+  // sort the blocks by their lists read backwards.  After the
+  // sort, duplicates will be next to each other, and any list
+  // which is the tail of a longer list comes just before the
+  // lists with that tail.  The duplicate array gives the order
   // of the blocklists in the BLOCKMAP lump.
+  //
+  // A list is stored as 0, lines..., -1.  A block whose lines
+  // are the tail of a longer list points at the word before
+  // them, which is either the 0 or another line.  Engines skip
+  // that first word (the original DOOM checked it as a line,
+  // which is harmless since every line is bbox tested).
   
   for (i=0; i < block_count; i++)
     block_dups[i] = i;
 
   qsort(block_dups, block_count, sizeof(uint16_g), BlockCompare);
 
+  // find which blocks can share the storage of another, going
+  // backwards so that each block can follow the one after it.
+
+  for (i=block_count-1; i >= 0; i--)
+  {
+    int blk_num = block_dups[i];
+
+    block_owners[blk_num] = blk_num;
+
+    if (BLOCK_NUM(blk_num) > 0 && i+1 < block_count &&
+        BlockIsTail(blk_num, block_dups[i+1]))
+    {
+      block_owners[blk_num] = block_owners[block_dups[i+1]];
+    }
+  }
+
   // scan duplicate array and build up offset array
 
   cur_offset = 4 + block_count + 2;
@@ -338,50 +469,47 @@ static void CompressBlockmap(void)
   for (i=0; i < block_count; i++)
   {
     int blk_num = block_dups[i];
-    int count;
+    int count = 2 + BLOCK_NUM(blk_num);
+
+    orig_size += count;
 
     // empty block ?
-    if (block_lines[blk_num] == NULL)
+    if (count == 2)
     {
       block_ptrs[blk_num] = 4 + block_count;
       block_dups[i] = DUMMY_DUP;
-
-      orig_size += 2;
       continue;
     }
 
-    count = 2 + block_lines[blk_num][BK_NUM];
+    // duplicate or tail of another list ?  Only the owner of the
+    // storage will update the current offset value.
 
-    // duplicate ?  Only the very last one of a sequence of duplicates
-    // will update the current offset value.
-
-    if (i+1 < block_count && 
-        BlockCompare(block_dups + i, block_dups + i+1) == 0)
+    if (block_owners[blk_num] != blk_num)
     {
-      block_ptrs[blk_num] = cur_offset;
       block_dups[i] = DUMMY_DUP;
 
-      // free the memory of the duplicated block
-      UtilFree(block_lines[blk_num]);
-      block_lines[blk_num] = NULL;
-      
       dup_count++;
-
-      orig_size += count;
       continue;
     }
 
-    // OK, this block is either the last of a series of duplicates, or
-    // just a singleton.
-
     block_ptrs[blk_num] = cur_offset;
 
     cur_offset += count;
+    new_size   += count;
+  }
 
-    orig_size += count;
-    new_size  += count;
+  for (i=0; i < block_count; i++)
+  {
+    int owner = block_owners[i];
+
+    if (owner != i && BLOCK_NUM(i) > 0)
+    {
+      block_ptrs[i] = block_ptrs[owner] + BLOCK_NUM(owner) - BLOCK_NUM(i);
+    }
   }
 
+  UtilFree(block_owners);
+
   if (cur_offset > 65535)
   {
     MarkSoftFailure(LIMIT_BLOCKMAP);
@@ -390,7 +518,7 @@ static void CompressBlockmap(void)
   }
 
 # if DEBUG_BLOCKMAP
-  PrintDebug("Blockmap: Last ptr = %d  duplicates = %d\n", 
+  PrintDebug("Blockmap: Last ptr = %d  shared = %d\n", 
       cur_offset, dup_count);
 # endif
 
@@ -401,7 +529,6 @@ static void CompressBlockmap(void)
     block_compression = 0;
 }
 
-
 static void WriteBlockmap(void)
 {
   int i;
@@ -444,19 +571,17 @@ static void WriteBlockmap(void)
   for (i=0; i < block_count; i++)
   {
     int blk_num = block_dups[i];
-    uint16_g *blk;
 
     // ignore duplicate or empty blocks
     if (blk_num == DUMMY_DUP)
       continue;
 
-    blk = block_lines[blk_num];
-
-    if (blk == NULL)
-      InternalError("WriteBlockmap: block %d is NULL !", i);
+    if (BLOCK_NUM(blk_num) == 0)
+      InternalError("WriteBlockmap: block %d is empty !", i);
 
     AppendLevelLump(lump, &m_zero, sizeof(uint16_g));
-    AppendLevelLump(lump, blk + BK_FIRST, blk[BK_NUM] * sizeof(uint16_g));
+    AppendLevelLump(lump, block_lines + block_start[blk_num],
+        BLOCK_NUM(blk_num) * sizeof(uint16_g));
     AppendLevelLump(lump, &m_neg1, sizeof(uint16_g));
   }
 }
@@ -464,15 +589,8 @@ static void WriteBlockmap(void)
 
 static void FreeBlockmap(void)
 {
-  int i;
-
-  for (i=0; i < block_count; i++)
-  {
-    if (block_lines[i])
-      UtilFree(block_lines[i]);
-  }
-
   UtilFree(block_lines);
+  UtilFree(block_start);
   UtilFree(block_ptrs);
   UtilFree(block_dups);
 }
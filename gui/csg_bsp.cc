@@ -34,11 +34,14 @@
 #include "g_doom.h"		// for MLF_DontDraw
 
 
-double QUANTIZE_GRID;
+// all of these are per-thread, so that several levels can be built
+// at the same time (each on its own thread).
 
-static bool csg_is_clip_hull;
+thread_local double QUANTIZE_GRID;
 
-static std::vector<region_c*> dead_regions;
+static thread_local bool csg_is_clip_hull;
+
+static thread_local std::vector<region_c*> dead_regions;
 
 
 
@@ -116,6 +119,8 @@ snag_c::snag_c(brush_vert_c *side, double _x1, double _y1, double _x2, double _y
 	mini(false), on_node(NULL), region(NULL), partner(NULL),
 	sides(), seen(false)
 {
+	MemTag_Add(MEM_Regions, sizeof(snag_c));
+
 	if (Length() < SNAG_EPSILON)
 		Main_FatalError("Line loop contains zero-length line! (%1.2f %1.2f)\n", x1, y1);
 
@@ -127,7 +132,9 @@ snag_c::snag_c(double _x1, double _y1, double _x2, double _y2, partition_c *part
 	x1(_x1), y1(_y1), x2(_x2), y2(_y2),
 	mini(true), on_node(part), region(NULL), partner(NULL),
 	sides(), seen(false)
-{ }
+{
+	MemTag_Add(MEM_Regions, sizeof(snag_c));
+}
 
 snag_c::snag_c(const snag_c& other) :
 	x1(other.x1), y1(other.y1), x2(other.x2), y2(other.y2),
@@ -135,6 +142,8 @@ snag_c::snag_c(const snag_c& other) :
 	region(other.region), partner(NULL),
 	sides(), seen(false)
 {
+	MemTag_Add(MEM_Regions, sizeof(snag_c));
+
 	// copy sides
 	for (unsigned int i = 0 ; i < other.sides.size() ; i++)
 		sides.push_back(other.sides[i]);
@@ -142,7 +151,9 @@ snag_c::snag_c(const snag_c& other) :
 
 
 snag_c::~snag_c()
-{ }
+{
+	MemTag_Add(MEM_Regions, -(long)sizeof(snag_c));
+}
 
 
 double snag_c::Length() const
@@ -265,7 +276,9 @@ region_c::region_c() :
 	snags(), brushes(), entities(), gaps(),
 	degenerate(false),
 	index(-1), shade(0)
-{ }
+{
+	MemTag_Add(MEM_Regions, sizeof(region_c));
+}
 
 
 region_c::region_c(const region_c& other) :
@@ -273,6 +286,8 @@ region_c::region_c(const region_c& other) :
 	degenerate(false),
 	index(-1), shade(0)
 {
+	MemTag_Add(MEM_Regions, sizeof(region_c));
+
 	for (unsigned int i = 0 ; i < other.brushes.size() ; i++)
 		brushes.push_back(other.brushes[i]);
 }
@@ -280,6 +295,8 @@ region_c::region_c(const region_c& other) :
 
 region_c::~region_c()
 {
+	MemTag_Add(MEM_Regions, -(long)sizeof(region_c));
+
 	unsigned int i;
 
 	for (i = 0 ; i < snags.size() ; i++)
@@ -706,11 +723,11 @@ void bsp_node_c::AddBBox(region_c *leaf)
 
 /***** VARIABLES ******************/
 
-static std::vector<partition_c *> all_partitions;
+static thread_local std::vector<partition_c *> all_partitions;
 
-std::vector<region_c *> all_regions;
+thread_local std::vector<region_c *> all_regions;
 
-bsp_node_c * bsp_root;
+thread_local bsp_node_c * bsp_root;
 
 
 //------------------------------------------------------------------------
@@ -2086,11 +2103,11 @@ void CSG_BSP(double grid, bool is_clip_hull)
 	group_c root;
 
 	// create a region for every brush
-	for (unsigned int i = 0 ; i < all_brushes.size() ; i++)
-		CreateRegion(root, all_brushes[i]);
+	for (unsigned int i = 0 ; i < cur_level->brushes.size() ; i++)
+		CreateRegion(root, cur_level->brushes[i]);
 
-	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
-		root.AddEntity(all_entities[i]);
+	for (unsigned int i = 0 ; i < cur_level->entities.size() ; i++)
+		root.AddEntity(cur_level->entities[i]);
 
 	// create a rectangle region around whole map
 	AddBoundingRegion(root);
@@ -2173,7 +2190,7 @@ void CSG_BSP_Free()
 
 #include "g_doom.h"
 
-static std::map<int, int> test_vertices;
+static thread_local std::map<int, int> test_vertices;
 
 
 static int TestVertex(snag_c *S, int which)
@@ -41,9 +41,9 @@
 #define CLIP_EPSILON  0.01
 
 
-extern qLump_c *q1_clip;
+extern thread_local qLump_c *q1_clip;
 
-extern int q1_total_clip;
+extern thread_local int q1_total_clip;
 
 
 static double Q1_hull_sizes[2][3] =
@@ -427,9 +427,9 @@ public:
 
 
 
-static std::vector<csg_brush_c *> saved_all_brushes;
+static thread_local std::vector<csg_brush_c *> saved_all_brushes;
 
-static std::vector<clip_side_c *> all_clip_sides;
+static thread_local std::vector<clip_side_c *> all_clip_sides;
 
 
 //------------------------------------------------------------------------
@@ -438,19 +438,19 @@ static void SaveBrushes()
 {
 	saved_all_brushes.clear();
 
-	std::swap(all_brushes, saved_all_brushes);
+	std::swap(cur_level->brushes, saved_all_brushes);
 }
 
 
 static void RestoreBrushes()
 {
 	// free our modified ones
-	for (unsigned int i = 0; i < all_brushes.size(); i++)
-		delete all_brushes[i];
+	for (unsigned int i = 0; i < cur_level->brushes.size(); i++)
+		delete cur_level->brushes[i];
 
-	all_brushes.clear();
+	cur_level->brushes.clear();
 
-	std::swap(all_brushes, saved_all_brushes);
+	std::swap(cur_level->brushes, saved_all_brushes);
 }
 
 
@@ -637,7 +637,7 @@ static void AddFatBrush(csg_brush_c *P2)
 	P2->ComputeBBox();
 	P2->Validate();
 
-	all_brushes.push_back(P2);
+	cur_level->brushes.push_back(P2);
 }
 
 
@@ -1252,14 +1252,13 @@ void Q1_ClippingHull(int hull)
 	if (hull > clip_hulls)
 		return;
 
-	if (main_action >= MAIN_CANCEL)
+	if (Main_Aborted())
 		return;
 
 
 	LogPrintf("\nClipping Hull %d...\n", hull);
 
-	if (main_win)
-		main_win->build_box->Prog_Step("Hull");
+	Main_ProgStep("Hull");
 
 
 	///???  FreeAll();
@@ -1279,9 +1278,9 @@ void Q1_ClippingHull(int hull)
 
 	Q1_ClipWorld(hull, pads);
 
-	for (unsigned int m = 0 ; m < qk_all_mapmodels.size() ; m++)
+	for (unsigned int m = 0 ; m < cur_level->mapmodels.size() ; m++)
 	{
-		Q1_ClipMapModel(qk_all_mapmodels[m], hull,
+		Q1_ClipMapModel(cur_level->mapmodels[m], hull,
 				pads[0], pads[1], pads[2]);
 	}
 
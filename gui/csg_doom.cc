@@ -47,11 +47,11 @@ int ef_thing_mode;
 
 
 // valid after DM_CreateLinedefs()
-static int map_bound_x1, map_bound_x2;
-static int map_bound_y1, map_bound_y2;
+static thread_local int map_bound_x1, map_bound_x2;
+static thread_local int map_bound_y1, map_bound_y2;
 
-static int dummy_pos_x;
-static int dummy_pos_y;
+static thread_local int dummy_pos_x;
+static thread_local int dummy_pos_y;
 
 
 #define SEC_FLOOR_SPECIAL  (1 << 1)
@@ -745,7 +745,7 @@ struct fs_thing_t
 	int x, y, z;
 
 	// this will point into a std::string in a csg_entity_c in the
-	// all_entities list -- guaranteed to stay around until map is
+	// level's entity list -- guaranteed to stay around until map is
 	// fully written.
 	const char *fs_name;
 
@@ -757,19 +757,20 @@ struct fs_thing_t
 
 /********* TABLES *********/
 
+// these are per-thread, like the rest of the CSG back-end
 
-static std::vector<doom_vertex_c *>  dm_vertices;
-static std::vector<doom_linedef_c *> dm_linedefs;
-static std::vector<doom_sidedef_c *> dm_sidedefs;
-static std::vector<doom_sector_c *>  dm_sectors;
+static thread_local std::vector<doom_vertex_c *>  dm_vertices;
+static thread_local std::vector<doom_linedef_c *> dm_linedefs;
+static thread_local std::vector<doom_sidedef_c *> dm_sidedefs;
+static thread_local std::vector<doom_sector_c *>  dm_sectors;
 
 class dummy_sector_c;
 
-static std::vector<dummy_sector_c *> dm_dummies;
-static std::vector<extrafloor_c *>   dm_exfloors;
-static std::vector<fs_thing_t>       dm_fs_things;
+static thread_local std::vector<dummy_sector_c *> dm_dummies;
+static thread_local std::vector<extrafloor_c *>   dm_exfloors;
+static thread_local std::vector<fs_thing_t>       dm_fs_things;
 
-static std::map<int, unsigned int>   dm_vertex_map;
+static thread_local std::map<int, unsigned int>   dm_vertex_map;
 
 
 //------------------------------------------------------------------------
@@ -787,9 +788,9 @@ void Doom_TestBrushes(void)
 	DM_StartWAD("brush_test.wad");
 	DM_BeginLevel();
 
-	for (unsigned int k = 0; k < all_brushes.size(); k++)
+	for (unsigned int k = 0; k < cur_level->brushes.size(); k++)
 	{
-		csg_brush_c *P = all_brushes[k];
+		csg_brush_c *P = cur_level->brushes[k];
 
 		int sec_idx = DM_NumSectors();
 
@@ -965,8 +966,8 @@ static void DM_MakeSector(region_c *R)
 	if (S->c_h < S->f_h)
 		S->c_h = S->f_h;
 
-	S->f_tex = f_face->getStr("tex", dummy_plane_tex.c_str());
-	S->c_tex = c_face->getStr("tex", dummy_plane_tex.c_str());
+	S->f_tex = f_face->getStr("tex", cur_level->dummy_plane_tex.c_str());
+	S->c_tex = c_face->getStr("tex", cur_level->dummy_plane_tex.c_str());
 
 	int f_mark = f_face->getInt("mark");
 	int c_mark = c_face->getInt("mark");
@@ -1253,7 +1254,7 @@ static doom_sidedef_c * DM_MakeSidedef(
 	brush_vert_c *lower = NULL;
 	brush_vert_c *upper = NULL;
 
-	const char *dummy_tex = dummy_wall_tex.c_str();
+	const char *dummy_tex = cur_level->dummy_wall_tex.c_str();
 
 	// Note: 'snag' actually faces into the region _behind_ this sidedef
 
@@ -2249,9 +2250,9 @@ public:
 		}
 		else
 		{
-			SD->upper = dummy_wall_tex;
-			SD->mid   = dummy_wall_tex;
-			SD->lower = dummy_wall_tex;
+			SD->upper = cur_level->dummy_wall_tex;
+			SD->mid   = cur_level->dummy_wall_tex;
+			SD->lower = cur_level->dummy_wall_tex;
 		}
 
 		// on two-sided line, don't set railing
@@ -2429,13 +2430,13 @@ static void DM_SolidExtraFloor(doom_sector_c *sec, gap_c *gap1, gap_c *gap2)
 	EF->top_h    = I_ROUND(gap2->bottom->t.z);
 	EF->bottom_h = I_ROUND(gap1->   top->b.z);
 
-	EF->top    = gap2->bottom->t.face.getStr("tex", dummy_plane_tex.c_str());
-	EF->bottom = gap1->   top->b.face.getStr("tex", dummy_plane_tex.c_str());
+	EF->top    = gap2->bottom->t.face.getStr("tex", cur_level->dummy_plane_tex.c_str());
+	EF->bottom = gap1->   top->b.face.getStr("tex", cur_level->dummy_plane_tex.c_str());
 
 
 	brush_vert_c *V = gap2->bottom->verts[0];
 
-	EF->wall = V->face.getStr("tex", dummy_wall_tex.c_str());
+	EF->wall = V->face.getStr("tex", cur_level->dummy_wall_tex.c_str());
 }
 
 
@@ -2468,13 +2469,13 @@ static void DM_LiquidExtraFloor(doom_sector_c *sec, csg_brush_c *liquid)
 		EF->top_h    = EF->bottom_h + 128;   // not significant
 	}
 
-	EF->top    = liquid->t.face.getStr("tex", dummy_plane_tex.c_str());
+	EF->top    = liquid->t.face.getStr("tex", cur_level->dummy_plane_tex.c_str());
 	EF->bottom = EF->top;
 
 
 	brush_vert_c *V = liquid->verts[0];
 
-	EF->wall = V->face.getStr("tex", dummy_wall_tex.c_str());
+	EF->wall = V->face.getStr("tex", cur_level->dummy_wall_tex.c_str());
 }
 
 
@@ -2695,8 +2696,8 @@ static void DM_ProcessLightFX()
 			new_sec->c_h   = 1;
 			new_sec->light = S->light2;
 
-			new_sec->f_tex = dummy_plane_tex.c_str();
-			new_sec->c_tex = dummy_plane_tex.c_str();
+			new_sec->f_tex = cur_level->dummy_plane_tex.c_str();
+			new_sec->c_tex = cur_level->dummy_plane_tex.c_str();
 
 			Dummy_New(new_sec, S);
 		}
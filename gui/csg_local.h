@@ -221,9 +221,9 @@ private:
 
 /***** VARIABLES ****************/
 
-extern std::vector<region_c *> all_regions;
+extern thread_local std::vector<region_c *> all_regions;
 
-extern bsp_node_c * bsp_root;
+extern thread_local bsp_node_c * bsp_root;
 
 
 /***** FUNCTIONS ****************/
@@ -26,7 +26,9 @@
 
 #include "lib_util.h"
 #include "main.h"
+#include "m_cache.h"
 #include "m_lua.h"
+#include "m_pipeline.h"
 
 #include "csg_main.h"
 #include "csg_local.h"
@@ -36,14 +38,7 @@
 #define EPSILON  0.001
 
 
-std::vector< csg_brush_c *> all_brushes;
-
-std::vector< csg_entity_c *> all_entities;
-
-std::map< std::string, csg_property_set_c *> all_tex_props;
-
-std::string dummy_wall_tex;
-std::string dummy_plane_tex;
+thread_local csg_level_c * cur_level;
 
 double CHUNK_SIZE = 512.0;
 
@@ -155,10 +150,14 @@ float uv_matrix_c::Calc_T(float x, float y, float z) const
 brush_vert_c::brush_vert_c(csg_brush_c *_parent, double _x, double _y) :
 	parent(_parent), x(_x), y(_y),
 	face(), uv_mat(NULL)
-{ }
+{
+	MemTag_Add(MEM_Brushes, sizeof(brush_vert_c));
+}
 
 brush_vert_c::~brush_vert_c()
 {
+	MemTag_Add(MEM_Brushes, -(long)sizeof(brush_vert_c));
+
 	if (uv_mat)
 		delete uv_mat;
 }
@@ -199,7 +198,9 @@ csg_brush_c::csg_brush_c() :
 	b(-EXTREME_H),
 	t( EXTREME_H),
 	link_ent(NULL)
-{ }
+{
+	MemTag_Add(MEM_Brushes, sizeof(csg_brush_c));
+}
 
 csg_brush_c::csg_brush_c(const csg_brush_c *other) :
 	bkind(other->bkind), bflags(other->bflags),
@@ -210,10 +211,14 @@ csg_brush_c::csg_brush_c(const csg_brush_c *other) :
 	// NOTE: verts and slopes not cloned
 
 	bflags &= ~ BRU_IF_Quad;
+
+	MemTag_Add(MEM_Brushes, sizeof(csg_brush_c));
 }
 
 csg_brush_c::~csg_brush_c()
 {
+	MemTag_Add(MEM_Brushes, -(long)sizeof(csg_brush_c));
+
 	// FIXME: free verts
 
 	// FIXME: free slopes
@@ -461,10 +466,14 @@ bool csg_brush_c::IntersectRay(float x1, float y1, float z1,
 
 
 csg_entity_c::csg_entity_c() : id(), x(0), y(0), z(0), props(), ex_floor(-1)
-{ }
+{
+	MemTag_Add(MEM_Entities, sizeof(csg_entity_c));
+}
 
 csg_entity_c::~csg_entity_c()
-{ }
+{
+	MemTag_Add(MEM_Entities, -(long)sizeof(csg_entity_c));
+}
 
 
 bool csg_entity_c::Match(const char *want_name) const
@@ -637,78 +646,7 @@ public:
 		return false;  // did not hit anything
 	}
 
-private:
-	void SpotTestBrush(const csg_brush_c *B,
-					   int x1, int y1, int x2, int y2, int floor_h)
-	{
-		// ignore non-solid brushes
-		if (B->bkind != BKIND_Solid || (B->bflags & BFLAG_NoClip))
-			return;
-
-		// bbox check (skip if merely touching the bbox)
-		if (B->max_x <= x1 || B->min_x >= x2 ||
-		    B->max_y <= y1 || B->min_y >= y2)
-			return;
-
-		double t_delta = B->t.face.getDouble("delta_z", 0);
-		double b_delta = B->b.face.getDouble("delta_z", 0);
-
-		int t_z = I_ROUND(B->t.z + t_delta);
-		int b_z = I_ROUND(B->b.z + b_delta);
-
-		// skip brushes underneath the floor (or the floor itself)
-		if (t_z < floor_h + 1)
-			return;
-
-		// skip brushes far above the floor (like ceilings)
-		if (b_z >= floor_h + spot_high_h)
-			return;
-
-		/* this brush is a potential blocker */
-
-		int content = SPOT_LEDGE;
-
-		if (b_z >= floor_h + spot_low_h)
-			content = SPOT_LOW_CEIL;
-
-		else if (b_z <= floor_h && t_z >= floor_h + spot_low_h)
-			content = SPOT_WALL;
-
-		// build the polygon
-		std::vector<int> shape;
-
-		int num_vert = (int)B->verts.size();
-
-		for (int i = 0 ; i < num_vert ; i++)
-		{
-			const brush_vert_c *V = B->verts[i];
-
-			// rounding to integer here, I don't think it is any problem,
-			// as the spot polygon-drawing code is fairly robust.
-			shape.push_back(I_ROUND(V->x));
-			shape.push_back(I_ROUND(V->y));
-		}
-
-		SPOT_FillPolygon(content, &shape[0], num_vert);
-	}
-
 public:
-	void SpotStuff(int x1, int y1, int x2, int y2, int floor_h)
-	{
-		for (unsigned int k = 0 ; k < brushes.size() ; k++)
-			SpotTestBrush(brushes[k], x1,y1, x2,y2, floor_h);
-
-		if (children[0][0])
-		{
-			for (int cx = 0 ; cx < 2 ; cx++)
-			for (int cy = 0 ; cy < 2 ; cy++)
-			{
-				if (children[cx][cy]->BoxTouchesThis(x1,y1, x2,y2))
-					children[cx][cy]->SpotStuff(x1,y1, x2,y2, floor_h);
-			}
-		}
-	}
-
 	bool BrushContents(double x, double y, double z, int *result,
 					   double *liquid_depth = NULL)
 	{
@@ -761,22 +699,46 @@ public:
 };
 
 
-brush_quad_node_c * brush_quad_tree;
-
+//------------------------------------------------------------------------
 
-static void CSG_CreateQuadTree()
+csg_level_c::csg_level_c() :
+	name(), description(),
+	brushes(), entities(), tex_props(),
+	dummy_wall_tex(), dummy_plane_tex(),
+	props(), mapmodels(),
+	spot_blockers(), spot_buckets(),
+	spot_bk_x(0), spot_bk_y(0),
+	spot_bk_w(0), spot_bk_h(0),
+	spot_blockers_valid(false)
 {
 	// TODO : ability to set this via gui.property()
 	int size = 65536;
 
-	brush_quad_tree = new brush_quad_node_c(-(size/2), -(size/2), size);
+	quad_tree = new brush_quad_node_c(-(size/2), -(size/2), size);
 }
 
-static void CSG_DeleteQuadTree()
+
+csg_level_c::~csg_level_c()
 {
-	delete brush_quad_tree;
+	unsigned int k;
 
-	brush_quad_tree = NULL;
+	for (k = 0 ; k < brushes.size() ; k++)
+		delete brushes[k];
+
+	for (k = 0 ; k < entities.size() ; k++)
+		delete entities[k];
+
+	for (k = 0 ; k < mapmodels.size() ; k++)
+		delete mapmodels[k];
+
+	std::map< std::string, csg_property_set_c *>::iterator TPI;
+
+	for (TPI = tex_props.begin() ; TPI != tex_props.end() ; TPI++)
+		delete TPI->second;
+
+	delete quad_tree;
+
+	FreeSpotBlockers();
 }
 
 
@@ -1104,17 +1066,128 @@ static int Grab_CoordList(lua_State *L, int stack_pos, csg_brush_c *B)
 }
 
 
+//------------------------------------------------------------------------
+//  LEVEL CACHE KEY
+//------------------------------------------------------------------------
+
+static void Hash_Properties(csg_property_set_c *props)
+{
+	csg_property_set_c::iterator PI;
+
+	for (PI = props->begin() ; PI != props->end() ; PI++)
+	{
+		Cache_HashString(PI->first.c_str());
+		Cache_HashString(PI->second.c_str());
+	}
+
+	// terminate the set
+	Cache_HashString("");
+}
+
+
+static void Hash_UVMatrix(const uv_matrix_c *uv_mat)
+{
+	if (uv_mat)
+	{
+		Cache_HashData(uv_mat->s, sizeof(uv_mat->s));
+		Cache_HashData(uv_mat->t, sizeof(uv_mat->t));
+	}
+	else
+	{
+		Cache_HashString("-");
+	}
+}
+
+
+static void Hash_BrushPlane(brush_plane_c *P)
+{
+	Cache_HashNumber(P->z);
+
+	if (P->slope)
+	{
+		const quake_plane_c *SL = P->slope;
+
+		float raw[6] = { SL->x, SL->y, SL->z, SL->nx, SL->ny, SL->nz };
+
+		Cache_HashData(raw, sizeof(raw));
+	}
+
+	Hash_Properties(&P->face);
+	Hash_UVMatrix(P->uv_mat);
+}
+
+
+static void Hash_Brush(csg_brush_c *B)
+{
+	Cache_HashString("brush");
+
+	int info[3] = { B->bkind, B->bflags, (int)B->verts.size() };
+
+	Cache_HashData(info, sizeof(info));
+
+	Hash_Properties(&B->props);
+
+	for (unsigned int k = 0 ; k < B->verts.size() ; k++)
+	{
+		brush_vert_c *V = B->verts[k];
+
+		Cache_HashNumber(V->x);
+		Cache_HashNumber(V->y);
+
+		Hash_Properties(&V->face);
+		Hash_UVMatrix(V->uv_mat);
+	}
+
+	Hash_BrushPlane(&B->b);
+	Hash_BrushPlane(&B->t);
+}
+
+
+static void Hash_Entity(csg_entity_c *E)
+{
+	Cache_HashString("entity");
+	Cache_HashString(E->id.c_str());
+
+	Cache_HashNumber(E->x);
+	Cache_HashNumber(E->y);
+	Cache_HashNumber(E->z);
+
+	Hash_Properties(&E->props);
+}
+
+
+static void Hash_TexProperties()
+{
+	std::map< std::string, csg_property_set_c *>::iterator TPI;
+
+	for (TPI = cur_level->tex_props.begin() ; TPI != cur_level->tex_props.end() ; TPI++)
+	{
+		Cache_HashString(TPI->first.c_str());
+
+		Hash_Properties(TPI->second);
+	}
+}
+
+
+//------------------------------------------------------------------------
+
 // LUA: begin_level()
 //
 int CSG_begin_level(lua_State *L)
 {
 	SYS_ASSERT(game_object);
 
-	CSG_Main_Free();
+	// an unfinished level (after a script error) is simply dropped
+	delete cur_level;
+
+	cur_level = new csg_level_c;
 
-	game_object->BeginLevel();
+	spot_low_h  = 72;
+	spot_high_h = 128;
+
+	Cache_BeginLevel();
 
-	CSG_CreateQuadTree();
+	game_object->BeginLevel(cur_level);
 
 	return 0;
 }
@@ -1126,62 +1199,138 @@ int CSG_end_level(lua_State *L)
 {
 	SYS_ASSERT(game_object);
 
-	game_object->EndLevel();
+	if (! cur_level)
+		return luaL_error(L, "gui.end_level: no level was begun");
 
-	CSG_Main_Free();
+	if (Cache_Enabled())
+		Hash_TexProperties();
 
-	CSG_BSP_Free();
+	const char *cache_key = Cache_LevelKey();
+
+	csg_level_c *lev = cur_level;
+
+	cur_level = NULL;
+
+	if (Pipeline_Active())
+		Pipeline_QueueLevel(lev, cache_key);
+	else
+		CSG_FinishLevel(lev, cache_key);
+
+	StringFree(cache_key);
 
 	return 0;
 }
 
 
-// LUA: property(key, value)
-//
-int CSG_property(lua_State *L)
+static void CSG_ApplyProperty(const char *key, const char *value)
 {
-	const char *key   = luaL_checkstring(L,1);
-	const char *value = luaL_checkstring(L,2);
+	if (StringCaseCmp(key, "chunk_size") == 0)
+	{
+		CHUNK_SIZE = atof(value);
+		return;
+	}
+	else if (StringCaseCmp(key, "cluster_size") == 0)
+	{
+		CLUSTER_SIZE = atof(value);
+		return;
+	}
+
+	if (QLIT_ParseProperty(key, value))
+		return;
+
+	SYS_ASSERT(game_object);
+
+	game_object->Property(key, value);
+}
+
+
+void CSG_FinishLevel(csg_level_c *lev, const char *cache_key)
+{
+	SYS_ASSERT(game_object);
+
+	cur_level = lev;
+
+	CHUNK_SIZE = 512.0;
+
+	for (unsigned int i = 0 ; i < lev->props.size() ; i++)
+		CSG_ApplyProperty(lev->props[i].first.c_str(), lev->props[i].second.c_str());
+
+	Cache_UseKey(cache_key);
+
+	game_object->EndLevel(lev);
+
+	Cache_EndLevel();
+
+	CSG_BSP_Free();
+
+	delete lev;
+
+	cur_level = NULL;
+}
+
+
+void CSG_SetProperty(const char *key, const char *value)
+{
+	Cache_Property(key, value);
 
 	// eat propertities intended for CSG2
 
-	if (strcmp(key, "error_tex") == 0)
+	if (cur_level && strcmp(key, "level_name") == 0)
 	{
-		dummy_wall_tex = std::string(value);
-		return 0;
+		cur_level->name = std::string(value);
+		return;
 	}
-	else if (strcmp(key, "error_flat") == 0)
+	else if (cur_level && strcmp(key, "description") == 0)
 	{
-		dummy_plane_tex = std::string(value);
-		return 0;
+		cur_level->description = std::string(value);
+		return;
+	}
+	else if (cur_level && strcmp(key, "error_tex") == 0)
+	{
+		cur_level->dummy_wall_tex = std::string(value);
+		return;
+	}
+	else if (cur_level && strcmp(key, "error_flat") == 0)
+	{
+		cur_level->dummy_plane_tex = std::string(value);
+		return;
 	}
 	else if (strcmp(key, "spot_low_h") == 0)
 	{
 		spot_low_h = atoi(value);
-		return 0;
+		return;
 	}
 	else if (strcmp(key, "spot_high_h") == 0)
 	{
 		spot_high_h = atoi(value);
-		return 0;
-	}
-	else if (StringCaseCmp(key, "chunk_size") == 0)
-	{
-		CHUNK_SIZE = atof(value);
-		return 0;
+		return;
 	}
-	else if (StringCaseCmp(key, "cluster_size") == 0)
+
+	// the rest are for the back-end.  While a level is being made
+	// they are kept with it, and take effect when the back-end of
+	// that level begins (which may be later, in another thread).
+
+	if (cur_level)
 	{
-		CLUSTER_SIZE = atof(value);
-		return 0;
+		cur_level->props.push_back(std::make_pair(std::string(key), std::string(value)));
+		return;
 	}
 
-	if (QLIT_ParseProperty(key, value))
-		return 0;
+	// otherwise wait until no back-end is running
+	Pipeline_Sync();
 
-	SYS_ASSERT(game_object);
+	CSG_ApplyProperty(key, value);
+}
 
-	game_object->Property(key, value);
+
+// LUA: property(key, value)
+//
+int CSG_property(lua_State *L)
+{
+	const char *key   = luaL_checkstring(L,1);
+	const char *value = luaL_checkstring(L,2);
+
+	CSG_SetProperty(key, value);
 
 	return 0;
 }
@@ -1195,17 +1344,20 @@ int CSG_tex_property(lua_State *L)
 	const char *key     = luaL_checkstring(L,2);
 	const char *value   = luaL_checkstring(L,3);
 
+	if (! cur_level)
+		return luaL_error(L, "gui.tex_property: no current level");
+
 	csg_property_set_c *props = NULL;
 
 	std::map< std::string, csg_property_set_c *>::iterator TPI;
 
-	TPI = all_tex_props.find(std::string(texture));
+	TPI = cur_level->tex_props.find(std::string(texture));
 
-	if (TPI == all_tex_props.end())
+	if (TPI == cur_level->tex_props.end())
 	{
 		props = new csg_property_set_c;
 
-		all_tex_props[std::string(texture)] = props;
+		cur_level->tex_props[std::string(texture)] = props;
 	}
 	else
 	{
@@ -1254,13 +1406,22 @@ int CSG_tex_property(lua_State *L)
 //
 int CSG_add_brush(lua_State *L)
 {
+	if (! cur_level)
+		return luaL_error(L, "gui.add_brush: no current level");
+
 	csg_brush_c *B = new csg_brush_c();
 
 	Grab_CoordList(L, 1, B);
 
-	all_brushes.push_back(B);
+	if (Cache_Enabled())
+		Hash_Brush(B);
+
+	cur_level->brushes.push_back(B);
+
+	cur_level->quad_tree->Add(B);
 
-	brush_quad_tree->Add(B);
+	// spot info needs to be collected again
+	cur_level->FreeSpotBlockers();
 
 	return 0;
 }
@@ -1278,6 +1439,9 @@ int CSG_add_brush(lua_State *L)
 //
 int CSG_add_entity(lua_State *L)
 {
+	if (! cur_level)
+		return luaL_error(L, "gui.add_entity: no current level");
+
 	csg_entity_c *E = new csg_entity_c();
 
 	Grab_Properties(L, 1, &E->props);
@@ -1292,7 +1456,10 @@ int CSG_add_entity(lua_State *L)
 	E->props.Remove("id"); E->props.Remove("x");
 	E->props.Remove("y");  E->props.Remove("z");
 
-	all_entities.push_back(E);
+	if (Cache_Enabled())
+		Hash_Entity(E);
+
+	cur_level->entities.push_back(E);
 
 	return 0;
 }
@@ -1332,9 +1499,10 @@ int CSG_trace_ray(lua_State *L)
 		return luaL_argerror(L, 7, "gui.trace_ray: bad mode string");
 	}
 
-	SYS_ASSERT(brush_quad_tree);
+	if (! cur_level)
+		return luaL_error(L, "gui.trace_ray: no current level");
 
-	bool result = brush_quad_tree->TraceRay(x1, y1, z1, x2, y2, z2, mode);
+	bool result = cur_level->quad_tree->TraceRay(x1, y1, z1, x2, y2, z2, mode);
 
 	lua_pushboolean(L, result ? 1 : 0);
 	return 1;
@@ -1344,9 +1512,9 @@ int CSG_trace_ray(lua_State *L)
 bool CSG_TraceRay(double x1, double y1, double z1,
 				  double x2, double y2, double z2, const char *mode)
 {
-	SYS_ASSERT(brush_quad_tree);
+	SYS_ASSERT(cur_level);
 
-	return brush_quad_tree->TraceRay(x1, y1, z1, x2, y2, z2, mode);
+	return cur_level->quad_tree->TraceRay(x1, y1, z1, x2, y2, z2, mode);
 }
 
 
@@ -1360,57 +1528,230 @@ int CSG_BrushContents(double x, double y, double z, double *liquid_depth)
 	// indicates either the point is in the AIR, or the point
 	// is completely outside of the map.
 
-	SYS_ASSERT(brush_quad_tree);
+	SYS_ASSERT(cur_level);
 
 	int result = -1;
 
-	brush_quad_tree->BrushContents(x, y, z, &result, liquid_depth);
+	cur_level->quad_tree->BrushContents(x, y, z, &result, liquid_depth);
 
 	return result;
 }
 
 
-void CSG_spot_processing(int x1, int y1, int x2, int y2, int floor_h)
+//------------------------------------------------------------------------
+//  SPOT BLOCKERS
+//------------------------------------------------------------------------
+
+// The spot code (csg_spots.cc) needs the solid brushes near each floor
+// area.  Rather than walk the quad-tree and look up the 'delta_z'
+// properties for every area, the info for each brush is collected once
+// per level (after all brushes are in) and stored in a simple grid of
+// buckets.  Any new brush throws the collected info away.
+// The info is kept in the csg_level_c class.
+
+#define SPOT_BUCKET_SIZE  512
+
+class spot_blocker_c
+{
+public:
+	double min_x, min_y;
+	double max_x, max_y;
+
+	int t_z, b_z;
+
+	// polygon, rounded to integer
+	std::vector<int> shape;
+};
+
+
+void csg_level_c::FreeSpotBlockers()
 {
-	brush_quad_tree->SpotStuff(x1, y1, x2, y2, floor_h);
+	for (unsigned int k = 0 ; k < spot_blockers.size() ; k++)
+		delete spot_blockers[k];
+
+	spot_blockers.clear();
+	spot_buckets .clear();
+
+	spot_blockers_valid = false;
 }
 
 
-//------------------------------------------------------------------------
+static inline int SpotBucketCoord(double v)
+{
+	return (int)floor(v / SPOT_BUCKET_SIZE);
+}
 
-csg_property_set_c * CSG_LookupTexProps(const char *name)
+
+static void CSG_CollectSpotBlockers(csg_level_c *lev)
 {
-	std::map< std::string, csg_property_set_c *>::iterator TPI;
+	lev->FreeSpotBlockers();
 
-	TPI = all_tex_props.find(std::string(name));
+	lev->spot_blockers_valid = true;
 
-	if (TPI == all_tex_props.end())
-		return NULL;
+	std::vector<spot_blocker_c *>& spot_blockers = lev->spot_blockers;
 
-	SYS_ASSERT(TPI->second);
+	for (unsigned int k = 0 ; k < lev->brushes.size() ; k++)
+	{
+		const csg_brush_c *B = lev->brushes[k];
 
-	return TPI->second;
+		// ignore non-solid brushes
+		if (B->bkind != BKIND_Solid || (B->bflags & BFLAG_NoClip))
+			continue;
+
+		spot_blocker_c *SB = new spot_blocker_c;
+
+		SB->min_x = B->min_x;  SB->max_x = B->max_x;
+		SB->min_y = B->min_y;  SB->max_y = B->max_y;
+
+		double t_delta = B->t.face.getDouble("delta_z", 0);
+		double b_delta = B->b.face.getDouble("delta_z", 0);
+
+		SB->t_z = I_ROUND(B->t.z + t_delta);
+		SB->b_z = I_ROUND(B->b.z + b_delta);
+
+		for (unsigned int i = 0 ; i < B->verts.size() ; i++)
+		{
+			const brush_vert_c *V = B->verts[i];
+
+			// rounding to integer here, I don't think it is any problem,
+			// as the spot polygon-drawing code is fairly robust.
+			SB->shape.push_back(I_ROUND(V->x));
+			SB->shape.push_back(I_ROUND(V->y));
+		}
+
+		spot_blockers.push_back(SB);
+	}
+
+	if (spot_blockers.empty())
+		return;
+
+	// determine size of the bucket grid
+	int bx1 = +999999, by1 = +999999;
+	int bx2 = -999999, by2 = -999999;
+
+	for (unsigned int k = 0 ; k < spot_blockers.size() ; k++)
+	{
+		const spot_blocker_c *SB = spot_blockers[k];
+
+		bx1 = MIN(bx1, SpotBucketCoord(SB->min_x));
+		by1 = MIN(by1, SpotBucketCoord(SB->min_y));
+		bx2 = MAX(bx2, SpotBucketCoord(SB->max_x));
+		by2 = MAX(by2, SpotBucketCoord(SB->max_y));
+	}
+
+	lev->spot_bk_x = bx1;
+	lev->spot_bk_y = by1;
+	lev->spot_bk_w = bx2 - bx1 + 1;
+	lev->spot_bk_h = by2 - by1 + 1;
+
+	lev->spot_buckets.resize(lev->spot_bk_w * lev->spot_bk_h);
+
+	for (unsigned int k = 0 ; k < spot_blockers.size() ; k++)
+	{
+		const spot_blocker_c *SB = spot_blockers[k];
+
+		int sx1 = SpotBucketCoord(SB->min_x) - lev->spot_bk_x;
+		int sy1 = SpotBucketCoord(SB->min_y) - lev->spot_bk_y;
+		int sx2 = SpotBucketCoord(SB->max_x) - lev->spot_bk_x;
+		int sy2 = SpotBucketCoord(SB->max_y) - lev->spot_bk_y;
+
+		for (int by = sy1 ; by <= sy2 ; by++)
+		for (int bx = sx1 ; bx <= sx2 ; bx++)
+			lev->spot_buckets[by * lev->spot_bk_w + bx].push_back(k);
+	}
 }
 
 
-static void CSG_FreeTexProps()
+static void SpotTestBlocker(const spot_blocker_c *SB,
+							int x1, int y1, int x2, int y2, int floor_h)
 {
-	std::map< std::string, csg_property_set_c *>::iterator TPI;
+	// bbox check (skip if merely touching the bbox)
+	if (SB->max_x <= x1 || SB->min_x >= x2 ||
+		SB->max_y <= y1 || SB->min_y >= y2)
+		return;
+
+	// skip brushes underneath the floor (or the floor itself)
+	if (SB->t_z < floor_h + 1)
+		return;
+
+	// skip brushes far above the floor (like ceilings)
+	if (SB->b_z >= floor_h + spot_high_h)
+		return;
+
+	/* this brush is a potential blocker */
+
+	int content = SPOT_LEDGE;
+
+	if (SB->b_z >= floor_h + spot_low_h)
+		content = SPOT_LOW_CEIL;
+
+	else if (SB->b_z <= floor_h && SB->t_z >= floor_h + spot_low_h)
+		content = SPOT_WALL;
+
+	SPOT_FillPolygon(content, &SB->shape[0], (int)SB->shape.size() / 2);
+}
+
+
+void CSG_spot_processing(int x1, int y1, int x2, int y2, int floor_h)
+{
+	csg_level_c *lev = cur_level;
+
+	SYS_ASSERT(lev);
+
+	if (! lev->spot_blockers_valid)
+		CSG_CollectSpotBlockers(lev);
+
+	if (lev->spot_blockers.empty())
+		return;
+
+	int bx1 = MAX(SpotBucketCoord(x1) - lev->spot_bk_x, 0);
+	int by1 = MAX(SpotBucketCoord(y1) - lev->spot_bk_y, 0);
+	int bx2 = MIN(SpotBucketCoord(x2) - lev->spot_bk_x, lev->spot_bk_w - 1);
+	int by2 = MIN(SpotBucketCoord(y2) - lev->spot_bk_y, lev->spot_bk_h - 1);
 
-	for (TPI = all_tex_props.begin() ; TPI != all_tex_props.end() ; TPI++)
+	// a brush can be in several buckets, so gather and sort them
+	// (which also keeps the brushes in their original order).
+	std::vector<int> list;
+
+	for (int by = by1 ; by <= by2 ; by++)
+	for (int bx = bx1 ; bx <= bx2 ; bx++)
 	{
-		delete TPI->second;
+		const std::vector<int>& bucket = lev->spot_buckets[by * lev->spot_bk_w + bx];
+
+		list.insert(list.end(), bucket.begin(), bucket.end());
 	}
 
-	all_tex_props.clear();
+	std::sort(list.begin(), list.end());
+
+	list.erase(std::unique(list.begin(), list.end()), list.end());
+
+	for (unsigned int i = 0 ; i < list.size() ; i++)
+		SpotTestBlocker(lev->spot_blockers[list[i]], x1, y1, x2, y2, floor_h);
+}
+
+
+//------------------------------------------------------------------------
+
+csg_property_set_c * CSG_LookupTexProps(const char *name)
+{
+	std::map< std::string, csg_property_set_c *>::iterator TPI;
+
+	TPI = cur_level->tex_props.find(std::string(name));
+
+	if (TPI == cur_level->tex_props.end())
+		return NULL;
+
+	SYS_ASSERT(TPI->second);
+
+	return TPI->second;
 }
 
 
 void CSG_LinkBrushToEntity(csg_brush_c *B, const char *link_key)
 {
-	for (unsigned int k = 0 ; k < all_entities.size() ; k++)
+	for (unsigned int k = 0 ; k < cur_level->entities.size() ; k++)
 	{
-		csg_entity_c *E = all_entities[k];
+		csg_entity_c *E = cur_level->entities[k];
 
 		const char *E_key = E->props.getStr("link_id");
 
@@ -1432,32 +1773,5 @@ void CSG_LinkBrushToEntity(csg_brush_c *B, const char *link_key)
 }
 
 
-void CSG_Main_Free()
-{
-	unsigned int k;
-
-	for (k = 0 ; k < all_brushes.size() ; k++)
-		delete all_brushes[k];
-
-	for (k = 0 ; k < all_entities.size() ; k++)
-		delete all_entities[k];
-
-	all_brushes .clear();
-	all_entities.clear();
-
-	CSG_FreeTexProps();
-
-	CSG_DeleteQuadTree();
-
-	dummy_wall_tex .clear();
-	dummy_plane_tex.clear();
-
-	spot_low_h  = 72;
-	spot_high_h = 128;
-
-	CHUNK_SIZE  = 512.0;
-}
-
-
 //--- editor settings ---
 // vi:ts=4:sw=4:noexpandtab
@@ -25,6 +25,10 @@ class csg_brush_c;
 class csg_entity_c;
 class quake_plane_c;
 
+class brush_quad_node_c;
+class spot_blocker_c;
+class quake_mapmodel_c;
+
 
 // very high (low) value for uncapped brushes
 #define EXTREME_H  32000
@@ -247,19 +251,61 @@ public:
 
 
 
-/***** VARIABLES ****************/
+class csg_level_c
+{
+	// This holds everything which the scripts create for a single
+	// level, which the back-end (CSG, nodes, vis, lighting) then
+	// turns into the game's format.  The back-end only uses the
+	// level which is current for its thread (cur_level), hence one
+	// level can be finished while the next one is being made.
 
-extern std::vector<csg_brush_c *> all_brushes;
+public:
+	std::string name;
+	std::string description;
 
-extern std::vector<csg_entity_c *> all_entities;
+	std::vector<csg_brush_c *>  brushes;
+	std::vector<csg_entity_c *> entities;
 
-extern std::string dummy_wall_tex;
-extern std::string dummy_plane_tex;
+	std::map< std::string, csg_property_set_c *> tex_props;
 
+	// textures used for missing stuff
+	std::string dummy_wall_tex;
+	std::string dummy_plane_tex;
 
-/***** FUNCTIONS ****************/
+	// properties for the back-end, set while this level was made.
+	// they take effect when the back-end of the level begins, in
+	// the same order as they were set (the order can matter).
+	std::vector< std::pair<std::string, std::string> > props;
+
+	// map-models (Quake 1 and 2)
+	std::vector<quake_mapmodel_c *> mapmodels;
+
+	brush_quad_node_c * quad_tree;
+
+	// solid brushes collected for the spot code
+	std::vector<spot_blocker_c *> spot_blockers;
+	std::vector< std::vector<int> > spot_buckets;
+
+	int  spot_bk_x, spot_bk_y;
+	int  spot_bk_w, spot_bk_h;
+
+	bool spot_blockers_valid;
+
+public:
+	 csg_level_c();
+	~csg_level_c();
+
+	void FreeSpotBlockers();
+};
+
+
+/***** VARIABLES ****************/
 
-void CSG_Main_Free();
+// the level which the current thread is working on, NULL if none
+extern thread_local csg_level_c * cur_level;
+
+
+/***** FUNCTIONS ****************/
 
 bool CSG_TraceRay(double x1, double y1, double z1,
 				  double x2, double y2, double z2, const char *mode);
@@ -268,6 +314,13 @@ int CSG_BrushContents(double x, double y, double z, double *liquid_depth = NULL)
 
 csg_property_set_c * CSG_LookupTexProps(const char *name);
 
+void CSG_SetProperty(const char *key, const char *value);
+
+// runs the back-end on a level which the scripts have finished, then
+// deletes it.  Normally done by gui.end_level(), but a pipelined build
+// does it later in another thread (see m_pipeline.cc).
+void CSG_FinishLevel(csg_level_c *lev, const char *cache_key);
+
 void CSG_LinkBrushToEntity(csg_brush_c *B, const char *link_key);
 
 
@@ -209,10 +209,10 @@ public:
 
 
 
-static std::vector<nukem_wall_c *>   nk_all_walls;
-static std::vector<nukem_sector_c *> nk_all_sectors;
+static thread_local std::vector<nukem_wall_c *>   nk_all_walls;
+static thread_local std::vector<nukem_sector_c *> nk_all_sectors;
 
-static int nk_current_wall;
+static thread_local int nk_current_wall;
 
 
 //------------------------------------------------------------------------
@@ -255,7 +255,7 @@ static void NK_MakeBasicWall(nukem_sector_c *S, snag_c *snag)
 
 static void NK_GetPlaneInfo(nukem_plane_c *P, csg_property_set_c *face)
 {
-	P->pic = atoi(face->getStr("tex", dummy_plane_tex.c_str()));
+	P->pic = atoi(face->getStr("tex", cur_level->dummy_plane_tex.c_str()));
 
 	// FIXME: other floor / ceiling stuff
 
@@ -504,7 +504,7 @@ static void LightingFloodFill(void)
 
 static void NK_GetFaceProps(nukem_wall_c *W, csg_property_set_c *face)
 {
-	const char *tex_name = dummy_wall_tex.c_str();
+	const char *tex_name = cur_level->dummy_wall_tex.c_str();
 
 	if (face)
 	{
@@ -30,6 +30,7 @@
 #include "lib_util.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_lua.h"
 
 #include "q_common.h"
@@ -54,12 +55,13 @@ double q3_default_tex_scale = 1.0 / 128.0;
 //  NEW LOGIC
 //------------------------------------------------------------------------
 
-quake_node_c * qk_bsp_root;
-quake_leaf_c * qk_solid_leaf;
+// the BSP being built belongs to the thread building the level
 
-std::vector<quake_face_c *>     qk_all_faces;
-std::vector<quake_mapmodel_c *> qk_all_mapmodels;
-std::vector<quake_leaf_c *>     qk_all_detail_models;  // Q3 only
+thread_local quake_node_c * qk_bsp_root;
+thread_local quake_leaf_c * qk_solid_leaf;
+
+thread_local std::vector<quake_face_c *>     qk_all_faces;
+thread_local std::vector<quake_leaf_c *>     qk_all_detail_models;  // Q3 only
 
 
 class quake_side_c
@@ -2564,11 +2566,11 @@ static void FilterDetailBrushes()
 	// completely ignored, and insert them into the leafs of our
 	// quakey BSP tree.  [ Quake 3 only ]
 
-	for (unsigned int k = 0 ; k < all_brushes.size() ; k++)
+	for (unsigned int k = 0 ; k < cur_level->brushes.size() ; k++)
 	{
 		leaf_map_t touched_leafs;
 
-		csg_brush_c *B = all_brushes[k];
+		csg_brush_c *B = cur_level->brushes[k];
 
 		if ((B->bflags & BFLAG_Detail) && !B->link_ent)
 		{
@@ -2630,9 +2632,9 @@ static void Model_ProcessEntity(csg_entity_c *E)
 	leaf->bbox.Begin();
 
 	// process all brushes associated with this entity
-	for (unsigned int i = 0 ; i < all_brushes.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->brushes.size() ; i++)
 	{
-		csg_brush_c *B = all_brushes[i];
+		csg_brush_c *B = cur_level->brushes[i];
 
 		if (B->link_ent == E)
 			Model_ProcessBrush(leaf, B);
@@ -2660,9 +2662,9 @@ static void ProcessDetailModels()
 {
 	// create all the map-models  [ Quake 3 only ]
 
-	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->entities.size() ; i++)
 	{
-		Model_ProcessEntity(all_entities[i]);
+		Model_ProcessEntity(cur_level->entities[i]);
 	}
 }
 
@@ -2671,13 +2673,11 @@ void CSG_QUAKE_Build()
 {
 	LogPrintf("QUAKE CSG...\n");
 
-	if (main_win)
-		main_win->build_box->Prog_Step("CSG");
+	Main_ProgStep("CSG");
 
 	CSG_BSP(1.0);
 
-	if (main_win)
-		main_win->build_box->Prog_Step("BSP");
+	Main_ProgStep("BSP");
 
 
 	quake_group_c GROUP;
@@ -2730,14 +2730,10 @@ void CSG_QUAKE_Free()
 	for (i = 0 ; i < qk_all_faces.size() ; i++)
 		delete qk_all_faces[i];
 
-	for (i = 0 ; i < qk_all_mapmodels.size() ; i++)
-		delete qk_all_mapmodels[i];
-
 	for (i = 0 ; i < qk_all_detail_models.size() ; i++)
 		delete qk_all_detail_models[i];
 
 	qk_all_faces.clear();
-	qk_all_mapmodels.clear();
 	qk_all_detail_models.clear();
 }
 
@@ -2764,9 +2760,15 @@ int Q1_add_mapmodel(lua_State *L)
 	if (lua_type(L, 1) != LUA_TTABLE)
 		return luaL_argerror(L, 1, "missing table: mapmodel info");
 
+	if (! cur_level)
+		return luaL_error(L, "gui.q1_add_mapmodel: no level was begun");
+
+	// the map-model info is not part of the level cache key
+	Cache_SkipLevel();
+
 	quake_mapmodel_c *model = new quake_mapmodel_c;
 
-	qk_all_mapmodels.push_back(model);
+	cur_level->mapmodels.push_back(model);
 
 	lua_getfield(L, 1, "x1");
 	lua_getfield(L, 1, "y1");
@@ -2800,7 +2802,7 @@ int Q1_add_mapmodel(lua_State *L)
 
 	// create model reference (for entity)
 	char ref_name[32];
-	sprintf(ref_name, "*%lu", (long unsigned int)qk_all_mapmodels.size());
+	sprintf(ref_name, "*%lu", (long unsigned int)cur_level->mapmodels.size());
 
 	lua_pushstring(L, ref_name);
 	return 1;
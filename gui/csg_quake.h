@@ -172,10 +172,14 @@ public:
 		node(NULL), leaf(NULL), node_side(-1),
 		verts(), texture(),
 		flags(0), lmap(NULL), index(-1)
-	{ }
+	{
+		MemTag_Add(MEM_QuakeFaces, sizeof(quake_face_c));
+	}
 
 	~quake_face_c()
-	{ }
+	{
+		MemTag_Add(MEM_QuakeFaces, -(long)sizeof(quake_face_c));
+	}
 
 	void AddVert(float x, float y, float z);
 
@@ -325,17 +329,18 @@ public:
 
 /***** VARIABLES ****************/
 
-extern quake_node_c * qk_bsp_root;
+// these are per-thread, see cur_level
+
+extern thread_local quake_node_c * qk_bsp_root;
 
 // this only used for Quake1 and closely related games
-extern quake_leaf_c * qk_solid_leaf;
+extern thread_local quake_leaf_c * qk_solid_leaf;
 
 // this not used for Quake3 handling
-extern quake_mapmodel_c * qk_world_model;
+extern thread_local quake_mapmodel_c * qk_world_model;
 
-extern std::vector<quake_face_c *>     qk_all_faces;
-extern std::vector<quake_mapmodel_c *> qk_all_mapmodels;
-extern std::vector<quake_leaf_c *>     qk_all_detail_models;  // Q3 only
+extern thread_local std::vector<quake_face_c *>     qk_all_faces;
+extern thread_local std::vector<quake_leaf_c *>     qk_all_detail_models;  // Q3 only
 
 
 /***** FUNCTIONS ****************/
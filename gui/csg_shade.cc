@@ -84,7 +84,7 @@ Lighting Model
 #define DEFAULT_AMBIENT_LEVEL  144
 
 
-static int current_region_group;
+static thread_local int current_region_group;
 
 
 #if 0   // DISABLED, WE DO TORCH RAY-TRACING IN LUA CODE
@@ -44,22 +44,31 @@
 #define IS_DUD     0x40
 
 
-static int grid_min_x, grid_min_y;
-static int grid_max_x, grid_max_y;
+// the grid is per-thread, each thread building a level has its own
 
-static int grid_floor_h;
+static thread_local int grid_min_x, grid_min_y;
+static thread_local int grid_max_x, grid_max_y;
+
+static thread_local int grid_floor_h;
 
 extern int spot_low_h;
 extern int spot_high_h;
 
 
 // number of grid squares
-static int grid_W, grid_H;
+static thread_local int grid_W, grid_H;
+
+// the cells, stored row by row
+static thread_local byte * spot_grid;
+
+static thread_local int * grid_lefties;
+static thread_local int * grid_righties;
 
-static byte ** spot_grid;
 
-static int * grid_lefties;
-static int * grid_righties;
+static inline byte & grid_cell(int x, int y)
+{
+	return spot_grid[y * grid_W + x];
+}
 
 
 // declare this here (don't pull in all CSG headers)
@@ -85,14 +94,9 @@ void SPOT_CreateGrid(byte content, int min_x, int min_y, int max_x, int max_y)
 	grid_H += 2;
 #endif
 
-	spot_grid = new byte* [grid_W];
-
-	for (int x = 0 ; x < grid_W ; x++)
-	{
-		spot_grid[x] = new byte[grid_H];
+	spot_grid = new byte[grid_W * grid_H];
 
-		memset(spot_grid[x], content, grid_H);
-	}
+	memset(spot_grid, content, grid_W * grid_H);
 
 	grid_lefties  = new int[grid_H];
 	grid_righties = new int[grid_H];
@@ -101,15 +105,13 @@ void SPOT_CreateGrid(byte content, int min_x, int min_y, int max_x, int max_y)
 
 void SPOT_FreeGrid()
 {
-	if (spot_grid)
-	{
-		for (int x = 0 ; x < grid_W ; x++)
-			delete[] spot_grid[x];
-
-		delete[] spot_grid;
+	delete[] spot_grid;
+	delete[] grid_lefties;
+	delete[] grid_righties;
 
-		spot_grid = NULL;
-	}
+	spot_grid     = NULL;
+	grid_lefties  = NULL;
+	grid_righties = NULL;
 }
 
 
@@ -128,7 +130,7 @@ void SPOT_DumpGrid(const char *info)
 
 		for (int x = 0 ; x < width ; x++)
 		{
-			byte content = spot_grid[x][y];
+			byte content = grid_cell(x, y);
 
 			if (content & HAS_MON)
 				buffer[x] = 'm';
@@ -179,7 +181,7 @@ static void test_item_spot(int x, int y, std::vector<grid_point_c> & spots)
 	for (int dx = 0 ; dx < 2 ; dx++)
 	for (int dy = 0 ; dy < 2 ; dy++)
 	{
-		byte content = spot_grid[x+dx][y+dy];
+		byte content = grid_cell(x+dx, y+dy);
 
 		if (content & (7 | HAS_ITEM))
 			return; // no good, something in the way
@@ -203,20 +205,19 @@ static void test_item_spot(int x, int y, std::vector<grid_point_c> & spots)
 	spots.push_back(grid_point_c(real_x, real_y));
 
 	// reserve these cells, prevent overlapping item spots
-	spot_grid[x+0][y+0] |= HAS_ITEM;
-	spot_grid[x+0][y+1] |= HAS_ITEM;
-	spot_grid[x+1][y+0] |= HAS_ITEM;
-	spot_grid[x+1][y+1] |= HAS_ITEM;
+	grid_cell(x+0, y+0) |= HAS_ITEM;
+	grid_cell(x+0, y+1) |= HAS_ITEM;
+	grid_cell(x+1, y+0) |= HAS_ITEM;
+	grid_cell(x+1, y+1) |= HAS_ITEM;
 }
 
 
 static void clean_up_grid()
 {
-	for (int x = 0 ; x < grid_W ; x++)
-	for (int y = 0 ; y < grid_H ; y++)
-	{
-		spot_grid[x][y] &= 7;
-	}
+	int total = grid_W * grid_H;
+
+	for (int i = 0 ; i < total ; i++)
+		spot_grid[i] &= 7;
 }
 
 
@@ -231,16 +232,16 @@ void SPOT_ItemSpots(std::vector<grid_point_c> & spots)
 	int x, y;
 
 	// first, mark squares which are near a wall
-	for (x = 0 ; x < grid_W ; x++)
 	for (y = 0 ; y < grid_H ; y++)
+	for (x = 0 ; x < grid_W ; x++)
 	{
-		if ((spot_grid[x][y] & 3) == SPOT_WALL)
+		if ((grid_cell(x, y) & 3) == SPOT_WALL)
 		{
-			if (x > 0)  spot_grid[x-1][y] |= NEAR_WALL;
-			if (x < w2) spot_grid[x+1][y] |= NEAR_WALL;
+			if (x > 0)  grid_cell(x-1, y) |= NEAR_WALL;
+			if (x < w2) grid_cell(x+1, y) |= NEAR_WALL;
 
-			if (y > 0)  spot_grid[x][y-1] |= NEAR_WALL;
-			if (y < h2) spot_grid[x][y+1] |= NEAR_WALL;
+			if (y > 0)  grid_cell(x, y-1) |= NEAR_WALL;
+			if (y < h2) grid_cell(x, y+1) |= NEAR_WALL;
 		}
 	}
 
@@ -255,30 +256,113 @@ void SPOT_ItemSpots(std::vector<grid_point_c> & spots)
 //----------------------------------------------------------------------
 
 
-static void remove_dud_cells()
+// The monster spot finder keeps a bit-plane of the grid (row by row),
+// where a set bit means the cell is usable for the current 'want'
+// value : no monster, not a dud, and ceiling not too low.  This lets
+// test_mon_area() check a whole row of cells with a few operations.
+//
+// It also caches the biggest vertical gap in each column, which only
+// needs to be recomputed for columns touched by a new monster spot.
+
+class spot_column_c
 {
-	for (int x = 0 ; x < grid_W ; x++)
+public:
+	bool dirty;
+
+	// best gap, num is zero when none
+	int num;
+	int y1, y2;
+};
+
+
+static thread_local std::vector<u32_t> spot_free_bits;
+
+static thread_local int spot_row_words;
+
+static thread_local std::vector<spot_column_c> spot_columns;
+
+
+static inline bool is_free(int x, int y)
+{
+	return (spot_free_bits[y * spot_row_words + (x >> 5)] >> (x & 31)) & 1;
+}
+
+
+static inline void set_flag(int x, int y, byte flag)
+{
+	grid_cell(x, y) |= flag;
+
+	spot_free_bits[y * spot_row_words + (x >> 5)] &= ~(1u << (x & 31));
+}
+
+
+static void build_free_bits(int want)
+{
+	spot_row_words = (grid_W + 31) >> 5;
+
+	spot_free_bits.assign(spot_row_words * grid_H, 0);
+
 	for (int y = 0 ; y < grid_H ; y++)
+	for (int x = 0 ; x < grid_W ; x++)
 	{
-		spot_grid[x][y] &= ~IS_DUD;
+		byte content = grid_cell(x, y);
+
+		if ((content & (HAS_MON | IS_DUD)) == 0 && (content & 3) <= want)
+			spot_free_bits[y * spot_row_words + (x >> 5)] |= (1u << (x & 31));
 	}
+
+	spot_column_c blank;
+
+	blank.dirty = true;
+	blank.num   = 0;
+	blank.y1    = blank.y2 = 0;
+
+	spot_columns.assign(grid_W, blank);
+}
+
+
+static void remove_dud_cells()
+{
+	int total = grid_W * grid_H;
+
+	for (int i = 0 ; i < total ; i++)
+		spot_grid[i] &= ~IS_DUD;
 }
 
 
-static bool test_mon_area(int x1, int y1, int x2, int y2, int want)
+static bool test_mon_area(int x1, int y1, int x2, int y2)
 {
 	if (x1 < 0 or x2 >= grid_W or y1 < 0 or y2 >= grid_H)
 		return false;
 
-	for (int x = x1 ; x <= x2 ; x++)
+	int w1 = x1 >> 5;
+	int w2 = x2 >> 5;
+
+	u32_t first_mask = ~0u << (x1 & 31);
+	u32_t last_mask  = ~0u >> (31 - (x2 & 31));
+
 	for (int y = y1 ; y <= y2 ; y++)
 	{
-		byte content = spot_grid[x][y];
+		const u32_t *row = &spot_free_bits[y * spot_row_words];
 
-		if (content & (HAS_MON | IS_DUD))
+		if (w1 == w2)
+		{
+			u32_t mask = first_mask & last_mask;
+
+			if ((row[w1] & mask) != mask)
+				return false;
+
+			continue;
+		}
+
+		if ((row[w1] & first_mask) != first_mask)
 			return false;
 
-		if ((content & 3) > want)
+		for (int w = w1 + 1 ; w < w2 ; w++)
+			if (row[w] != ~0u)
+				return false;
+
+		if ((row[w2] & last_mask) != last_mask)
 			return false;
 	}
 
@@ -286,47 +370,68 @@ static bool test_mon_area(int x1, int y1, int x2, int y2, int want)
 }
 
 
-static int biggest_gap(int *y1, int *y2, int want)
+static void scan_column(int x)
 {
 	// Note: this also duds any single square spots, which will never
 	//       get used because they'll never form a 2x2 group.
 
-	int best_x   = -1;
-	int best_num = 0;
+	spot_column_c& col = spot_columns[x];
 
-	for (int x = 0 ; x < grid_W ; x++)
+	col.dirty = false;
+	col.num   = 0;
+
+	int y = 0;
+
+	while (y < grid_H-1)
 	{
-		int y = 0;
+		if (! is_free(x, y))
+		{
+			y++; continue;
+		}
+
+		int ey = y;
+
+		while (ey < grid_H-1 && is_free(x, ey+1))
+			ey++;
+
+		int num = ey - y + 1;
 
-		while (y < grid_H-1)
+		if (num == 1)
 		{
-			if (! test_mon_area(x, y, x, y, want))
-			{
-				y++; continue;
-			}
+			// single squares are useless, remove them now
+			set_flag(x, y, IS_DUD);
+		}
+		else if (num > col.num)
+		{
+			col.num = num;
+			col.y1  = y;
+			col.y2  = ey;
+		}
+
+		y = ey + 1;
+	}
+}
 
-			int ey = y;
 
-			while (ey < grid_H-1 && test_mon_area(x, ey+1, x, ey+1, want))
-				ey++;
+static int biggest_gap(int *y1, int *y2)
+{
+	int best_x   = -1;
+	int best_num = 0;
 
-			int num = ey - y + 1;
+	for (int x = 0 ; x < grid_W ; x++)
+	{
+		spot_column_c& col = spot_columns[x];
 
-			if (num == 1)
-			{
-				// single squares are useless, remove them now
-				spot_grid[x][y] |= IS_DUD;
-			}
-			else if (num > best_num)
-			{
-				best_x   = x;
-				best_num = num;
+		if (col.dirty)
+			scan_column(x);
 
-				*y1 = y;
-				*y2 = ey;
-			}
+		if (col.num > best_num)
+		{
+			best_x   = x;
+			best_num = col.num;
 
-			y = ey + 1;
+			*y1 = col.y1;
+			*y2 = col.y2;
 		}
 	}
 
@@ -334,7 +439,7 @@ static int biggest_gap(int *y1, int *y2, int want)
 }
 
 
-static bool grow_spot(int& x1, int& y1, int& x2, int& y2, int want)
+static bool grow_spot(int& x1, int& y1, int& x2, int& y2)
 {
 	// (passing parameters by reference for nicer code)
 
@@ -343,10 +448,10 @@ static bool grow_spot(int& x1, int& y1, int& x2, int& y2, int want)
 
 	if (x1 == x2 && y1 == y2)
 	{
-		if (test_mon_area(x1, y1, x2+1, y2+1, want)) { x2++; y2++; return true; }
-		if (test_mon_area(x1, y1-1, x2+1, y2, want)) { x2++; y1--; return true; }
-		if (test_mon_area(x1-1, y1, x2, y2+1, want)) { x1--; y2++; return true; }
-		if (test_mon_area(x1-1, y1-1, x2, y2, want)) { x1--; y1--; return true; }
+		if (test_mon_area(x1, y1, x2+1, y2+1)) { x2++; y2++; return true; }
+		if (test_mon_area(x1, y1-1, x2+1, y2)) { x2++; y1--; return true; }
+		if (test_mon_area(x1-1, y1, x2, y2+1)) { x1--; y2++; return true; }
+		if (test_mon_area(x1-1, y1-1, x2, y2)) { x1--; y1--; return true; }
 
 		// return now, will mark this square as a dud
 		return false;
@@ -390,11 +495,11 @@ static bool grow_spot(int& x1, int& y1, int& x2, int& y2, int want)
 
 	for (int pass = 0 ; pass < 4 ; pass++)
 	{
-		if (pass == x1_pass && test_mon_area(x1-1, y1, x1-1, y2, want)) { x1--; return true; }
-		if (pass == x2_pass && test_mon_area(x2+1, y1, x2+1, y2, want)) { x2++; return true; }
+		if (pass == x1_pass && test_mon_area(x1-1, y1, x1-1, y2)) { x1--; return true; }
+		if (pass == x2_pass && test_mon_area(x2+1, y1, x2+1, y2)) { x2++; return true; }
 
-		if (pass == y1_pass && test_mon_area(x1, y1-1, x2, y1-1, want)) { y1--; return true; }
-		if (pass == y2_pass && test_mon_area(x1, y2+1, x2, y2+1, want)) { y2++; return true; }
+		if (pass == y1_pass && test_mon_area(x1, y1-1, x2, y1-1)) { y1--; return true; }
+		if (pass == y2_pass && test_mon_area(x1, y2+1, x2, y2+1)) { y2++; return true; }
 	}
 
 	return false;
@@ -404,9 +509,11 @@ static bool grow_spot(int& x1, int& y1, int& x2, int& y2, int want)
 static void mark_monster(int x1, int y1, int x2, int y2, byte flag)
 {
 	for (int x = x1 ; x <= x2 ; x++)
-	for (int y = y1 ; y <= y2 ; y++)
 	{
-		spot_grid[x][y] |= flag;
+		for (int y = y1 ; y <= y2 ; y++)
+			set_flag(x, y, flag);
+
+		spot_columns[x].dirty = true;
 	}
 }
 
@@ -417,27 +524,29 @@ void SPOT_MonsterSpots(std::vector<grid_point_c> & spots, int want)
 	//   find the biggest vertical gap which is free, and use the
 	//   middle square as our starting point.  Then grow it as much as
 	//   as possible (minimum size is 2x2 squares).
-	//   
+	//
 	//   repeat until no more available.
 
+	build_free_bits(want);
+
 	for (;;)
 	{
 		int x1, x2;
 		int y1=0, y2=0;
 
-		x1 = biggest_gap(&y1, &y2, want);
+		x1 = biggest_gap(&y1, &y2);
 
 		if (x1 < 0)
 			return;
 
 		y1 = (y1 + y2) / 2;
 
-		SYS_ASSERT((spot_grid[x1][y1] & 3) <= want);
+		SYS_ASSERT((grid_cell(x1, y1) & 3) <= want);
 
 		x2 = x1;
 		y2 = y1;
 
-		while (grow_spot(x1,y1, x2,y2, want))
+		while (grow_spot(x1,y1, x2,y2))
 		{ }
 
 		if (x2 > x1 && y2 > y1)
@@ -470,8 +579,8 @@ void SPOT_MonsterSpots(std::vector<grid_point_c> & spots, int want)
 //  POLYGON FILLING
 //------------------------------------------------------------------------
 
-static int grid_toppy;
-static int grid_botty;
+static thread_local int grid_toppy;
+static thread_local int grid_botty;
 
 
 static void clear_rows()
@@ -593,7 +702,7 @@ static void draw_line(int x1, int y1, int x2, int y2)
 
 static inline void replace_cell(int x, int y, byte content)
 {
-	byte& target = spot_grid[x][y];
+	byte& target = grid_cell(x, y);
 
 	// Note : we allow SPOT_CLEAR to replace anything, though
 	//        generally it is only used to initialize the grid.
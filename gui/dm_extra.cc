@@ -32,6 +32,7 @@
 
 #include "main.h"
 #include "m_lua.h"
+#include "m_pipeline.h"
 
 #include "csg_main.h"
 
@@ -808,6 +809,8 @@ int DM_wad_add_binary_lump(lua_State *L)
 
 static void TransferFILEtoWAD(PHYSFS_File *fp, const char *dest_lump)
 {
+	Pipeline_Sync();
+
 	WAD_NewLump(dest_lump);
 
 	int buf_size = 4096;
@@ -833,8 +836,20 @@ static void TransferWADtoWAD(int src_entry, const char *dest_lump)
 {
 	int length = WAD_EntryLen(src_entry);
 
+	Pipeline_Sync();
+
 	WAD_NewLump(dest_lump);
 
+	// write straight from the memory-mapped file when possible
+	const byte *data = WAD_EntryData(src_entry);
+
+	if (data)
+	{
+		WAD_AppendData(data, length);
+		WAD_FinishLump();
+		return;
+	}
+
 	int buf_size = 4096;
 	char *buffer = new char[buf_size];
 
@@ -863,6 +878,14 @@ static qLump_c * DoLoadLump(int src_entry)
 
 	int length = WAD_EntryLen(src_entry);
 
+	const byte *data = WAD_EntryData(src_entry);
+
+	if (data)
+	{
+		lump->Append(data, length);
+		return lump;
+	}
+
 	int buf_size = 4096;
 	char *buffer = new char[buf_size];
 
@@ -1252,33 +1275,149 @@ static rgb_color_t Grab_Color(lua_State *L, int stack_idx)
 }
 
 
-static byte PaletteLookup(rgb_color_t col, const rgb_color_t *palette)
+//
+// Inverse palette, for converting RGB colors to the nearest palette
+// index.  The color cube is split into cells, and each cell has a
+// list of the palette entries which could be the nearest for any
+// color within that cell.  Entries not in the list are further away
+// than some other entry for *every* color in the cell.
+//
+// The result is exactly the same as checking all of the entries
+// (including which entry wins a tie).
+//
+
+#define PAL_CELL_BITS   5
+#define PAL_CELL_SHIFT  (8 - PAL_CELL_BITS)
+#define PAL_CELL_NUM    (1 << PAL_CELL_BITS)
+
+class palette_lookup_c
 {
-	int r = RGB_RED(col);
-	int g = RGB_GREEN(col);
-	int b = RGB_BLUE(col);
+private:
+	rgb_color_t palette[256];
+
+	// for each cell, where its entries begin in 'candidates'.
+	// the extra element at the end marks the end of the last one.
+	std::vector<int> cell_start;
 
-	int best = 0;
-	int best_dist = (1 << 30);
+	std::vector<byte> candidates;
 
-	// ignore the very last color
-	for (int c = 0 ; c < 255 ; c++)
+public:
+	palette_lookup_c() : cell_start(), candidates()
+	{ }
+
+	~palette_lookup_c()
+	{ }
+
+	bool IsBuilt() const
+	{
+		return ! cell_start.empty();
+	}
+
+	void Build(const rgb_color_t *_palette)
 	{
-		int dr = r - RGB_RED(palette[c]);
-		int dg = g - RGB_GREEN(palette[c]);
-		int db = b - RGB_BLUE(palette[c]);
+		memcpy(palette, _palette, sizeof(palette));
 
-		int dist = dr*dr + dg*dg + db*db;
+		cell_start.clear();
+		candidates.clear();
 
-		if (dist < best_dist)
+		cell_start.reserve(PAL_CELL_NUM * PAL_CELL_NUM * PAL_CELL_NUM + 1);
+
+		int min_dist[256];
+
+		for (int cr = 0 ; cr < PAL_CELL_NUM ; cr++)
+		for (int cg = 0 ; cg < PAL_CELL_NUM ; cg++)
+		for (int cb = 0 ; cb < PAL_CELL_NUM ; cb++)
 		{
-			best = c;
-			best_dist = dist;
+			cell_start.push_back((int)candidates.size());
+
+			// find the smallest "furthest distance" of any entry
+			int best_max = (1 << 30);
+
+			// ignore the very last color
+			for (int c = 0 ; c < 255 ; c++)
+			{
+				int max_dist = 0;
+
+				min_dist[c] = CellDistance(cr, cg, cb, palette[c], &max_dist);
+
+				best_max = MIN(best_max, max_dist);
+			}
+
+			for (int c = 0 ; c < 255 ; c++)
+				if (min_dist[c] <= best_max)
+					candidates.push_back(c);
 		}
+
+		cell_start.push_back((int)candidates.size());
 	}
 
-	return best;
-}
+	byte Lookup(rgb_color_t col) const
+	{
+		int r = RGB_RED(col);
+		int g = RGB_GREEN(col);
+		int b = RGB_BLUE(col);
+
+		int cell = ((r >> PAL_CELL_SHIFT) << (PAL_CELL_BITS * 2)) |
+		           ((g >> PAL_CELL_SHIFT) <<  PAL_CELL_BITS) |
+		            (b >> PAL_CELL_SHIFT);
+
+		int best = 0;
+		int best_dist = (1 << 30);
+
+		// candidates are in ascending order, so the lowest index wins
+		// a tie, same as checking every entry.
+		for (int k = cell_start[cell] ; k < cell_start[cell+1] ; k++)
+		{
+			int c = candidates[k];
+
+			int dr = r - RGB_RED(palette[c]);
+			int dg = g - RGB_GREEN(palette[c]);
+			int db = b - RGB_BLUE(palette[c]);
+
+			int dist = dr*dr + dg*dg + db*db;
+
+			if (dist < best_dist)
+			{
+				best = c;
+				best_dist = dist;
+			}
+		}
+
+		return best;
+	}
+
+private:
+	static void ChannelDistance(int cell, int value, int *near_d, int *far_d)
+	{
+		int low  = cell << PAL_CELL_SHIFT;
+		int high = low + (1 << PAL_CELL_SHIFT) - 1;
+
+		if (value < low)
+			*near_d = low - value;
+		else if (value > high)
+			*near_d = value - high;
+		else
+			*near_d = 0;
+
+		*far_d = MAX(abs(value - low), abs(value - high));
+	}
+
+	// returns the squared distance from the palette color to the
+	// nearest point of the cell, and the furthest via 'max_dist'.
+	static int CellDistance(int cr, int cg, int cb, rgb_color_t col, int *max_dist)
+	{
+		int nr, ng, nb;
+		int fr, fg, fb;
+
+		ChannelDistance(cr, RGB_RED(col),   &nr, &fr);
+		ChannelDistance(cg, RGB_GREEN(col), &ng, &fg);
+		ChannelDistance(cb, RGB_BLUE(col),  &nb, &fb);
+
+		*max_dist = fr*fr + fg*fg + fb*fb;
+
+		return nr*nr + ng*ng + nb*nb;
+	}
+};
 
 
 //------------------------------------------------------------------------
@@ -1295,6 +1434,8 @@ static rgb_color_t * title_pix;
 
 static rgb_color_t title_palette[256];
 
+static palette_lookup_c title_pal_lookup;
+
 typedef enum
 {
 	REND_Solid = 0,
@@ -1438,31 +1579,44 @@ static bool TitleCacheImage(const char *filename)
 }
 
 
-static int TitleAveragePixel(int x, int y)
+static void TitleAverageRow(int y, rgb_color_t *dest)
 {
-	x *= 3;
-	y *= 3;
+	// computes a row of the final image, where each pixel is the
+	// average of a 3x3 block of the supersampled image.
 
-	// compute average
-	int r = 0;
-	int g = 0;
-	int b = 0;
+	static std::vector<int> sum_r;
+	static std::vector<int> sum_g;
+	static std::vector<int> sum_b;
 
-	for (int ky = 0 ; ky < 3 ; ky++)
-	for (int kx = 0 ; kx < 3 ; kx++)
-	{
-		const rgb_color_t c = title_pix[(y + ky) * title_W3 + (x + kx)];
+	sum_r.resize(title_W3);
+	sum_g.resize(title_W3);
+	sum_b.resize(title_W3);
+
+	const rgb_color_t *row0 = &title_pix[(y * 3) * title_W3];
+	const rgb_color_t *row1 = row0 + title_W3;
+	const rgb_color_t *row2 = row1 + title_W3;
 
-		r += RGB_RED(c);
-		g += RGB_GREEN(c);
-		b += RGB_BLUE(c);
+	// first add up each column of three pixels
+	for (int x = 0 ; x < title_W3 ; x++)
+	{
+		sum_r[x] = RGB_RED  (row0[x]) + RGB_RED  (row1[x]) + RGB_RED  (row2[x]);
+		sum_g[x] = RGB_GREEN(row0[x]) + RGB_GREEN(row1[x]) + RGB_GREEN(row2[x]);
+		sum_b[x] = RGB_BLUE (row0[x]) + RGB_BLUE (row1[x]) + RGB_BLUE (row2[x]);
 	}
 
-	r = r / 9;
-	g = g / 9;
-	b = b / 9;
+	// then add up three columns
+	for (int x = 0 ; x < title_W ; x++)
+	{
+		int r = sum_r[x*3] + sum_r[x*3 + 1] + sum_r[x*3 + 2];
+		int g = sum_g[x*3] + sum_g[x*3 + 1] + sum_g[x*3 + 2];
+		int b = sum_b[x*3] + sum_b[x*3 + 1] + sum_b[x*3 + 2];
 
-	return MAKE_RGBA(r, g, b, 255);
+		r = r / 9;
+		g = g / 9;
+		b = b / 9;
+
+		dest[x] = MAKE_RGBA(r, g, b, 255);
+	}
 }
 
 
@@ -1494,34 +1648,53 @@ static qLump_c * TitleCreateTGA()
 	lump->AddByte(24); // pixel_bits
 	lump->AddByte(0);  // attributes
 
+	std::vector<rgb_color_t> row(title_W);
+
 	for (int y = title_H-1 ; y >= 0 ; y--)
-	for (int x = 0 ; x < title_W ; x++)
 	{
-		rgb_color_t col = TitleAveragePixel(x, y);
+		TitleAverageRow(y, &row[0]);
 
-		lump->AddByte( RGB_BLUE(col));
-		lump->AddByte(RGB_GREEN(col));
-		lump->AddByte(  RGB_RED(col));
+		for (int x = 0 ; x < title_W ; x++)
+		{
+			rgb_color_t col = row[x];
+
+			lump->AddByte( RGB_BLUE(col));
+			lump->AddByte(RGB_GREEN(col));
+			lump->AddByte(  RGB_RED(col));
+		}
 	}
 
 	return lump;
 }
 
 
-static qLump_c * TitleCreatePatch()
+static byte * TitleConvertPixels()
 {
-	// convert image to the palette  [ this is very slow! ]
+	// convert image to the palette
+
+	if (! title_pal_lookup.IsBuilt())
+		title_pal_lookup.Build(title_palette);
 
 	byte *conv_pixels = new byte[title_W * title_H];
 
+	std::vector<rgb_color_t> row(title_W);
+
 	for (int y = 0 ; y < title_H ; y++)
-	for (int x = 0 ; x < title_W ; x++)
 	{
-		rgb_color_t col = TitleAveragePixel(x, y);
+		TitleAverageRow(y, &row[0]);
 
-		conv_pixels[y * title_W + x] = PaletteLookup(col, title_palette);
+		for (int x = 0 ; x < title_W ; x++)
+			conv_pixels[y * title_W + x] = title_pal_lookup.Lookup(row[x]);
 	}
 
+	return conv_pixels;
+}
+
+
+static qLump_c * TitleCreatePatch()
+{
+	byte *conv_pixels = TitleConvertPixels();
+
 	qLump_c *lump = DM_CreatePatch(title_W, title_H, 0, 0, conv_pixels, title_W, title_H);
 
 	delete[] conv_pixels;
@@ -1532,17 +1705,7 @@ static qLump_c * TitleCreatePatch()
 
 static qLump_c * TitleCreateRaw()
 {
-	// convert image to the palette  [ this is very slow! ]
-
-	byte *conv_pixels = new byte[title_W * title_H];
-
-	for (int y = 0 ; y < title_H ; y++)
-	for (int x = 0 ; x < title_W ; x++)
-	{
-		rgb_color_t col = TitleAveragePixel(x, y);
-
-		conv_pixels[y * title_W + x] = PaletteLookup(col, title_palette);
-	}
+	byte *conv_pixels = TitleConvertPixels();
 
 	qLump_c *lump = new qLump_c;
 
@@ -1616,6 +1779,8 @@ int DM_title_set_palette(lua_State *L)
 		title_palette[c] = MAKE_RGBA(r, g, b, 255);
 	}
 
+	title_pal_lookup.Build(title_palette);
+
 	return 0;
 }
 
@@ -1845,6 +2010,57 @@ static inline rgb_color_t CalcPixel(int x, int y)
 }
 
 
+static void TDraw_Span(int y, int x1, int x2)
+{
+	// draws the pixels [x1..x2) on row y.  The render mode is only
+	// checked once per span, giving simple inner loops which the
+	// compiler can vectorise.
+
+	rgb_color_t *dest = &title_pix[y * title_W3];
+
+	rgb_color_t C = title_drawctx.color[0];
+
+	int x;
+
+	switch (title_drawctx.render_mode)
+	{
+		case REND_Solid:
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = C;
+			return;
+
+		case REND_Additive:
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = CalcAdditive(dest[x], C);
+			return;
+
+		case REND_Subtract:
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = CalcSubtract(dest[x], C);
+			return;
+
+		case REND_Multiply:
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = CalcMultiply(dest[x], C);
+			return;
+
+		case REND_Gradient:
+		case REND_Gradient3:
+			// the color only depends on y
+			C = CalcPixel(x1, y);
+
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = C;
+			return;
+
+		default:
+			for (x = x1 ; x < x2 ; x++)
+				dest[x] = CalcPixel(x, y);
+			return;
+	}
+}
+
+
 static void TDraw_Box(int x, int y, int w, int h)
 {
 	// clip the box
@@ -1863,9 +2079,8 @@ static void TDraw_Box(int x, int y, int w, int h)
 		return;
 
 	for (int y = y1 ; y < y2 ; y++)
-	for (int x = x1 ; x < x2 ; x++)
 	{
-		title_pix[y * title_W3 + x] = CalcPixel(x, y);
+		TDraw_Span(y, x1, x2);
 	}
 }
 
@@ -1887,6 +2102,14 @@ static void TDraw_Slash(int x, int y, int w, int dir)
 }
 
 
+static inline bool InsideCircle(int x, int bmx, int w, float dy)
+{
+	float dx = (x - bmx) / (float)w;
+
+	return ! (dx * dx + dy * dy > 0.25);
+}
+
+
 static void TDraw_Circle(int x, int y, int w, int h)
 {
 	int bmx = x + w / 2;
@@ -1907,16 +2130,55 @@ static void TDraw_Circle(int x, int y, int w, int h)
 	if (x1 > x2 || y1 > y2)
 		return;
 
+	if (w <= 0 || h <= 0)
+		return;
+
 	for (int y = y1 ; y < y2 ; y++)
-	for (int x = x1 ; x < x2 ; x++)
 	{
-		float dx = (x - bmx) / (float)w;
 		float dy = (y - bmy) / (float)h;
 
-		if (dx * dx + dy * dy > 0.25)
+		// the pixels inside the circle form a single span around the
+		// middle (since the test only gets harder further away), so
+		// find each end of it with a binary search.
+
+		if (! InsideCircle(bmx, bmx, w, dy))
 			continue;
 
-		title_pix[y * title_W3 + x] = CalcPixel(x, y);
+		int lo = x;
+		int hi = bmx;
+
+		while (lo < hi)
+		{
+			int mid = lo + (hi - lo) / 2;
+
+			if (InsideCircle(mid, bmx, w, dy))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+
+		int left = lo;
+
+		lo = bmx;
+		hi = x + w - 1;
+
+		while (lo < hi)
+		{
+			int mid = hi - (hi - lo) / 2;
+
+			if (InsideCircle(mid, bmx, w, dy))
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		int right = lo;
+
+		left  = MAX(left,  x1);
+		right = MIN(right, x2 - 1);
+
+		if (left <= right)
+			TDraw_Span(y, left, right + 1);
 	}
 }
 
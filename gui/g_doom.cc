@@ -28,8 +28,10 @@
 #include "lib_wad.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 #include "m_lua.h"
+#include "m_pipeline.h"
 
 #include "csg_main.h"
 #include "q_common.h"  // qLump_c
@@ -47,19 +49,17 @@ extern int ef_liquid_type;
 extern int ef_thing_mode;
 
 
-static char *level_name;
-
-
 int dm_sub_format;
 
 int dm_offset_map;
 
-static qLump_c *header_lump;
-static qLump_c *thing_lump;
-static qLump_c *vertex_lump;
-static qLump_c *sector_lump;
-static qLump_c *sidedef_lump;
-static qLump_c *linedef_lump;
+// the lumps of the level being written (by the current thread)
+static thread_local qLump_c *header_lump;
+static thread_local qLump_c *thing_lump;
+static thread_local qLump_c *vertex_lump;
+static thread_local qLump_c *sector_lump;
+static thread_local qLump_c *sidedef_lump;
+static thread_local qLump_c *linedef_lump;
 
 static int errors_seen;
 
@@ -102,6 +102,15 @@ void DM_WriteLump(const char *name, const void *data, u32_t len)
 {
 	SYS_ASSERT(strlen(name) <= 8);
 
+	Cache_NewEntry(name);
+	Cache_AppendData(data, len);
+
+	// a pipelined level is written later, in order
+	if (Cache_OutputDeferred())
+		return;
+
+	Pipeline_Sync();
+
 	WAD_NewLump(name);
 
 	if (len > 0)
@@ -217,12 +226,13 @@ bool DM_StartWAD(const char *filename)
 }
 
 
-bool DM_EndWAD()
+bool DM_EndWAD(bool keep)
 {
 	DM_WriteSections();
 	DM_ClearSections();
 
-	WAD_CloseWrite();
+	if (! WAD_CloseWrite(keep))
+		errors_seen++;
 
 	return (errors_seen == 0);
 }
@@ -285,7 +295,7 @@ void DM_EndLevel(const char *level_name)
 
 void DM_HeaderPrintf(const char *str, ...)
 {
-	static char message_buf[MSG_BUF_LEN];
+	static thread_local char message_buf[MSG_BUF_LEN];
 
 	va_list args;
 
@@ -563,7 +573,7 @@ static void GB_Ticker(void)
 {
 	Main_Ticker();
 
-	if (main_action >= MAIN_CANCEL)
+	if (Main_Aborted())
 	{
 		nb_comms.cancelled = TRUE;
 	}
@@ -597,8 +607,8 @@ static void GB_DisplaySetBarLimit(int barnum, int limit)
 	{
 		progress_limit = limit;
 
-		main_win->build_box->SetStatus(_("Building nodes"));
-		main_win->build_box->Prog_Nodes(0, limit);
+		Main_ProgStatus(_("Building nodes"));
+		Main_ProgNodes(0, limit);
 	}
 }
 
@@ -606,7 +616,7 @@ static void GB_DisplaySetBar(int barnum, int count)
 {
 	if (display_mode == DIS_BUILDPROGRESS && barnum == 2 && main_win)
 	{
-		main_win->build_box->Prog_Nodes(count, progress_limit);
+		Main_ProgNodes(count, progress_limit);
 	}
 }
 
@@ -701,8 +711,8 @@ public:
 	bool Start(const char *preset);
 	bool Finish(bool build_ok);
 
-	void BeginLevel();
-	void EndLevel();
+	void BeginLevel(csg_level_c *lev);
+	void EndLevel(csg_level_c *lev);
 	void Property(const char *key, const char *value);
 
 private:
@@ -738,8 +748,7 @@ bool doom_game_interface_c::Start(const char *preset)
 		return false;
 	}
 
-	if (main_win)
-		main_win->build_box->Prog_Init(20, N_("CSG"));
+	Main_ProgInit(20, N_("CSG"));
 
 	return true;
 }
@@ -770,20 +779,22 @@ bool doom_game_interface_c::BuildNodes()
 
 bool doom_game_interface_c::Finish(bool build_ok)
 {
-	// TODO: handle write errors
-	DM_EndWAD();
+	// a failed build leaves any existing file untouched
+	if (! DM_EndWAD(build_ok))
+		build_ok = false;
 
 	if (build_ok)
 	{
+		Main_ProgStep("Nodes");
+
 		build_ok = BuildNodes();
-	}
 
-	if (! build_ok)
-	{
-		// remove the WAD if an error occurred
-		FileDelete(filename);
+		// remove the WAD if the nodes could not be built
+		if (! build_ok)
+			FileDelete(filename);
 	}
-	else
+
+	if (build_ok)
 	{
 		Recent_AddFile(RECG_Output, filename);
 	}
@@ -792,24 +803,15 @@ bool doom_game_interface_c::Finish(bool build_ok)
 }
 
 
-void doom_game_interface_c::BeginLevel()
+void doom_game_interface_c::BeginLevel(csg_level_c *lev)
 {
-	DM_BeginLevel();
+	// nothing needed, the lumps are created in EndLevel
 }
 
 
 void doom_game_interface_c::Property(const char *key, const char *value)
 {
-	if (StringCaseCmp(key, "level_name") == 0)
-	{
-		level_name = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "description") == 0)
-	{
-		// ignored (for now)
-		// [another mechanism sets the description via BEX/DDF]
-	}
-	else if (StringCaseCmp(key, "sub_format") == 0)
+	if (StringCaseCmp(key, "sub_format") == 0)
 	{
 		if (StringCaseCmp(value, "doom") == 0)
 			dm_sub_format = 0;
@@ -843,23 +845,27 @@ void doom_game_interface_c::Property(const char *key, const char *value)
 }
 
 
-void doom_game_interface_c::EndLevel()
+void doom_game_interface_c::EndLevel(csg_level_c *lev)
 {
-	if (! level_name)
+	// Note: the description is ignored (for now)
+	// [another mechanism sets the description via BEX/DDF]
+
+	if (lev->name.empty())
 		Main_FatalError("Script problem: did not set level name!\n");
 
-	if (main_win)
-		main_win->build_box->Prog_Step("CSG");
+	Main_ProgStep("CSG");
+
+	if (! Cache_ReplayLevel(DM_WriteLump))
+	{
+		DM_BeginLevel();
 
-	CSG_DOOM_Write();
+		CSG_DOOM_Write();
 #if 0
-	CSG_TestRegions_Doom();
+		CSG_TestRegions_Doom();
 #endif
 
-	DM_EndLevel(level_name);
-
-	StringFree(level_name);
-	level_name = NULL;
+		DM_EndLevel(lev->name.c_str());
+	}
 }
 
 
@@ -39,7 +39,7 @@ extern int dm_sub_format;
 /***** FUNCTIONS ****************/
 
 bool DM_StartWAD(const char *filename);
-bool DM_EndWAD();
+bool DM_EndWAD(bool keep = true);
 
 void DM_BeginLevel();
 void DM_EndLevel(const char *level_name);
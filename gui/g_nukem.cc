@@ -30,8 +30,10 @@
 #include "lib_grp.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 #include "m_lua.h"
+#include "m_pipeline.h"
 
 #include "img_all.h"
 
@@ -44,15 +46,11 @@
 extern void CSG_NUKEM_Write();
 
 
-// Properties
-static char *level_name;
+static thread_local qLump_c *nk_sectors;
+static thread_local qLump_c *nk_walls;
+static thread_local qLump_c *nk_sprites;
 
-
-static qLump_c *nk_sectors;
-static qLump_c *nk_walls;
-static qLump_c *nk_sprites;
-
-static raw_nukem_map_t nk_header;
+static thread_local raw_nukem_map_t nk_header;
 
 
 static void NK_FreeLumps()
@@ -63,17 +61,24 @@ static void NK_FreeLumps()
 }
 
 
-static void NK_WriteLump(const char *name, qLump_c *lump)
+static void NK_WriteLump(const char *name, const void *data, u32_t len)
 {
 	SYS_ASSERT(strlen(name) <= 11);
 
-	GRP_NewLump(name);
+	Cache_NewEntry(name);
+	Cache_AppendData(data, len);
+
+	// a pipelined level is written later, in order
+	if (Cache_OutputDeferred())
+		return;
 
-	int len = lump->GetSize();
+	Pipeline_Sync();
+
+	GRP_NewLump(name);
 
 	if (len > 0)
 	{
-		if (! GRP_AppendData(lump->GetBuffer(), len))
+		if (! GRP_AppendData(data, len))
 		{
 			//    errors_seen++;
 		}
@@ -83,6 +88,12 @@ static void NK_WriteLump(const char *name, qLump_c *lump)
 }
 
 
+static void NK_WriteLump(const char *name, qLump_c *lump)
+{
+	NK_WriteLump(name, lump->GetBuffer(), lump->GetSize());
+}
+
+
 bool NK_StartGRP(const char *filename)
 {
 	if (! GRP_OpenWrite(filename))
@@ -102,15 +113,8 @@ void NK_EndGRP(void)
 }
 
 
-void NK_BeginLevel(const char *level_name)
+void NK_BeginLevel()
 {
-	char lump_name[40];
-
-	sprintf(lump_name, "%s.MAP", level_name);
-	StringUpper(lump_name);
-
-	GRP_NewLump(lump_name);
-
 	// initialise the header
 	memset(&nk_header, 0, sizeof(nk_header));
 
@@ -125,7 +129,7 @@ void NK_BeginLevel(const char *level_name)
 }
 
 
-void NK_EndLevel()
+void NK_EndLevel(const char *level_name)
 {
 	// write everything...
 
@@ -133,18 +137,27 @@ void NK_EndLevel()
 	u16_t num_walls   = LE_U16(NK_NumWalls());
 	u16_t num_sprites = LE_U16(NK_NumSprites());
 
-	GRP_AppendData(&nk_header, (int)sizeof(nk_header));
+	qLump_c *map = new qLump_c;
 
-	GRP_AppendData(&num_sectors, 2);
-	GRP_AppendData(nk_sectors->GetBuffer(), nk_sectors->GetSize());
+	map->Append(&nk_header, (int)sizeof(nk_header));
 
-	GRP_AppendData(&num_walls, 2);
-	GRP_AppendData(nk_walls->GetBuffer(), nk_walls->GetSize());
+	map->Append(&num_sectors, 2);
+	map->Append(nk_sectors->GetBuffer(), nk_sectors->GetSize());
 
-	GRP_AppendData(&num_sprites, 2);
-	GRP_AppendData(nk_sprites->GetBuffer(), nk_sprites->GetSize());
+	map->Append(&num_walls, 2);
+	map->Append(nk_walls->GetBuffer(), nk_walls->GetSize());
 
-	GRP_FinishLump();
+	map->Append(&num_sprites, 2);
+	map->Append(nk_sprites->GetBuffer(), nk_sprites->GetSize());
+
+	char lump_name[40];
+
+	sprintf(lump_name, "%s.MAP", level_name);
+	StringUpper(lump_name);
+
+	NK_WriteLump(lump_name, map);
+
+	delete map;
 
 	NK_FreeLumps();
 }
@@ -478,8 +491,8 @@ public:
 	bool Start(const char *preset);
 	bool Finish(bool build_ok);
 
-	void BeginLevel();
-	void EndLevel();
+	void BeginLevel(csg_level_c *lev);
+	void EndLevel(csg_level_c *lev);
 	void Property(const char *key, const char *value);
 
 private:
@@ -508,8 +521,7 @@ bool nukem_game_interface_c::Start(const char *preset)
 		return false;
 	}
 
-	if (main_win)
-		main_win->build_box->Prog_Init(0, N_("CSG"));
+	Main_ProgInit(0, N_("CSG"));
 
 	return true;
 }
@@ -529,45 +541,34 @@ bool nukem_game_interface_c::Finish(bool build_ok)
 }
 
 
-void nukem_game_interface_c::BeginLevel()
+void nukem_game_interface_c::BeginLevel(csg_level_c *lev)
 {
 }
 
 
 void nukem_game_interface_c::Property(const char *key, const char *value)
 {
-	if (StringCaseCmp(key, "level_name") == 0)
-	{
-		level_name = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "description") == 0)
-	{
-		// ignored (for now)
-		// [another mechanism sets the description via BEX/DDF]
-	}
-	else
-	{
-		LogPrintf("WARNING: unknown NUKEM property: %s=%s\n", key, value);
-	}
+	LogPrintf("WARNING: unknown NUKEM property: %s=%s\n", key, value);
 }
 
 
-void nukem_game_interface_c::EndLevel()
+void nukem_game_interface_c::EndLevel(csg_level_c *lev)
 {
-	if (! level_name)
-		Main_FatalError("Script problem: did not set level name!\n");
+	// Note: the description is ignored (for now)
 
-	NK_BeginLevel(level_name);
+	if (lev->name.empty())
+		Main_FatalError("Script problem: did not set level name!\n");
 
-	if (main_win)
-		main_win->build_box->Prog_Step("CSG");
+	Main_ProgStep("CSG");
 
-	CSG_NUKEM_Write();
+	if (! Cache_ReplayLevel(NK_WriteLump))
+	{
+		NK_BeginLevel();
 
-	NK_EndLevel();
+		CSG_NUKEM_Write();
 
-	StringFree(level_name);
-	level_name = NULL;
+		NK_EndLevel(lev->name.c_str());
+	}
 }
 
 
@@ -29,6 +29,7 @@
 #include "lib_wad.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 
 #include "q_common.h"
@@ -69,19 +70,17 @@
 extern void Q1_ClippingHull(int hull);
 
 
-static char *level_name;
-static char *description;
 static char *qk_texture_wad;
 
-quake_mapmodel_c *qk_world_model;
+thread_local quake_mapmodel_c *qk_world_model;
 
 
 //------------------------------------------------------------------------
 
-static std::vector<std::string>   q1_miptexs;
-static std::map<std::string, int> q1_miptex_map;
+static thread_local std::vector<std::string>   q1_miptexs;
+static thread_local std::map<std::string, int> q1_miptex_map;
 
-static int num_custom_tex = 0;
+static thread_local int num_custom_tex = 0;
 
 s32_t Q1_AddMipTex(const char *name);
 
@@ -245,6 +244,15 @@ static void TransferOneMipTex(qLump_c *lump, unsigned int m, const char *name)
 		int pos    = 0;
 		int length = WAD2_EntryLen(entry);
 
+		// use the memory-mapped data when possible
+		const byte *data = WAD2_EntryData(entry);
+
+		if (data)
+		{
+			lump->Append(data, length);
+			return;
+		}
+
 		byte buffer[1024];
 
 		while (length > 0)
@@ -427,9 +435,9 @@ static void DummyMipTex(void)
 
 #define TEXINFO_HASH_SIZE  128
 
-static std::vector<texinfo_t> q1_texinfos;
+static thread_local std::vector<texinfo_t> q1_texinfos;
 
-static std::vector<int> * texinfo_hashtab[TEXINFO_HASH_SIZE];
+static thread_local std::vector<int> * texinfo_hashtab[TEXINFO_HASH_SIZE];
 
 
 static void Q1_ClearTexInfo(void)
@@ -563,25 +571,25 @@ static void DummyTexInfo(void)
 //   BSP TREE OUTPUT
 //------------------------------------------------------------------------
 
-static qLump_c *q1_surf_edges;
-static qLump_c *q1_mark_surfs;
+static thread_local qLump_c *q1_surf_edges;
+static thread_local qLump_c *q1_mark_surfs;
 
-static qLump_c *q1_faces;
-static qLump_c *q1_leafs;
-static qLump_c *q1_nodes;
+static thread_local qLump_c *q1_faces;
+static thread_local qLump_c *q1_leafs;
+static thread_local qLump_c *q1_nodes;
 
-static qLump_c *q1_models;
+static thread_local qLump_c *q1_models;
 
-static int q1_total_surf_edges;
-static int q1_total_mark_surfs;
+static thread_local int q1_total_surf_edges;
+static thread_local int q1_total_mark_surfs;
 
-static int q1_total_faces;
-static int q1_total_leafs;
-static int q1_total_nodes;
+static thread_local int q1_total_faces;
+static thread_local int q1_total_leafs;
+static thread_local int q1_total_nodes;
 
-qLump_c *q1_clip;
+thread_local qLump_c *q1_clip;
 
-int q1_total_clip;
+thread_local int q1_total_clip;
 
 
 static int q1_medium_table[5] =
@@ -1260,9 +1268,9 @@ static void Q1_WriteModels()
 
 	Q1_WriteModel(qk_world_model);
 
-	for (unsigned int i = 0 ; i < qk_all_mapmodels.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->mapmodels.size() ; i++)
 	{
-		quake_mapmodel_c *model = qk_all_mapmodels[i];
+		quake_mapmodel_c *model = cur_level->mapmodels[i];
 
 		model->firstface = q1_total_faces;
 		model->numfaces  = 6;
@@ -1289,8 +1297,7 @@ static void Q1_WriteModels()
 
 static void Q1_LightWorld()
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Light");
+	Main_ProgStep("Light");
 
 	QLIT_LightAllFaces();
 
@@ -1305,14 +1312,13 @@ static void Q1_LightWorld()
 
 static void Q1_VisWorld(int base_leafs)
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Vis");
+	Main_ProgStep("Vis");
 
 	// take the solid leaf into account
 	int numleafs = 1 + base_leafs;
 
 	// add in the map models
-	for (unsigned int i = 0 ; i < qk_all_mapmodels.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->mapmodels.size() ; i++)
 	{
 		numleafs += 6; ///TODO  qk_all_mapmodels->PredictLeafs();
 	}
@@ -1354,7 +1360,7 @@ static void Q1_CreateBSPFile(const char *name)
 	Q1_WriteMipTex();
 	Q1_WriteTexInfo();
 
-	BSP_WriteEntities(LUMP_ENTITIES, description);
+	BSP_WriteEntities(LUMP_ENTITIES, cur_level->description.c_str());
 
 	// this will free lots of stuff (lightmaps etc)
 	BSP_CloseLevel();
@@ -1377,10 +1383,9 @@ int Q1_add_tex_wad(lua_State *L)
 
 	// TODO: support more than one
 
-	if (qk_texture_wad)
-		StringFree(qk_texture_wad);
-
-	qk_texture_wad = StringDup(name);
+	// this is handled like a property, since the back-end of the
+	// level may not run until later.
+	CSG_SetProperty("tex_wad", name);
 
 	return 1;
 }
@@ -1411,8 +1416,8 @@ public:
 	bool Start(const char *preset);
 	bool Finish(bool build_ok);
 
-	void BeginLevel();
-	void EndLevel();
+	void BeginLevel(csg_level_c *lev);
+	void EndLevel(csg_level_c *lev);
 	void Property(const char *key, const char *value);
 
 private:
@@ -1464,8 +1469,7 @@ bool quake1_game_interface_c::Start(const char *preset)
 
 	BSP_AddInfoFile();
 
-	if (main_win)
-		main_win->build_box->Prog_Init(0, StepsForGame(0));
+	Main_ProgInit(0, StepsForGame(0));
 
 	return true;
 }
@@ -1473,7 +1477,8 @@ bool quake1_game_interface_c::Start(const char *preset)
 
 bool quake1_game_interface_c::Finish(bool build_ok)
 {
-	PAK_CloseWrite();
+	if (! PAK_CloseWrite())
+		build_ok = false;
 
 	// remove the file if an error occurred
 	if (! build_ok)
@@ -1485,12 +1490,8 @@ bool quake1_game_interface_c::Finish(bool build_ok)
 }
 
 
-void quake1_game_interface_c::BeginLevel()
+void quake1_game_interface_c::BeginLevel(csg_level_c *lev)
 {
-	level_name  = NULL;
-	description = NULL;
-	qk_texture_wad = NULL;
-
 	Q1_FreeStuff();
 
 	CSG_QUAKE_Free();
@@ -1499,15 +1500,7 @@ void quake1_game_interface_c::BeginLevel()
 
 void quake1_game_interface_c::Property(const char *key, const char *value)
 {
-	if (StringCaseCmp(key, "level_name") == 0)
-	{
-		level_name = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "description") == 0)
-	{
-		description = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "sub_format") == 0)
+	if (StringCaseCmp(key, "sub_format") == 0)
 	{
 		if (StringCaseCmp(value, "quake") == 0)
 			qk_sub_format = 0;
@@ -1519,13 +1512,19 @@ void quake1_game_interface_c::Property(const char *key, const char *value)
 			LogPrintf("WARNING: unknown QUAKE1 sub_format '%s'\n", value);
 
 		// this assumes the sub_format is only set once at the start
-		if (main_win)
-			main_win->build_box->Prog_Init(0, StepsForGame(qk_sub_format));
+		Main_ProgInit(0, StepsForGame(qk_sub_format));
 	}
 	else if (StringCaseCmp(key, "worldtype") == 0)
 	{
 		qk_worldtype = atoi(value);
 	}
+	else if (StringCaseCmp(key, "tex_wad") == 0)
+	{
+		if (qk_texture_wad)
+			StringFree(qk_texture_wad);
+
+		qk_texture_wad = StringDup(value);
+	}
 	else
 	{
 		LogPrintf("WARNING: unknown QUAKE1 property: %s=%s\n", key, value);
@@ -1533,9 +1532,11 @@ void quake1_game_interface_c::Property(const char *key, const char *value)
 }
 
 
-void quake1_game_interface_c::EndLevel()
+void quake1_game_interface_c::EndLevel(csg_level_c *lev)
 {
-	if (! level_name)
+	const char *level_name = lev->name.c_str();
+
+	if (! level_name[0])
 		Main_FatalError("Script problem: did not set level name!\n");
 
 	if (strlen(level_name) >= 32)
@@ -1544,15 +1545,14 @@ void quake1_game_interface_c::EndLevel()
 	char entry_in_pak[64];
 	sprintf(entry_in_pak, "maps/%s.bsp", level_name);
 
-	Q1_CreateBSPFile(entry_in_pak);
-
-	StringFree(level_name);
-
-	if (description)
-		StringFree(description);
+	if (! Cache_ReplayLevel(BSP_WriteCachedEntry))
+		Q1_CreateBSPFile(entry_in_pak);
 
 	if (qk_texture_wad)
+	{
 		StringFree(qk_texture_wad);
+		qk_texture_wad = NULL;
+	}
 }
 
 
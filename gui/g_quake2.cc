@@ -28,6 +28,7 @@
 #include "lib_pak.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 
 #include "q_common.h"
@@ -46,10 +47,6 @@
 #define MODEL_LIGHT  64
 
 
-static char *level_name;
-static char *description;
-
-
 // IMPORTANT!! Quake II assumes axis-aligned node planes are positive
 
 
@@ -65,10 +62,10 @@ static int q2_medium_table[5] =
 
 //------------------------------------------------------------------------
 
-static std::vector<dbrush_t>     q2_brushes;
-static std::vector<dbrushside_t> q2_brush_sides;
+static thread_local std::vector<dbrush_t>     q2_brushes;
+static thread_local std::vector<dbrushside_t> q2_brush_sides;
 
-static std::map<const csg_brush_c *, u16_t> brush_map;
+static thread_local std::map<const csg_brush_c *, u16_t> brush_map;
 
 
 static void Q2_ClearBrushes()
@@ -179,10 +176,10 @@ static void Q2_WriteBrushes()
 
 //------------------------------------------------------------------------
 
-static std::vector<texinfo2_t> q2_texinfos;
+static thread_local std::vector<texinfo2_t> q2_texinfos;
 
 #define NUM_TEXINFO_HASH  128
-static std::vector<int> * texinfo_hashtab[NUM_TEXINFO_HASH];
+static thread_local std::vector<int> * texinfo_hashtab[NUM_TEXINFO_HASH];
 
 
 static void Q2_ClearTexInfo(void)
@@ -351,23 +348,23 @@ const byte oblige_pop[256] =
 
 //------------------------------------------------------------------------
 
-static qLump_c *q2_surf_edges;
-static qLump_c *q2_mark_surfs;  // LUMP_LEAFFACES
-static qLump_c *q2_leaf_brushes;
+static thread_local qLump_c *q2_surf_edges;
+static thread_local qLump_c *q2_mark_surfs;  // LUMP_LEAFFACES
+static thread_local qLump_c *q2_leaf_brushes;
 
-static qLump_c *q2_faces;
-static qLump_c *q2_leafs;
-static qLump_c *q2_nodes;
+static thread_local qLump_c *q2_faces;
+static thread_local qLump_c *q2_leafs;
+static thread_local qLump_c *q2_nodes;
 
-static qLump_c *q2_models;
+static thread_local qLump_c *q2_models;
 
-static int q2_total_surf_edges;
-static int q2_total_mark_surfs;
-static int q2_total_leaf_brushes;
+static thread_local int q2_total_surf_edges;
+static thread_local int q2_total_mark_surfs;
+static thread_local int q2_total_leaf_brushes;
 
-static int q2_total_faces;
-static int q2_total_leafs;
-static int q2_total_nodes;
+static thread_local int q2_total_faces;
+static thread_local int q2_total_leafs;
+static thread_local int q2_total_nodes;
 
 
 static void Q2_FreeStuff()
@@ -997,9 +994,9 @@ static void Q2_WriteModels()
 
 	// handle the sub-models (doors etc)
 
-	for (unsigned int i = 0 ; i < qk_all_mapmodels.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->mapmodels.size() ; i++)
 	{
-		quake_mapmodel_c *model = qk_all_mapmodels[i];
+		quake_mapmodel_c *model = cur_level->mapmodels[i];
 
 		model->firstface = q2_total_faces;
 		model->numfaces  = 6;
@@ -1026,8 +1023,7 @@ static void Q2_WriteModels()
 
 static void Q2_LightWorld()
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Light");
+	Main_ProgStep("Light");
 
 	QLIT_LightAllFaces();
 
@@ -1037,8 +1033,7 @@ static void Q2_LightWorld()
 
 static void Q2_VisWorld()
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Vis");
+	Main_ProgStep("Vis");
 
 	// no need for numleafs, as Quake II uses clusters directly
 
@@ -1074,7 +1069,7 @@ static void Q2_CreateBSPFile(const char *name)
 	Q2_WriteBrushes();
 	Q2_WriteTexInfo();
 
-	BSP_WriteEntities(LUMP_ENTITIES, description);
+	BSP_WriteEntities(LUMP_ENTITIES, cur_level->description.c_str());
 
 	// this will free lots of stuff (lightmaps etc)
 	BSP_CloseLevel();
@@ -1102,8 +1097,8 @@ public:
 	bool Start(const char *preset);
 	bool Finish(bool build_ok);
 
-	void BeginLevel();
-	void EndLevel();
+	void BeginLevel(csg_level_c *lev);
+	void EndLevel(csg_level_c *lev);
 	void Property(const char *key, const char *value);
 };
 
@@ -1139,8 +1134,7 @@ bool quake2_game_interface_c::Start(const char *preset)
 
 	BSP_AddInfoFile();
 
-	if (main_win)
-		main_win->build_box->Prog_Init(0, "CSG,BSP,Vis,Light");
+	Main_ProgInit(0, "CSG,BSP,Vis,Light");
 
 	return true;
 }
@@ -1148,7 +1142,8 @@ bool quake2_game_interface_c::Start(const char *preset)
 
 bool quake2_game_interface_c::Finish(bool build_ok)
 {
-	PAK_CloseWrite();
+	if (! PAK_CloseWrite())
+		build_ok = false;
 
 	// remove the file if an error occurred
 	if (! build_ok)
@@ -1160,11 +1155,8 @@ bool quake2_game_interface_c::Finish(bool build_ok)
 }
 
 
-void quake2_game_interface_c::BeginLevel()
+void quake2_game_interface_c::BeginLevel(csg_level_c *lev)
 {
-	level_name  = NULL;
-	description = NULL;
-
 	Q2_FreeStuff();
 
 	CSG_QUAKE_Free();
@@ -1173,24 +1165,15 @@ void quake2_game_interface_c::BeginLevel()
 
 void quake2_game_interface_c::Property(const char *key, const char *value)
 {
-	if (StringCaseCmp(key, "level_name") == 0)
-	{
-		level_name = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "description") == 0)
-	{
-		description = StringDup(value);
-	}
-	else
-	{
-		LogPrintf("WARNING: unknown QUAKE2 property: %s=%s\n", key, value);
-	}
+	LogPrintf("WARNING: unknown QUAKE2 property: %s=%s\n", key, value);
 }
 
 
-void quake2_game_interface_c::EndLevel()
+void quake2_game_interface_c::EndLevel(csg_level_c *lev)
 {
-	if (! level_name)
+	const char *level_name = lev->name.c_str();
+
+	if (! level_name[0])
 		Main_FatalError("Script problem: did not set level name!\n");
 
 	if (strlen(level_name) >= 32)
@@ -1199,12 +1182,8 @@ void quake2_game_interface_c::EndLevel()
 	char entry_in_pak[64];
 	sprintf(entry_in_pak, "maps/%s.bsp", level_name);
 
-	Q2_CreateBSPFile(entry_in_pak);
-
-	StringFree(level_name);
-
-	if (description)
-		StringFree(description);
+	if (! Cache_ReplayLevel(BSP_WriteCachedEntry))
+		Q2_CreateBSPFile(entry_in_pak);
 }
 
 
@@ -29,6 +29,7 @@
 #include "lib_zip.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 
 #include "q_common.h"
@@ -61,9 +62,6 @@
 #define SHADER_COMMON_LAVA     6
 
 
-static char *level_name;
-static char *description;
-
 static char *water_shader;
 static char *slime_shader;
 static char * lava_shader;
@@ -74,10 +72,10 @@ extern double q3_default_tex_scale;
 
 //------------------------------------------------------------------------
 
-static std::vector<dbrush3_t>     q3_brushes;
-static std::vector<dbrushside3_t> q3_brush_sides;
+static thread_local std::vector<dbrush3_t>     q3_brushes;
+static thread_local std::vector<dbrushside3_t> q3_brush_sides;
 
-static std::map<const csg_brush_c *, s32_t> brush_map;
+static thread_local std::map<const csg_brush_c *, s32_t> brush_map;
 
 
 static void Q3_ClearBrushes()
@@ -329,10 +327,10 @@ static void Q3_WriteBrushes()
 
 //------------------------------------------------------------------------
 
-static std::vector<dshader3_t> q3_shaders;
+static thread_local std::vector<dshader3_t> q3_shaders;
 
 #define NUM_SHADER_HASH  128
-static std::vector<int> * shader_hashtab[NUM_SHADER_HASH];
+static thread_local std::vector<int> * shader_hashtab[NUM_SHADER_HASH];
 
 
 static void Q3_ClearShaders(void)
@@ -419,28 +417,28 @@ static void Q3_WriteFogs()
 
 //------------------------------------------------------------------------
 
-static qLump_c *q3_leaf_surfs;  // LUMP_LEAFSURFACES
-static qLump_c *q3_leaf_brushes;
+static thread_local qLump_c *q3_leaf_surfs;  // LUMP_LEAFSURFACES
+static thread_local qLump_c *q3_leaf_brushes;
 
-static qLump_c *q3_leafs;
-static qLump_c *q3_nodes;
+static thread_local qLump_c *q3_leafs;
+static thread_local qLump_c *q3_nodes;
 
-static qLump_c *q3_surfaces;
-static qLump_c *q3_drawverts;
-static qLump_c *q3_indexes;
+static thread_local qLump_c *q3_surfaces;
+static thread_local qLump_c *q3_drawverts;
+static thread_local qLump_c *q3_indexes;
 
-static qLump_c *q3_models;
+static thread_local qLump_c *q3_models;
 
-static int q3_total_leaf_surfs;
-static int q3_total_leaf_brushes;
+static thread_local int q3_total_leaf_surfs;
+static thread_local int q3_total_leaf_brushes;
 
-static int q3_total_leafs;
-static int q3_total_nodes;
-static int q3_total_models;
+static thread_local int q3_total_leafs;
+static thread_local int q3_total_nodes;
+static thread_local int q3_total_models;
 
-static int q3_total_surfaces;
-static int q3_total_drawverts;
-static int q3_total_indexes;
+static thread_local int q3_total_surfaces;
+static thread_local int q3_total_drawverts;
+static thread_local int q3_total_indexes;
 
 
 static void Q3_FreeStuff()
@@ -1162,8 +1160,7 @@ static void Q3_SetGridLights()
 
 static void Q3_LightWorld()
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Light");
+	Main_ProgStep("Light");
 
 	QLIT_LightAllFaces();
 
@@ -1175,8 +1172,7 @@ static void Q3_LightWorld()
 
 static void Q3_VisWorld()
 {
-	if (main_win)
-		main_win->build_box->Prog_Step("Vis");
+	Main_ProgStep("Vis");
 
 	// Quake 3 uses clusters directly
 
@@ -1233,13 +1229,18 @@ static void Q3_CreateBSPFile(const char *name)
 	Q3_WriteBSP();
 	Q3_WriteModels();
 
+	// these can be large, so write them out now
+	BSP_FlushLump(LUMP_SURFACES);
+	BSP_FlushLump(LUMP_DRAWVERTS);
+	BSP_FlushLump(LUMP_DRAWINDEXES);
+
 	BSP_WritePlanes(LUMP_PLANES, MAX_MAP_PLANES);
 
 	Q3_WriteBrushes();
 	Q3_WriteShaders();
 	Q3_WriteFogs();
 
-	BSP_WriteEntities(LUMP_ENTITIES, description);
+	BSP_WriteEntities(LUMP_ENTITIES, cur_level->description.c_str());
 
 	// this will free lots of stuff (lightmaps etc)
 	BSP_CloseLevel();
@@ -1255,24 +1256,33 @@ static void DP_CreateRTLights(const char *entry_in_pak)
 	// we don't create the file when there are no RT lights
 	bool has_file = false;
 
-	static char buffer[1024];
+	// a pipelined build only records the output
+	bool to_file = ! Cache_OutputDeferred();
 
-	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
+	static thread_local char buffer[1024];
+
+	for (unsigned int i = 0 ; i < cur_level->entities.size() ; i++)
 	{
-		csg_entity_c *E = all_entities[i];
+		csg_entity_c *E = cur_level->entities[i];
 
 		if (strcmp(E->id.c_str(), "oblige_rtlight") != 0)
 			continue;
 
 		if (! has_file)
 		{
-			ZIPF_NewLump(entry_in_pak);
+			if (to_file)
+				ZIPF_NewLump(entry_in_pak);
+
+			Cache_NewEntry(entry_in_pak);
 			has_file = true;
 		}
 
 		if (E->props.getInt("noshadow") > 0)
 		{
-			ZIPF_AppendData("!", 1);
+			if (to_file)
+				ZIPF_AppendData("!", 1);
+
+			Cache_AppendData("!", 1);
 		}
 
 		rgb_color_t color = QLIT_ParseColorString(E->props.getStr("color"));
@@ -1286,10 +1296,13 @@ static void DP_CreateRTLights(const char *entry_in_pak)
 				 E->props.getDouble("radius", RT_DEFAULT_RADIUS),
 				 r, g, b, E->props.getInt("style", 0));
 
-		ZIPF_AppendData(buffer, (int)strlen(buffer));
+		if (to_file)
+			ZIPF_AppendData(buffer, (int)strlen(buffer));
+
+		Cache_AppendData(buffer, (int)strlen(buffer));
 	}
 
-	if (has_file)
+	if (has_file && to_file)
 		ZIPF_FinishLump();
 }
 
@@ -1311,8 +1324,8 @@ public:
 	bool Start(const char *preset);
 	bool Finish(bool build_ok);
 
-	void BeginLevel();
-	void EndLevel();
+	void BeginLevel(csg_level_c *lev);
+	void EndLevel(csg_level_c *lev);
 	void Property(const char *key, const char *value);
 };
 
@@ -1357,8 +1370,7 @@ bool quake3_game_interface_c::Start(const char *preset)
 
 	BSP_AddInfoFile();
 
-	if (main_win)
-		main_win->build_box->Prog_Init(0, "CSG,BSP,Vis,Light");
+	Main_ProgInit(0, "CSG,BSP,Vis,Light");
 
 	return true;
 }
@@ -1366,7 +1378,8 @@ bool quake3_game_interface_c::Start(const char *preset)
 
 bool quake3_game_interface_c::Finish(bool build_ok)
 {
-	ZIPF_CloseWrite();
+	if (! ZIPF_CloseWrite())
+		build_ok = false;
 
 	// remove the file if an error occurred
 	if (! build_ok)
@@ -1378,11 +1391,8 @@ bool quake3_game_interface_c::Finish(bool build_ok)
 }
 
 
-void quake3_game_interface_c::BeginLevel()
+void quake3_game_interface_c::BeginLevel(csg_level_c *lev)
 {
-	level_name  = NULL;
-	description = NULL;
-
 	Q3_FreeStuff();
 
 	CSG_QUAKE_Free();
@@ -1391,15 +1401,7 @@ void quake3_game_interface_c::BeginLevel()
 
 void quake3_game_interface_c::Property(const char *key, const char *value)
 {
-	if (StringCaseCmp(key, "level_name") == 0)
-	{
-		level_name = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "description") == 0)
-	{
-		description = StringDup(value);
-	}
-	else if (StringCaseCmp(key, "default_tex_scale") == 0)
+	if (StringCaseCmp(key, "default_tex_scale") == 0)
 	{
 		q3_default_tex_scale = atof(value);
 	}
@@ -1422,9 +1424,11 @@ void quake3_game_interface_c::Property(const char *key, const char *value)
 }
 
 
-void quake3_game_interface_c::EndLevel()
+void quake3_game_interface_c::EndLevel(csg_level_c *lev)
 {
-	if (! level_name)
+	const char *level_name = lev->name.c_str();
+
+	if (! level_name[0])
 		Main_FatalError("Script problem: did not set level name!\n");
 
 	if (strlen(level_name) >= 32)
@@ -1433,16 +1437,14 @@ void quake3_game_interface_c::EndLevel()
 	char entry_in_pak[64];
 	sprintf(entry_in_pak, "maps/%s.bsp", level_name);
 
-	Q3_CreateBSPFile(entry_in_pak);
-
-	sprintf(entry_in_pak, "maps/%s.rtlights", level_name);
-
-	DP_CreateRTLights(entry_in_pak);
+	if (! Cache_ReplayLevel(BSP_WriteCachedEntry))
+	{
+		Q3_CreateBSPFile(entry_in_pak);
 
-	StringFree(level_name);
+		sprintf(entry_in_pak, "maps/%s.rtlights", level_name);
 
-	if (description)
-		StringFree(description);
+		DP_CreateRTLights(entry_in_pak);
+	}
 }
 
 
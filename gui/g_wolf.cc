@@ -29,6 +29,8 @@
 #include "main.h"
 #include "m_lua.h"
 
+#include "csg_main.h"
+
 
 #define TEMP_GAMEFILE  "GAMEMAPS.TMP"
 #define TEMP_HEADFILE  "MAPHEAD.TMP"
@@ -53,8 +55,6 @@ static int current_offset;
 static u16_t *solid_plane;
 static u16_t *thing_plane;
 
-static char *level_name;
-
 #define PL_START  2
 
 
@@ -173,7 +173,7 @@ static void WF_WriteBlankPlane(int *offset, int *length)
 }
 
 
-static void WF_WriteMap(void)
+static void WF_WriteMap(const char *level_name)
 {
   const char *message = OBLIGE_TITLE " " OBLIGE_VERSION;
 
@@ -201,7 +201,7 @@ static void WF_WriteMap(void)
   WF_PutU16(64, map_fp);
   WF_PutU16(64, map_fp);
 
-  WF_PutNString(level_name ? level_name : "Custom Map", 16, map_fp);
+  WF_PutNString(level_name[0] ? level_name : "Custom Map", 16, map_fp);
 
   WF_PutNString("!ID!", 4, map_fp);
 }
@@ -367,8 +367,8 @@ public:
   bool Start(const char *preset);
   bool Finish(bool build_ok);
 
-  void BeginLevel();
-  void EndLevel();
+  void BeginLevel(csg_level_c *lev);
+  void EndLevel(csg_level_c *lev);
   void Property(const char *key, const char *value);
 
 private:
@@ -417,8 +417,7 @@ bool wolf_game_interface_c::Start(const char *preset)
   thing_plane = new u16_t[64*64 + 8];
 
 
-  if (main_win)
-    main_win->build_box->Prog_Init(0, "");
+  Main_ProgInit(0, "");
 
   return true;
 }
@@ -480,7 +479,7 @@ void wolf_game_interface_c::Tidy()
 }
 
 
-void wolf_game_interface_c::BeginLevel()
+void wolf_game_interface_c::BeginLevel(csg_level_c *lev)
 {
   // clear the planes before use
   for (int i = 0 ; i < 64*64 ; i++)
@@ -495,28 +494,18 @@ void wolf_game_interface_c::BeginLevel()
 }
 
 
-void wolf_game_interface_c::EndLevel()
+void wolf_game_interface_c::EndLevel(csg_level_c *lev)
 {
   WF_DumpMap();
 
-  WF_WriteMap();
+  WF_WriteMap(lev->name.c_str());
   WF_WriteHead();
-
-  if (level_name)
-  {
-    StringFree(level_name);
-    level_name = NULL;
-  }
 }
 
 
 void wolf_game_interface_c::Property(const char *key, const char *value)
 {
-  if (StringCaseCmp(key, "level_name") == 0)
-  {
-    level_name = StringDup(value);
-  }
-  else if (StringCaseCmp(key, "file_ext") == 0)
+  if (StringCaseCmp(key, "file_ext") == 0)
   {
     file_ext = std::string(value);
   }
@@ -34,6 +34,8 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #endif
 
 #ifdef __APPLE__
@@ -387,6 +389,53 @@ void FileFree(const byte *mem)
 }
 
 
+const byte *FileMapRead(const char *filename, int *length)
+{
+	*length = 0;
+
+#ifdef UNIX
+	int fd = open(filename, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+
+	struct stat st;
+
+	if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size >= 0x7fffffff)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	void *mem = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	// the mapping stays valid after the file is closed
+	close(fd);
+
+	if (mem == MAP_FAILED)
+		return NULL;
+
+	*length = (int)st.st_size;
+
+	return (const byte *)mem;
+
+#else  // WIN32
+	return NULL;
+#endif
+}
+
+
+void FileUnmap(const byte *mem, int length)
+{
+#ifdef UNIX
+	if (mem)
+	{
+		munmap((void *)mem, (size_t)length);
+	}
+#endif
+}
+
+
 //
 // Note: returns false when the path doesn't exist.
 //
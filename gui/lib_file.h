@@ -49,6 +49,11 @@ bool FileMakeDir(const char *dir_name);
 byte *FileLoad(const char *filename, int *length);
 void  FileFree(const byte *mem);
 
+// maps the whole file into memory (read only).  Returns NULL if the
+// file cannot be mapped, including on systems without mmap().
+const byte *FileMapRead(const char *filename, int *length);
+void FileUnmap(const byte *mem, int length);
+
 const char * FileFindInPath(const char *paths, const char *base_name);
 
 // miscellanous
@@ -25,8 +25,10 @@
 
 #ifdef HAVE_PHYSFS
 #include "physfs.h"
+#include "m_addons.h"  // VFS_MapFile
 #endif
 
+#include "lib_file.h"
 #include "lib_util.h"
 #include "lib_pak.h"
 
@@ -48,6 +50,10 @@ static raw_pak_header_t r_header;
 
 static raw_pak_entry_t * r_directory;
 
+// the whole file when it could be memory-mapped, otherwise NULL
+static const byte * r_pak_map;
+static int r_pak_map_len;
+
 
 bool PAK_OpenRead(const char *filename)
 {
@@ -162,6 +168,12 @@ bool PAK_OpenRead(const char *filename)
 		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, E->offset, E->length, E->name);
 	}
 
+#ifdef HAVE_PHYSFS
+	r_pak_map = VFS_MapFile(filename, &r_pak_map_len);
+#else
+	r_pak_map = FileMapRead(filename, &r_pak_map_len);
+#endif
+
 	return true; // OK
 }
 
@@ -176,6 +188,16 @@ void PAK_CloseRead(void)
 
 	LogPrintf("Closed PAK file\n");
 
+	if (r_pak_map)
+	{
+#ifdef HAVE_PHYSFS
+		VFS_UnmapFile(r_pak_map, r_pak_map_len);
+#else
+		FileUnmap(r_pak_map, r_pak_map_len);
+#endif
+		r_pak_map = NULL;
+	}
+
 	delete[] r_directory;
 	r_directory = NULL;
 }
@@ -247,6 +269,24 @@ void PAK_FindMaps(std::vector<int>& entries)
 }
 
 
+const byte * PAK_EntryData(int entry)
+{
+	SYS_ASSERT(entry >= 0 && entry < (int)r_header.entry_num);
+
+	raw_pak_entry_t *E = &r_directory[entry];
+
+	if (! r_pak_map)
+		return NULL;
+
+	// ignore entries which lie outside of the file
+	if (E->offset > (u32_t)r_pak_map_len ||
+	    E->length > (u32_t)r_pak_map_len - E->offset)
+		return NULL;
+
+	return r_pak_map + E->offset;
+}
+
+
 bool PAK_ReadData(int entry, int offset, int length, void *buffer)
 {
 	SYS_ASSERT(entry >= 0 && entry < (int)r_header.entry_num);
@@ -258,6 +298,14 @@ bool PAK_ReadData(int entry, int offset, int length, void *buffer)
 	if ((u32_t)offset + (u32_t)length > E->length)  // EOF
 		return false;
 
+	const byte *data = PAK_EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
 #ifdef HAVE_PHYSFS
 	if (! PHYSFS_seek(r_pak_fp, E->offset + offset))
 		return false;
@@ -306,6 +354,8 @@ static std::list<raw_pak_entry_t> w_pak_dir;
 
 static raw_pak_entry_t w_pak_entry;
 
+static bool w_pak_error;
+
 
 bool PAK_OpenWrite(const char *filename)
 {
@@ -319,6 +369,8 @@ bool PAK_OpenWrite(const char *filename)
 
 	LogPrintf("Created PAK file: %s\n", filename);
 
+	w_pak_error = false;
+
 	// write out a dummy header
 	raw_pak_header_t header;
 	memset(&header, 0, sizeof(header));
@@ -330,7 +382,7 @@ bool PAK_OpenWrite(const char *filename)
 }
 
 
-void PAK_CloseWrite(void)
+bool PAK_CloseWrite(void)
 {
 	fflush(w_pak_fp);
 
@@ -364,16 +416,25 @@ void PAK_CloseWrite(void)
 	header.dir_start = LE_U32(header.dir_start);
 	header.entry_num = LE_U32(header.entry_num);
 
-	fseek(w_pak_fp, 0, SEEK_SET);
+	if (fseek(w_pak_fp, 0, SEEK_SET) != 0 ||
+		fwrite(&header, sizeof(header), 1, w_pak_fp) != 1)
+	{
+		w_pak_error = true;
+	}
 
-	fwrite(&header, sizeof(header), 1, w_pak_fp);
+	if (fclose(w_pak_fp) != 0)
+		w_pak_error = true;
 
-	fflush(w_pak_fp);
-	fclose(w_pak_fp);
+	w_pak_fp = NULL;
 
-	LogPrintf("Closed PAK file\n");
+	if (w_pak_error)
+		LogPrintf("PAK_CloseWrite: error writing file\n");
+	else
+		LogPrintf("Closed PAK file\n");
 
 	w_pak_dir.clear();
+
+	return ! w_pak_error;
 }
 
 
@@ -400,6 +461,32 @@ bool PAK_AppendData(const void *data, int length)
 }
 
 
+void PAK_ReserveData(int length)
+{
+	SYS_ASSERT((int)ftell(w_pak_fp) == (int)w_pak_entry.offset);
+
+	for (; length > 0 ; length--)
+		fputc(0, w_pak_fp);
+}
+
+
+bool PAK_PatchData(int offset, const void *data, int length)
+{
+	SYS_ASSERT(offset >= 0 && length > 0);
+
+	if (fseek(w_pak_fp, (int)w_pak_entry.offset + offset, SEEK_SET) != 0 ||
+		fwrite(data, length, 1, w_pak_fp) != 1)
+	{
+		w_pak_error = true;
+	}
+
+	if (fseek(w_pak_fp, 0, SEEK_END) != 0)
+		w_pak_error = true;
+
+	return ! w_pak_error;
+}
+
+
 void PAK_FinishLump(void)
 {
 	int len = (int)ftell(w_pak_fp) - (int)w_pak_entry.offset;
@@ -36,18 +36,29 @@ const char * PAK_EntryName(int entry);
 
 bool PAK_ReadData(int entry, int offset, int length, void *buffer);
 
+// returns the data of an entry directly when the file is memory-mapped,
+// otherwise NULL (and PAK_ReadData must be used).  The pointer is valid
+// until the file is closed.
+const byte * PAK_EntryData(int entry);
+
 void PAK_ListEntries(void);
 
 
 /* PAK writing */
 
 bool PAK_OpenWrite(const char *filename);
-void PAK_CloseWrite(void);
+bool PAK_CloseWrite(void);  // returns false on a write error
 
 void PAK_NewLump(const char *name);
 bool PAK_AppendData(const void *data, int length);
 void PAK_FinishLump(void);
 
+// writes 'length' zero bytes at the start of the current lump,
+// which can be replaced later by PAK_PatchData().  That returns
+// false on a write error (and so will PAK_CloseWrite).
+void PAK_ReserveData(int length);
+bool PAK_PatchData(int offset, const void *data, int length);
+
 
 /* ----- PAK structures ---------------------- */
 
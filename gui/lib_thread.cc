@@ -0,0 +1,350 @@
+//------------------------------------------------------------------------
+//  Worker Threads
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+// the WIN32 cross-compiler may lack std::thread, so builds for
+// Windows simply run everything on the main thread.
+#ifndef WIN32
+#include <thread>
+#include <atomic>
+#include <mutex>
+#endif
+
+#include "lib_thread.h"
+
+#include "main.h"
+
+
+#define MAX_THREADS  64
+
+
+int Thread_Count()
+{
+#ifdef WIN32
+	return 1;
+#else
+	static int count = -1;
+
+	if (count < 0)
+	{
+		count = (int)std::thread::hardware_concurrency();
+
+		count = CLAMP(1, count, MAX_THREADS);
+	}
+
+	return count;
+#endif
+}
+
+
+#ifndef WIN32
+
+// thrown to leave a call which had a fatal error
+class parallel_error_c
+{ };
+
+
+class parallel_job_c
+{
+public:
+	int total;
+
+	parallel_func_f func;
+	void *priv_dat;
+
+	std::atomic<int> next;
+
+	// the first error, raised again by the calling thread
+	std::mutex error_mutex;
+
+	bool failed;
+	bool is_assert;
+
+	std::string error;
+
+public:
+	parallel_job_c(int _total, parallel_func_f _func, void *_priv) :
+		total(_total), func(_func), priv_dat(_priv), next(0),
+		failed(false), is_assert(false), error()
+	{ }
+
+	void Run()
+	{
+		for (;;)
+		{
+			int index = next.fetch_add(1);
+
+			if (index >= total)
+				return;
+
+			func(index, priv_dat);
+		}
+	}
+
+	void SetError(const char *msg, bool _assert)
+	{
+		std::unique_lock<std::mutex> lock(error_mutex);
+
+		// stop handing out the remaining calls
+		next = total;
+
+		if (failed)
+			return;
+
+		failed    = true;
+		is_assert = _assert;
+		error     = msg;
+	}
+
+	void RaiseError()
+	{
+		if (! failed)
+			return;
+
+		if (is_assert)
+			throw assert_fail_c(error.c_str());
+
+		Main_FatalError("%s", error.c_str());
+	}
+};
+
+
+static thread_local parallel_job_c * cur_parallel_job;
+
+
+static void Thread_RunJob(parallel_job_c *job)
+{
+	// errors are kept in the job, the calling thread raises them
+
+	parallel_job_c *old_job = cur_parallel_job;
+
+	cur_parallel_job = job;
+
+	try
+	{
+		job->Run();
+	}
+	catch (parallel_error_c)
+	{
+		// already stored
+	}
+	catch (assert_fail_c err)
+	{
+		job->SetError(err.GetMessage(), true);
+	}
+	catch (...)
+	{
+		job->SetError("An unknown problem occurred (parallel job)", false);
+	}
+
+	cur_parallel_job = old_job;
+}
+
+#endif
+
+
+bool Thread_InParallel()
+{
+#ifdef WIN32
+	return false;
+#else
+	return (cur_parallel_job != NULL);
+#endif
+}
+
+
+void Thread_ParallelError(const char *msg)
+{
+#ifdef WIN32
+	Main_FatalError("%s", msg);
+#else
+	SYS_ASSERT(cur_parallel_job);
+
+	cur_parallel_job->SetError(msg, false);
+
+	throw parallel_error_c();
+#endif
+}
+
+
+void Thread_ParallelFor(int total, parallel_func_f func, void *priv_dat)
+{
+	int num_threads = MIN(Thread_Count(), total);
+
+	if (num_threads <= 1)
+	{
+		for (int i = 0 ; i < total ; i++)
+			func(i, priv_dat);
+
+		return;
+	}
+
+#ifndef WIN32
+	parallel_job_c job(total, func, priv_dat);
+
+	std::vector<std::thread> workers;
+
+	for (int t = 1 ; t < num_threads ; t++)
+		workers.push_back(std::thread(Thread_RunJob, &job));
+
+	// the calling thread does its share of the work too
+	Thread_RunJob(&job);
+
+	for (unsigned int k = 0 ; k < workers.size() ; k++)
+		workers[k].join();
+
+	// the calling thread knows how to handle the error (e.g. it is
+	// the build thread), the helper threads do not.
+	job.RaiseError();
+#endif
+}
+
+
+//------------------------------------------------------------------------
+
+struct thread_handle_s
+{
+#ifndef WIN32
+	std::thread thread;
+#endif
+};
+
+
+thread_handle_t * Thread_Start(thread_func_f func, void *priv_dat)
+{
+#ifdef WIN32
+	return NULL;
+#else
+	thread_handle_t *handle = new thread_handle_t;
+
+	handle->thread = std::thread(func, priv_dat);
+
+	return handle;
+#endif
+}
+
+
+void Thread_Join(thread_handle_t *handle)
+{
+#ifndef WIN32
+	handle->thread.join();
+#endif
+
+	delete handle;
+}
+
+
+//------------------------------------------------------------------------
+
+// the reader and writer positions only ever increase, and the slot
+// used is the position modulo the capacity.
+struct queue_counters_s
+{
+#ifdef WIN32
+	volatile unsigned int read_pos;
+	volatile unsigned int write_pos;
+#else
+	std::atomic<unsigned int> read_pos;
+	std::atomic<unsigned int> write_pos;
+#endif
+};
+
+
+thread_queue_c::thread_queue_c(int _rec_size, int _capacity) :
+	rec_size(_rec_size), capacity(_capacity)
+{
+	// keeps the slots correct when the positions wrap around
+	SYS_ASSERT((capacity & (capacity - 1)) == 0);
+
+	records = new byte[rec_size * capacity];
+
+	queue_counters_s *C = new queue_counters_s;
+
+	C->read_pos  = 0;
+	C->write_pos = 0;
+
+	counters = C;
+}
+
+
+thread_queue_c::~thread_queue_c()
+{
+	delete[] records;
+	delete (queue_counters_s *)counters;
+}
+
+
+bool thread_queue_c::Push(const void *rec)
+{
+	queue_counters_s *C = (queue_counters_s *)counters;
+
+#ifdef WIN32
+	unsigned int w = C->write_pos;
+	unsigned int r = C->read_pos;
+#else
+	unsigned int w = C->write_pos.load(std::memory_order_relaxed);
+	unsigned int r = C->read_pos .load(std::memory_order_acquire);
+#endif
+
+	if (w - r >= (unsigned int)capacity)
+		return false;
+
+	memcpy(records + (w % capacity) * rec_size, rec, rec_size);
+
+#ifdef WIN32
+	C->write_pos = w + 1;
+#else
+	C->write_pos.store(w + 1, std::memory_order_release);
+#endif
+
+	return true;
+}
+
+
+bool thread_queue_c::Pop(void *rec)
+{
+	queue_counters_s *C = (queue_counters_s *)counters;
+
+#ifdef WIN32
+	unsigned int r = C->read_pos;
+	unsigned int w = C->write_pos;
+#else
+	unsigned int r = C->read_pos .load(std::memory_order_relaxed);
+	unsigned int w = C->write_pos.load(std::memory_order_acquire);
+#endif
+
+	if (r == w)
+		return false;
+
+	memcpy(rec, records + (r % capacity) * rec_size, rec_size);
+
+#ifdef WIN32
+	C->read_pos = r + 1;
+#else
+	C->read_pos.store(r + 1, std::memory_order_release);
+#endif
+
+	return true;
+}
+
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -0,0 +1,95 @@
+//------------------------------------------------------------------------
+//  Worker Threads
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __LIB_THREAD_H__
+#define __LIB_THREAD_H__
+
+typedef void (* parallel_func_f)(int index, void *priv_dat);
+
+int Thread_Count();
+// returns the number of threads which Thread_ParallelFor() will
+// use, which is the number of CPU cores (and always at least 1).
+
+void Thread_ParallelFor(int total, parallel_func_f func, void *priv_dat = NULL);
+// calls the function once for every index in the range [0, total),
+// spreading the calls over several threads.  The order of the calls
+// is unspecified, hence each call must only read shared data and
+// only write to its own part of the output.  Returns once every
+// call has finished.
+//
+// The function must not call any FLTK or Lua code.
+//
+// A fatal error (or failed assertion) in any call stops the others,
+// and is raised again in the calling thread once they have finished.
+
+bool Thread_InParallel();
+// true while running a call of Thread_ParallelFor().
+
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+void Thread_ParallelError(const char *msg);
+// used by Main_FatalError() inside a Thread_ParallelFor() call.
+// The error is passed back to the calling thread.  Never returns.
+
+
+typedef void (* thread_func_f)(void *priv_dat);
+
+typedef struct thread_handle_s thread_handle_t;
+
+thread_handle_t * Thread_Start(thread_func_f func, void *priv_dat = NULL);
+// runs the function on a new thread.  Returns NULL when threads are
+// not supported, and the caller should simply call the function.
+
+void Thread_Join(thread_handle_t *handle);
+// waits for the thread to finish, and frees the handle.
+
+
+class thread_queue_c
+{
+	// A queue of fixed size records, for passing messages from one
+	// thread to another without any locking.  Only one thread may
+	// push records, and only one (other) thread may pop them.
+	// The capacity must be a power of two.
+
+private:
+	int rec_size;
+	int capacity;
+
+	byte *records;
+
+	// the counters are atomic (except on Windows)
+	void *counters;
+
+public:
+	 thread_queue_c(int _rec_size, int _capacity);
+	~thread_queue_c();
+
+	// returns false if the queue is full
+	bool Push(const void *rec);
+
+	// returns false if the queue is empty
+	bool Pop(void *rec);
+};
+
+#endif /* __LIB_THREAD_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -26,6 +26,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>   // usleep()
+#include <sys/resource.h>
 #endif
 
 
@@ -441,5 +442,44 @@ void TimeDelay(u32_t millies)
 }
 
 
+//------------------------------------------------------------------------
+
+void MemoryGetUsage(u32_t *cur_kb, u32_t *peak_kb)
+{
+	// values are zero when unknown
+
+	*cur_kb  = 0;
+	*peak_kb = 0;
+
+#ifdef UNIX
+	struct rusage usage;
+
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+#ifdef __APPLE__
+		*peak_kb = (u32_t) (usage.ru_maxrss / 1024);
+#else
+		*peak_kb = (u32_t) usage.ru_maxrss;
+#endif
+	}
+
+#ifdef __linux__
+	// second field is the resident set size (in pages)
+	FILE *fp = fopen("/proc/self/statm", "r");
+
+	if (fp)
+	{
+		unsigned long size, resident;
+
+		if (fscanf(fp, "%lu %lu", &size, &resident) == 2)
+			*cur_kb = (u32_t) (resident * (sysconf(_SC_PAGESIZE) / 1024));
+
+		fclose(fp);
+	}
+#endif
+#endif
+}
+
+
 //--- editor settings ---
 // vi:ts=4:sw=4:noexpandtab
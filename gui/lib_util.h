@@ -43,6 +43,10 @@ char *mem_gets(char *buf, int size, const char ** str_ptr);
 u32_t TimeGetMillies();
 void TimeDelay(u32_t millies);
 
+/* memory utilities */
+
+void MemoryGetUsage(u32_t *cur_kb, u32_t *peak_kb);
+
 /* math utilities */
 
 u32_t IntHash(u32_t key);
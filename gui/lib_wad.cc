@@ -25,8 +25,10 @@
 
 #ifdef HAVE_PHYSFS
 #include "physfs.h"
+#include "m_addons.h"  // VFS_MapFile
 #endif
 
+#include "lib_file.h"
 #include "lib_util.h"
 #include "lib_wad.h"
 
@@ -46,6 +48,10 @@ static FILE *wad_R_fp;
 static raw_wad_header_t  wad_R_header;
 static raw_wad_lump_t * wad_R_dir;
 
+// the whole file when it could be memory-mapped, otherwise NULL
+static const byte * wad_R_map;
+static int wad_R_map_len;
+
 bool WAD_OpenRead(const char *filename)
 {
 #ifdef HAVE_PHYSFS
@@ -153,6 +159,12 @@ bool WAD_OpenRead(const char *filename)
 		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, L->start, L->length, L->name);
 	}
 
+#ifdef HAVE_PHYSFS
+	wad_R_map = VFS_MapFile(filename, &wad_R_map_len);
+#else
+	wad_R_map = FileMapRead(filename, &wad_R_map_len);
+#endif
+
 	return true; // OK
 }
 
@@ -165,6 +177,16 @@ void WAD_CloseRead(void)
 	fclose(wad_R_fp);
 #endif
 
+	if (wad_R_map)
+	{
+#ifdef HAVE_PHYSFS
+		VFS_UnmapFile(wad_R_map, wad_R_map_len);
+#else
+		FileUnmap(wad_R_map, wad_R_map_len);
+#endif
+		wad_R_map = NULL;
+	}
+
 	LogPrintf("Closed WAD file\n");
 
 	delete[] wad_R_dir;
@@ -216,6 +238,24 @@ const char * WAD_EntryName(int entry)
 }
 
 
+const byte * WAD_EntryData(int entry)
+{
+	SYS_ASSERT(entry >= 0 && entry < (int)wad_R_header.num_lumps);
+
+	raw_wad_lump_t *L = &wad_R_dir[entry];
+
+	if (! wad_R_map)
+		return NULL;
+
+	// ignore entries which lie outside of the file
+	if (L->start > (u32_t)wad_R_map_len ||
+	    L->length > (u32_t)wad_R_map_len - L->start)
+		return NULL;
+
+	return wad_R_map + L->start;
+}
+
+
 bool WAD_ReadData(int entry, int offset, int length, void *buffer)
 {
 	SYS_ASSERT(entry >= 0 && entry < (int)wad_R_header.num_lumps);
@@ -227,6 +267,14 @@ bool WAD_ReadData(int entry, int offset, int length, void *buffer)
 	if ((u32_t)offset + (u32_t)length > L->length)  // EOF
 		return false;
 
+	const byte *data = WAD_EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
 #if HAVE_PHYSFS
 	if (! PHYSFS_seek(wad_R_fp, L->start + offset))
 		return false;
@@ -271,38 +319,102 @@ void WAD_ListEntries(void)
 
 static FILE *wad_W_fp;
 
-static std::list<raw_wad_lump_t> wad_W_directory;
+// the file is written under a temporary name, and only renamed to
+// the final name once it is complete.
+static char *wad_W_filename;
+static char *wad_W_tempname;
+
+static std::vector<raw_wad_lump_t> wad_W_directory;
 
 static raw_wad_lump_t wad_W_lump;
 
+// current size of the file (including any buffered data)
+static u32_t wad_W_pos;
+
+// data is collected here and written out in large pieces
+#define WAD_W_BUFFER_SIZE  (1 << 20)
+
+static byte * wad_W_buffer;
+static int wad_W_buf_used;
+
+static bool wad_W_error;
+
+
+static void WAD_FlushBuffer()
+{
+	if (wad_W_buf_used > 0)
+	{
+		if (fwrite(wad_W_buffer, wad_W_buf_used, 1, wad_W_fp) != 1)
+			wad_W_error = true;
+
+		wad_W_buf_used = 0;
+	}
+}
+
+
+static void WAD_RawWrite(const void *data, int length)
+{
+	wad_W_pos += (u32_t)length;
+
+	if (wad_W_buf_used + length > WAD_W_BUFFER_SIZE)
+	{
+		WAD_FlushBuffer();
+
+		// large pieces are written directly
+		if (length >= WAD_W_BUFFER_SIZE)
+		{
+			if (fwrite(data, length, 1, wad_W_fp) != 1)
+				wad_W_error = true;
+
+			return;
+		}
+	}
+
+	memcpy(wad_W_buffer + wad_W_buf_used, data, length);
+
+	wad_W_buf_used += length;
+}
+
 
 bool WAD_OpenWrite(const char *filename)
 {
-	wad_W_fp = fopen(filename, "wb");
+	wad_W_tempname = StringPrintf("%s.part", filename);
+
+	wad_W_fp = fopen(wad_W_tempname, "wb");
 
 	if (! wad_W_fp)
 	{
-		LogPrintf("WAD_OpenWrite: cannot create file: %s\n", filename);
+		LogPrintf("WAD_OpenWrite: cannot create file: %s\n", wad_W_tempname);
+
+		StringFree(wad_W_tempname);
+		wad_W_tempname = NULL;
 		return false;
 	}
 
 	LogPrintf("Created WAD file: %s\n", filename);
 
+	wad_W_filename = StringDup(filename);
+
+	wad_W_buffer   = new byte[WAD_W_BUFFER_SIZE];
+	wad_W_buf_used = 0;
+
+	wad_W_pos   = 0;
+	wad_W_error = false;
+
+	wad_W_directory.clear();
+
 	// write out a dummy header
 	raw_wad_header_t header;
 	memset(&header, 0, sizeof(header));
 
-	fwrite(&header, sizeof(raw_wad_header_t), 1, wad_W_fp);
-	fflush(wad_W_fp);
+	WAD_RawWrite(&header, sizeof(raw_wad_header_t));
 
 	return true;
 }
 
 
-void WAD_CloseWrite(void)
+bool WAD_CloseWrite(bool keep)
 {
-	fflush(wad_W_fp);
-
 	// write the directory
 
 	LogPrintf("Writing WAD directory\n");
@@ -311,37 +423,72 @@ void WAD_CloseWrite(void)
 
 	memcpy(header.magic, "PWAD", sizeof(header.magic));
 
-	header.dir_start = (int)ftell(wad_W_fp);
-	header.num_lumps = 0;
-
-	std::list<raw_wad_lump_t>::iterator WDI;
+	header.dir_start = LE_U32(wad_W_pos);
+	header.num_lumps = LE_U32((u32_t)wad_W_directory.size());
 
-	for (WDI = wad_W_directory.begin(); WDI != wad_W_directory.end(); WDI++)
+	if (! wad_W_directory.empty())
 	{
-		raw_wad_lump_t *L = & (*WDI);
-
-		fwrite(L, sizeof(raw_wad_lump_t), 1, wad_W_fp);
-
-		header.num_lumps++;
+		WAD_RawWrite(&wad_W_directory[0], (int)wad_W_directory.size() * sizeof(raw_wad_lump_t));
 	}
 
-	fflush(wad_W_fp);
+	WAD_FlushBuffer();
 
 	// finally write the _real_ WAD header
 
-	header.dir_start = LE_U32(header.dir_start);
-	header.num_lumps = LE_U32(header.num_lumps);
-
 	fseek(wad_W_fp, 0, SEEK_SET);
 
-	fwrite(&header, sizeof(header), 1, wad_W_fp);
+	if (fwrite(&header, sizeof(header), 1, wad_W_fp) != 1)
+		wad_W_error = true;
 
-	fflush(wad_W_fp);
-	fclose(wad_W_fp);
+	if (fclose(wad_W_fp) != 0)
+		wad_W_error = true;
 
-	LogPrintf("Closed WAD file\n");
+	wad_W_fp = NULL;
+
+	// move the finished file into place
+
+	if (! keep)
+	{
+		LogPrintf("Discarding WAD file\n");
+
+		FileDelete(wad_W_tempname);
+	}
+	else if (! wad_W_error)
+	{
+#ifdef WIN32
+		// Windows cannot rename onto an existing file
+		FileDelete(wad_W_filename);
+#endif
+		if (! FileRename(wad_W_tempname, wad_W_filename))
+		{
+			LogPrintf("WAD_CloseWrite: cannot rename to: %s\n", wad_W_filename);
+			wad_W_error = true;
+		}
+	}
+
+	if (wad_W_error)
+	{
+		LogPrintf("WAD_CloseWrite: error writing file: %s\n", wad_W_filename);
+
+		FileDelete(wad_W_tempname);
+	}
+	else if (keep)
+	{
+		LogPrintf("Closed WAD file\n");
+	}
+
+	delete[] wad_W_buffer;
+	wad_W_buffer = NULL;
+
+	StringFree(wad_W_filename);
+	StringFree(wad_W_tempname);
+
+	wad_W_filename = NULL;
+	wad_W_tempname = NULL;
 
 	wad_W_directory.clear();
+
+	return ! wad_W_error;
 }
 
 
@@ -352,9 +499,9 @@ void WAD_NewLump(const char *name)
 
 	memset(&wad_W_lump, 0, sizeof(wad_W_lump));
 
-	strncpy(wad_W_lump.name, name, 8);
+	memcpy(wad_W_lump.name, name, strlen(name));
 
-	wad_W_lump.start = (u32_t)ftell(wad_W_fp);
+	wad_W_lump.start = wad_W_pos;
 }
 
 
@@ -365,13 +512,15 @@ bool WAD_AppendData(const void *data, int length)
 
 	SYS_ASSERT(length > 0);
 
-	return (fwrite(data, length, 1, wad_W_fp) == 1);
+	WAD_RawWrite(data, length);
+
+	return ! wad_W_error;
 }
 
 
 void WAD_FinishLump(void)
 {
-	int len = (int)ftell(wad_W_fp) - (int)wad_W_lump.start;
+	int len = (int)wad_W_pos - (int)wad_W_lump.start;
 
 	// pad lumps to a multiple of four bytes
 	int padding = ALIGN_LEN(len) - len;
@@ -380,7 +529,7 @@ void WAD_FinishLump(void)
 	{
 		static u8_t zeros[4] = { 0,0,0,0 };
 
-		fwrite(zeros, padding, 1, wad_W_fp);
+		WAD_RawWrite(zeros, padding);
 	}
 
 	// fix endianness
@@ -404,6 +553,10 @@ static FILE *wad2_R_fp;
 static raw_wad2_header_t  wad2_R_header;
 static raw_wad2_lump_t * wad2_R_dir;
 
+// the whole file when it could be memory-mapped, otherwise NULL
+static const byte * wad2_R_map;
+static int wad2_R_map_len;
+
 bool WAD2_OpenRead(const char *filename)
 {
 #ifdef HAVE_PHYSFS
@@ -515,6 +668,12 @@ bool WAD2_OpenRead(const char *filename)
 		//  DebugPrintf(" %4d: %08x %08x : %s\n", i, L->start, L->length, L->name);
 	}
 
+#ifdef HAVE_PHYSFS
+	wad2_R_map = VFS_MapFile(filename, &wad2_R_map_len);
+#else
+	wad2_R_map = FileMapRead(filename, &wad2_R_map_len);
+#endif
+
 	return true; // OK
 }
 
@@ -527,6 +686,16 @@ void WAD2_CloseRead(void)
 	fclose(wad2_R_fp);
 #endif
 
+	if (wad2_R_map)
+	{
+#ifdef HAVE_PHYSFS
+		VFS_UnmapFile(wad2_R_map, wad2_R_map_len);
+#else
+		FileUnmap(wad2_R_map, wad2_R_map_len);
+#endif
+		wad2_R_map = NULL;
+	}
+
 	LogPrintf("Closed WAD2 file\n");
 
 	delete[] wad2_R_dir;
@@ -578,6 +747,24 @@ int WAD2_EntryType(int entry)
 	return wad2_R_dir[entry].type;
 }
 
+const byte * WAD2_EntryData(int entry)
+{
+	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
+
+	raw_wad2_lump_t *L = &wad2_R_dir[entry];
+
+	if (! wad2_R_map || L->compression != 0)
+		return NULL;
+
+	// ignore entries which lie outside of the file
+	if (L->start > (u32_t)wad2_R_map_len ||
+	    L->length > (u32_t)wad2_R_map_len - L->start)
+		return NULL;
+
+	return wad2_R_map + L->start;
+}
+
+
 bool WAD2_ReadData(int entry, int offset, int length, void *buffer)
 {
 	SYS_ASSERT(entry >= 0 && entry < (int)wad2_R_header.num_lumps);
@@ -589,6 +776,14 @@ bool WAD2_ReadData(int entry, int offset, int length, void *buffer)
 	if ((u32_t)offset + (u32_t)length > L->length)  // EOF
 		return false;
 
+	const byte *data = WAD2_EntryData(entry);
+
+	if (data)
+	{
+		memcpy(buffer, data + offset, length);
+		return true;
+	}
+
 #ifdef HAVE_PHYSFS
 	if (! PHYSFS_seek(wad2_R_fp, L->start + offset))
 		return false;
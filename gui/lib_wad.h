@@ -34,13 +34,20 @@ const char * WAD_EntryName(int entry);
 
 bool WAD_ReadData(int entry, int offset, int length, void *buffer);
 
+// returns the data of an entry directly when the file is memory-mapped,
+// otherwise NULL (and WAD_ReadData must be used).  The pointer is valid
+// until the file is closed.
+const byte * WAD_EntryData(int entry);
+
 void WAD_ListEntries(void);
 
 
 /* WAD writing */
 
 bool WAD_OpenWrite(const char *filename);
-void WAD_CloseWrite(void);
+// when 'keep' is false (a failed build), the new file is discarded
+// and any existing file is left alone.  Returns false on a write error.
+bool WAD_CloseWrite(bool keep);
 
 void WAD_NewLump(const char *name);
 bool WAD_AppendData(const void *data, int length);
@@ -61,6 +68,9 @@ const char * WAD2_EntryName(int entry);
 
 bool WAD2_ReadData(int entry, int offset, int length, void *buffer);
 
+// like WAD_EntryData(), this is also NULL for compressed entries
+const byte * WAD2_EntryData(int entry);
+
 void WAD2_ListEntries(void);
 
 
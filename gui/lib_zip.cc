@@ -665,6 +665,11 @@ static zip_local_entry_t w_local;
 static int w_local_start;
 static int w_local_length;
 
+// the reserved part at the start of the current lump
+static std::vector<byte> w_reserved;
+
+static bool w_zip_error;
+
 // common date and time (not swapped)
 static int zipf_date;
 static int zipf_time;
@@ -682,6 +687,8 @@ bool ZIPF_OpenWrite(const char *filename)
 
 	LogPrintf("Created ZIP file: %s\n", filename);
 
+	w_zip_error = false;
+
 	// grab the current date and time
 	time_t cur_time = time(NULL);
 
@@ -708,7 +715,7 @@ bool ZIPF_OpenWrite(const char *filename)
 }
 
 
-void ZIPF_CloseWrite(void)
+bool ZIPF_CloseWrite(void)
 {
 	fflush(w_zip_fp);
 
@@ -752,15 +759,21 @@ void ZIPF_CloseWrite(void)
 	end_part.dir_offset = LE_U32(dir_offset);
 	end_part.dir_size   = LE_U32(dir_size);
 
-	fwrite(&end_part, sizeof(end_part), 1, w_zip_fp);
+	if (fwrite(&end_part, sizeof(end_part), 1, w_zip_fp) != 1)
+		w_zip_error = true;
 
-	fflush(w_zip_fp);
-	fclose(w_zip_fp);
+	if (fclose(w_zip_fp) != 0)
+		w_zip_error = true;
 
-	LogPrintf("Closed ZIP file\n");
+	if (w_zip_error)
+		LogPrintf("ZIPF_CloseWrite: error writing file\n");
+	else
+		LogPrintf("Closed ZIP file\n");
 
 	w_zip_fp = NULL;
 	w_directory.clear();
+
+	return ! w_zip_error;
 }
 
 
@@ -773,6 +786,8 @@ void ZIPF_NewLump(const char *name)
 	w_local_start  = (int)ftell(w_zip_fp);
 	w_local_length = 0;
 
+	w_reserved.clear();
+
 	// setup the zip_local_entry_t fields
 	memcpy(w_local.hdr.magic, ZIPF_LOCAL_MAGIC, 4);
 
@@ -821,24 +836,79 @@ bool ZIPF_AppendData(const void *data, int length)
 }
 
 
+void ZIPF_ReserveData(int length)
+{
+	SYS_ASSERT(w_local_length == 0);
+	SYS_ASSERT(w_reserved.empty());
+
+	if (length <= 0)
+		return;
+
+	w_reserved.resize(length, 0);
+
+	fwrite(&w_reserved[0], length, 1, w_zip_fp);
+
+	w_local_length = length;
+}
+
+
+bool ZIPF_PatchData(int offset, const void *data, int length)
+{
+	SYS_ASSERT(offset >= 0 && length > 0);
+	SYS_ASSERT(offset + length <= (int)w_reserved.size());
+
+	memcpy(&w_reserved[offset], data, length);
+
+	int name_length = LE_U16(w_local.hdr.name_length);
+
+	int pos = w_local_start + (int)sizeof(w_local.hdr) + name_length + offset;
+
+	if (fseek(w_zip_fp, pos, SEEK_SET) != 0 ||
+		fwrite(data, length, 1, w_zip_fp) != 1)
+	{
+		w_zip_error = true;
+	}
+
+	if (fseek(w_zip_fp, 0, SEEK_END) != 0)
+		w_zip_error = true;
+
+	return ! w_zip_error;
+}
+
+
 void ZIPF_FinishLump(void)
 {
 	fflush(w_zip_fp);
 
+	// the CRC so far only covers the data after the reserved part,
+	// hence combine it with the CRC of the reserved part.
+	if (! w_reserved.empty())
+	{
+		uLong res_crc = crc32(0, &w_reserved[0], (uInt)w_reserved.size());
+
+		w_local.hdr.crc = crc32_combine(res_crc, w_local.hdr.crc,
+				w_local_length - (int)w_reserved.size());
+
+		w_reserved.clear();
+	}
+
 	w_local.hdr.full_size     = LE_U32(w_local_length);
 	w_local.hdr.compress_size = LE_U32(w_local_length);
 
 	// seek back and fix up the CRC and size fields
-	fseek(w_zip_fp, w_local_start + LOCAL_CRC_OFFSET, SEEK_SET);
-
-	fwrite(&w_local.hdr.crc,           4, 1, w_zip_fp);
-	fwrite(&w_local.hdr.compress_size, 4, 1, w_zip_fp);
-	fwrite(&w_local.hdr.full_size,     4, 1, w_zip_fp);
+	if (fseek(w_zip_fp, w_local_start + LOCAL_CRC_OFFSET, SEEK_SET) != 0 ||
+		fwrite(&w_local.hdr.crc,           4, 1, w_zip_fp) != 1 ||
+		fwrite(&w_local.hdr.compress_size, 4, 1, w_zip_fp) != 1 ||
+		fwrite(&w_local.hdr.full_size,     4, 1, w_zip_fp) != 1)
+	{
+		w_zip_error = true;
+	}
 
 	fflush(w_zip_fp);
 
 	// seek back to end of file
-	fseek(w_zip_fp, 0, SEEK_END);
+	if (fseek(w_zip_fp, 0, SEEK_END) != 0)
+		w_zip_error = true;
 
 	// create the central entry from the local entry
 	zip_central_entry_t  central;
@@ -40,12 +40,19 @@ void ZIPF_ListEntries(void);
 /* ZIP writing */
 
 bool ZIPF_OpenWrite(const char *filename);
-void ZIPF_CloseWrite(void);
+bool ZIPF_CloseWrite(void);  // returns false on a write error
 
 void ZIPF_NewLump(const char *name);
 bool ZIPF_AppendData(const void *data, int length);
 void ZIPF_FinishLump(void);
 
+// writes 'length' zero bytes at the start of the current lump,
+// which can be replaced later by ZIPF_PatchData().  The CRC of
+// this part is only computed when the lump is finished.
+// Returns false on a write error (and so will ZIPF_CloseWrite).
+void ZIPF_ReserveData(int length);
+bool ZIPF_PatchData(int offset, const void *data, int length);
+
 
 /* ----- ZIP file structures ---------------------- */
 
@@ -302,6 +302,49 @@ byte * VFS_LoadFile(const char *filename, int *length)
 }
 
 
+const byte * VFS_MapFile(const char *filename, int *length)
+{
+	*length = 0;
+
+	const char *real_dir = PHYSFS_getRealDir(filename);
+
+	// skip files inside a PK3 (etc)
+	if (! real_dir || ! PathIsDirectory(real_dir))
+		return NULL;
+
+	// remove the mount point from the virtual name
+	const char *name  = filename;
+	const char *mount = PHYSFS_getMountPoint(real_dir);
+
+	while (*name == '/')
+		name++;
+
+	if (mount && strcmp(mount, "/") != 0)
+	{
+		int len = strlen(mount);
+
+		if (strncmp(name, mount, len) != 0)
+			return NULL;
+
+		name += len;
+	}
+
+	char *real_name = StringPrintf("%s/%s", real_dir, name);
+
+	const byte *mem = FileMapRead(real_name, length);
+
+	StringFree(real_name);
+
+	return mem;
+}
+
+
+void VFS_UnmapFile(const byte *mem, int length)
+{
+	FileUnmap(mem, length);
+}
+
+
 void VFS_FreeFile(const byte *mem)
 {
 	if (mem)
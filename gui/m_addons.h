@@ -33,6 +33,11 @@ bool   VFS_CopyFile(const char *src_name, const char *dest_name);
 byte * VFS_LoadFile(const char *filename, int *length);
 void   VFS_FreeFile(const byte *mem);
 
+// maps a file into memory when it is a real file on disk (rather
+// than inside an addon), otherwise returns NULL.
+const byte * VFS_MapFile(const char *filename, int *length);
+void VFS_UnmapFile(const byte *mem, int length);
+
 #endif /* __OBLIGE_ADDONS_H__ */
 
 //--- editor settings ---
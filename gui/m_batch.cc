@@ -0,0 +1,638 @@
+//------------------------------------------------------------------------
+//  BATCH : Build server and multi-seed builds
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  The server loads the scripts once, then reads build jobs one per
+//  line.  Each line looks like this:
+//
+//      <output> <seed> [key=value...]
+//
+//  where <seed> is a whole number, or "-" to pick a new one, and the
+//  key=value pairs use the same syntax as the command line (including
+//  @module names).  A line containing "quit" ends the session, and
+//  "shutdown" also stops a socket server.  Blank lines and '#'
+//  comments are ignored.  A bad line is answered with "JOB n BAD".
+//
+//  Each job is built in a forked child process, so it always starts
+//  from the same freshly initialised Lua state.  Status is sent back
+//  as lines beginning with "JOB", for example:
+//
+//      JOB 1 BEGIN foo.wad 12345
+//      JOB 1 OK 4.52
+//      JOB 2 FAILED 3
+//
+//  The multi-seed mode works the same way, except that the jobs come
+//  from the command line (--batch-count etc) and several children can
+//  be building at the same time.  In that case each child logs into
+//  its own file (the output name with a ".log" extension).
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "lib_file.h"
+#include "lib_util.h"
+
+#include "main.h"
+#include "m_batch.h"
+#include "m_cookie.h"
+
+
+#define JOB_LINE_LEN  4096
+
+
+class batch_job_c
+{
+public:
+	int number;
+
+	std::string output;
+	std::string seed;
+
+	// config lines in the "name = value" form
+	std::string config;
+
+public:
+	batch_job_c(int _num) : number(_num), output(), seed(), config()
+	{ }
+
+	~batch_job_c()
+	{ }
+};
+
+
+static char * Batch_NextToken(char ** pos)
+{
+	char *p = *pos;
+
+	while (isspace(*p))
+		p++;
+
+	if (*p == 0)
+		return NULL;
+
+	char *start = p;
+
+	// allow double quotes around filenames with spaces
+	if (*p == '"')
+	{
+		start = ++p;
+
+		while (*p && *p != '"')
+			p++;
+	}
+	else
+	{
+		while (*p && ! isspace(*p))
+			p++;
+	}
+
+	if (*p)
+		*p++ = 0;
+
+	*pos = p;
+
+	return start;
+}
+
+
+static bool Batch_ValidSeed(const char *seed)
+{
+	if (strcmp(seed, "-") == 0)
+		return true;
+
+	// only digits, and few enough to be exact in a double
+	int len = (int)strlen(seed);
+
+	if (len < 1 || len > 15)
+		return false;
+
+	for (int i = 0 ; i < len ; i++)
+		if (! isdigit(seed[i]))
+			return false;
+
+	return true;
+}
+
+
+static bool Batch_ParseJob(char *line, batch_job_c *job)
+{
+	char *pos = line;
+
+	const char *output = Batch_NextToken(&pos);
+	const char *seed   = Batch_NextToken(&pos);
+
+	if (! output || ! seed)
+		return false;
+
+	job->output = output;
+	job->seed   = seed;
+
+	const char *tok;
+
+	while ((tok = Batch_NextToken(&pos)) != NULL)
+	{
+		// allow module names to omit the value (as per command line)
+		if (tok[0] == '@' && ! strchr(tok, '='))
+		{
+			job->config += tok;
+			job->config += " = 1\n";
+			continue;
+		}
+
+		if (! strchr(tok, '='))
+			return false;
+
+		job->config += tok;
+		job->config += "\n";
+	}
+
+	return true;
+}
+
+
+static bool Batch_RunJob(batch_job_c *job)
+{
+	batch_output_file = job->output.c_str();
+
+	if (! job->config.empty())
+		Cookie_LoadString(job->config.c_str(), false /* keep_seed */);
+
+	if (job->seed == "-")
+	{
+		Main_CalcNewSeed();
+
+		next_rand_seed += job->number;
+	}
+	else
+	{
+		next_rand_seed = floor(atof(job->seed.c_str()));
+	}
+
+	Main_SetSeed();
+
+	return Build_Cool_Shit();
+}
+
+
+#ifndef WIN32
+
+static void Batch_SeparateJob(batch_job_c *job)
+{
+	// several jobs run at the same time, so each one gets its own log
+	// file (next to its output) and its status messages are prefixed.
+
+	char *log_name = ReplaceExtension(job->output.c_str(), "log");
+
+	if (! LogReopen(log_name))
+		fprintf(stderr, "Batch: cannot create log file: %s\n", log_name);
+
+	StringFree(log_name);
+
+	// the terminal is shared too
+	LogEnableTerminal(false);
+
+	batch_status_prefix = StringPrintf("[seed %s] ", job->seed.c_str());
+}
+
+
+static pid_t Batch_SpawnJob(batch_job_c *job, int progress_fd, bool separate)
+{
+	// prevent buffered output being written twice
+	fflush(stdout);
+	fflush(stderr);
+
+	pid_t pid = fork();
+
+	if (pid < 0)
+	{
+		LogPrintf("Batch: fork failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (pid == 0)
+	{
+		// child process : progress messages go to the client
+		if (progress_fd >= 0)
+			dup2(progress_fd, 2);
+
+		if (separate)
+			Batch_SeparateJob(job);
+
+		bool was_ok = Batch_RunJob(job);
+
+		fflush(stdout);
+		fflush(stderr);
+
+		_exit(was_ok ? 0 : 3);
+	}
+
+	return pid;
+}
+
+
+static int Batch_ExitCode(int status)
+{
+	if (WIFEXITED(status))
+		return WEXITSTATUS(status);
+
+	return -1;
+}
+
+
+static int Batch_ForkJob(batch_job_c *job, int progress_fd)
+{
+	pid_t pid = Batch_SpawnJob(job, progress_fd, false /* separate */);
+
+	if (pid < 0)
+		return -1;
+
+	int status;
+
+	while (waitpid(pid, &status, 0) < 0)
+	{
+		if (errno != EINTR)
+			return -1;
+	}
+
+	return Batch_ExitCode(status);
+}
+
+
+static bool Batch_ServeStream(FILE *in, FILE *out, int progress_fd)
+{
+	// returns true when the server should shut down
+
+	static int total_jobs = 0;
+
+	char buffer[JOB_LINE_LEN];
+
+	while (fgets(buffer, JOB_LINE_LEN-2, in))
+	{
+		StringRemoveCRLF(buffer);
+
+		char *line = buffer;
+
+		while (isspace(*line))
+			line++;
+
+		if (line[0] == 0 || line[0] == '#')
+			continue;
+
+		if (strcmp(line, "quit") == 0)
+			return false;
+
+		if (strcmp(line, "shutdown") == 0)
+			return true;
+
+		total_jobs += 1;
+
+		batch_job_c job(total_jobs);
+
+		if (! Batch_ParseJob(line, &job))
+		{
+			fprintf(out, "JOB %d BAD\n", job.number);
+			fflush(out);
+			continue;
+		}
+
+		if (! Batch_ValidSeed(job.seed.c_str()))
+		{
+			LogPrintf("Server: bad seed '%s'\n", job.seed.c_str());
+
+			fprintf(out, "JOB %d BAD seed\n", job.number);
+			fflush(out);
+			continue;
+		}
+
+		fprintf(out, "JOB %d BEGIN %s %s\n", job.number,
+				job.output.c_str(), job.seed.c_str());
+
+		// a write error means the client has gone away
+		if (fflush(out) != 0)
+			return false;
+
+		u32_t start_time = TimeGetMillies();
+
+		int result = Batch_ForkJob(&job, progress_fd);
+
+		u32_t total_time = TimeGetMillies() - start_time;
+
+		if (result == 0)
+			fprintf(out, "JOB %d OK %1.2f\n", job.number, total_time / 1000.0);
+		else
+			fprintf(out, "JOB %d FAILED %d\n", job.number, result);
+
+		if (fflush(out) != 0)
+			return false;
+	}
+
+	// end of file
+	return false;
+}
+
+
+static int Batch_SocketServer(const char *socket_path)
+{
+	struct sockaddr_un addr;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path))
+		Main_FatalError("Server socket path is too long: %s\n", socket_path);
+
+	memset(&addr, 0, sizeof(addr));
+
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listen_fd < 0)
+		Main_FatalError("Unable to create server socket: %s\n", strerror(errno));
+
+	// remove a stale socket from a previous run
+	unlink(socket_path);
+
+	if (bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+		listen(listen_fd, 4) < 0)
+	{
+		Main_FatalError("Unable to bind server socket: %s\n(%s)\n",
+				socket_path, strerror(errno));
+	}
+
+	LogPrintf("Server: listening on %s\n\n", socket_path);
+
+	bool shutdown = false;
+
+	while (! shutdown)
+	{
+		int conn_fd = accept(listen_fd, NULL, NULL);
+
+		if (conn_fd < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			LogPrintf("Server: accept failed: %s\n", strerror(errno));
+			break;
+		}
+
+		int out_fd = dup(conn_fd);
+
+		FILE *in  = fdopen(conn_fd, "r");
+		FILE *out = (out_fd < 0) ? NULL : fdopen(out_fd, "w");
+
+		if (! in || ! out)
+		{
+			LogPrintf("Server: fdopen failed: %s\n", strerror(errno));
+
+			if (in)  fclose(in);  else close(conn_fd);
+			if (out) fclose(out); else if (out_fd >= 0) close(out_fd);
+
+			continue;
+		}
+
+		shutdown = Batch_ServeStream(in, out, fileno(out));
+
+		fclose(in);
+		fclose(out);
+	}
+
+	close(listen_fd);
+	unlink(socket_path);
+
+	return 0;
+}
+
+
+static bool Batch_CheckPattern(const char *pattern)
+{
+	// the pattern must contain exactly one integer conversion,
+	// e.g. "%d" or "%04d", anything else is too dangerous.
+
+	int conversions = 0;
+
+	for (const char *p = pattern ; *p ; p++)
+	{
+		if (*p != '%')
+			continue;
+
+		p++;
+
+		if (*p == '%')
+			continue;
+
+		while (isdigit(*p))
+			p++;
+
+		if (*p != 'd')
+			return false;
+
+		conversions++;
+	}
+
+	return (conversions == 1);
+}
+
+
+static void Batch_ShowSummary(std::vector<batch_job_c *>& all_jobs,
+		std::vector<int>& results, std::vector<u32_t>& times)
+{
+	int failures = 0;
+
+	LogPrintf("\n===== BATCH SUMMARY =====\n\n");
+
+	fprintf(stdout, "\n%-12s %10s  %-7s %s\n", "Seed", "Time", "Result", "File");
+
+	for (unsigned int i = 0 ; i < all_jobs.size() ; i++)
+	{
+		const batch_job_c *job = all_jobs[i];
+
+		const char *res_str = (results[i] == 0) ? "ok" : "FAILED";
+
+		if (results[i] != 0)
+			failures++;
+
+		fprintf(stdout, "%-12s %9.2fs  %-7s %s\n", job->seed.c_str(),
+				times[i] / 1000.0, res_str, job->output.c_str());
+
+		LogPrintf("  seed %s : %1.2f sec : %s (%d) : %s\n", job->seed.c_str(),
+				times[i] / 1000.0, res_str, results[i], job->output.c_str());
+	}
+
+	fprintf(stdout, "\n%d of %d builds failed\n\n", failures, (int)all_jobs.size());
+	fflush(stdout);
+
+	LogPrintf("\n%d of %d builds failed\n\n", failures, (int)all_jobs.size());
+}
+
+#endif /* WIN32 */
+
+
+int Batch_MultiSeed(int count, const char *pattern, int max_jobs)
+{
+#ifdef WIN32
+	(void) count; (void) pattern; (void) max_jobs;
+
+	Main_FatalError("Multi-seed batch mode is not supported on this platform.\n");
+	return 9;  /* NOT REACHED */
+
+#else
+	SYS_ASSERT(count > 0);
+
+	if (! Batch_CheckPattern(pattern))
+		Main_FatalError("Bad --batch-pattern '%s' (needs a single %%d)\n", pattern);
+
+	if (max_jobs < 1)
+		max_jobs = 1;
+
+	// seeds are derived from the base seed (from the command line,
+	// or based on the time) simply by counting upwards.
+	double base_seed = next_rand_seed;
+
+	std::vector<batch_job_c *> all_jobs;
+
+	std::vector<int>   results(count, -1);
+	std::vector<u32_t> times  (count, 0);
+
+	for (int i = 0 ; i < count ; i++)
+	{
+		batch_job_c *job = new batch_job_c(i);
+
+		char *filename = StringPrintf(pattern, i);
+		char *seed_str = StringPrintf("%1.0f", base_seed + i);
+
+		job->output = filename;
+		job->seed   = seed_str;
+
+		StringFree(filename);
+		StringFree(seed_str);
+
+		all_jobs.push_back(job);
+	}
+
+	LogPrintf("Batch: building %d seeds with %d job(s)\n", count, max_jobs);
+
+	if (max_jobs > 1)
+		LogPrintf("Batch: the log of each build is next to its output file\n");
+
+	LogPrintf("\n");
+
+	// maps a running process to its job index
+	std::map<pid_t, int> running;
+
+	int next_job = 0;
+
+	while (next_job < count || ! running.empty())
+	{
+		while (next_job < count && (int)running.size() < max_jobs)
+		{
+			batch_job_c *job = all_jobs[next_job];
+
+			times[next_job] = TimeGetMillies();
+
+			pid_t pid = Batch_SpawnJob(job, -1 /* progress_fd */, max_jobs > 1);
+
+			if (pid < 0)
+				times[next_job] = 0;
+			else
+				running[pid] = next_job;
+
+			next_job++;
+		}
+
+		if (running.empty())
+			continue;
+
+		int status;
+
+		pid_t pid = waitpid(-1, &status, 0);
+
+		if (pid < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			Main_FatalError("Batch: waitpid failed: %s\n", strerror(errno));
+		}
+
+		std::map<pid_t, int>::iterator IT = running.find(pid);
+
+		if (IT == running.end())
+			continue;
+
+		int index = IT->second;
+
+		running.erase(IT);
+
+		results[index] = Batch_ExitCode(status);
+		times  [index] = TimeGetMillies() - times[index];
+	}
+
+	Batch_ShowSummary(all_jobs, results, times);
+
+	bool any_failed = false;
+
+	for (int i = 0 ; i < count ; i++)
+	{
+		if (results[i] != 0)
+			any_failed = true;
+
+		delete all_jobs[i];
+	}
+
+	return any_failed ? 3 : 0;
+#endif
+}
+
+
+int Batch_Server(const char *socket_path)
+{
+#ifdef WIN32
+	(void) socket_path;
+
+	Main_FatalError("Server mode is not supported on this platform.\n");
+	return 9;  /* NOT REACHED */
+
+#else
+	// a client which disconnects must not kill the server
+	signal(SIGPIPE, SIG_IGN);
+
+	if (socket_path)
+		return Batch_SocketServer(socket_path);
+
+	LogPrintf("Server: reading jobs from stdin\n\n");
+
+	Batch_ServeStream(stdin, stdout, -1 /* progress_fd */);
+
+	return 0;
+#endif
+}
+
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
@@ -0,0 +1,39 @@
+//------------------------------------------------------------------------
+//  BATCH : Build server and multi-seed builds
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __OBLIGE_BATCH_H__
+#define __OBLIGE_BATCH_H__
+
+// runs the build server.  The scripts must already be loaded and
+// the command-line config applied.  Jobs are read from stdin, or
+// from a Unix socket when 'socket_path' is not NULL.
+// Returns the exit code for the program.
+int Batch_Server(const char *socket_path);
+
+// builds 'count' levels with consecutive seeds (starting at the
+// current seed) into files named by 'pattern', which must contain
+// a single %d.  Up to 'max_jobs' builds are run at the same time.
+// Returns the exit code for the program.
+int Batch_MultiSeed(int count, const char *pattern, int max_jobs);
+
+#endif /* __OBLIGE_BATCH_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
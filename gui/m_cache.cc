@@ -0,0 +1,498 @@
+//------------------------------------------------------------------------
+//  CACHE : Level stage cache
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  The key of each level is a hash of everything the scripts send
+//  to the CSG code for that level: the brushes, entities and all
+//  the properties in effect.  Hence it covers the scripts, config,
+//  seed and level index, but is unaffected by changes which don't
+//  alter the level itself (e.g. a module which only changes later
+//  levels).
+//
+//  The Lua planning still runs for every level, since later levels
+//  depend on what happened in earlier ones, but the costly back-end
+//  stages (CSG, BSP, vis, lighting) are skipped for a cached level,
+//  and its output entries are copied from the cache file instead.
+//
+//  NOTE: the cache should be cleared when OBLIGE itself is rebuilt
+//        with changes to the back-end code.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+#include "lib_file.h"
+#include "lib_util.h"
+
+#include "main.h"
+#include "m_cache.h"
+
+
+#define CACHE_MAGIC    "OblCache"
+#define CACHE_VERSION  1
+
+typedef unsigned long long cache_hash_t;
+
+#define FNV_OFFSET_BASIS  0xcbf29ce484222325ULL
+#define FNV_PRIME         0x100000001b3ULL
+
+
+class cache_entry_c
+{
+public:
+	std::string name;
+	std::string data;
+
+public:
+	cache_entry_c(const char *_name) : name(_name), data()
+	{ }
+
+	~cache_entry_c()
+	{ }
+};
+
+
+class cache_output_c
+{
+public:
+	std::vector<cache_entry_c *> entries;
+
+	cache_write_func_t write_func;
+
+public:
+	cache_output_c() : entries(), write_func(NULL)
+	{ }
+
+	~cache_output_c()
+	{
+		for (unsigned int i = 0 ; i < entries.size() ; i++)
+			delete entries[i];
+	}
+};
+
+
+static const char *cache_dir;
+
+// the hashing is done by the thread running the scripts
+static cache_hash_t level_hash;
+
+static bool level_skipped;
+
+static std::map<std::string, std::string> cache_props;
+
+// the rest belongs to the thread running the back-end of a level
+static thread_local const char *cache_filename;
+
+static thread_local bool recording;
+static thread_local bool defer_output;
+
+static thread_local std::vector<cache_entry_c *> recorded;
+
+static thread_local cache_write_func_t recorded_func;
+
+
+void Cache_Init(const char *dir)
+{
+	if (! PathIsDirectory(dir) && ! FileMakeDir(dir))
+		Main_FatalError("Unable to create cache directory: %s\n", dir);
+
+	cache_dir = StringDup(dir);
+
+	LogPrintf("Using level cache: %s\n", cache_dir);
+}
+
+
+bool Cache_Enabled()
+{
+	return (cache_dir != NULL);
+}
+
+
+//------------------------------------------------------------------------
+//  HASHING
+//------------------------------------------------------------------------
+
+void Cache_BeginLevel()
+{
+	level_hash    = FNV_OFFSET_BASIS;
+	level_skipped = false;
+}
+
+
+void Cache_HashData(const void *data, int length)
+{
+	const byte *pos = (const byte *)data;
+
+	for (; length > 0 ; length--, pos++)
+	{
+		level_hash ^= *pos;
+		level_hash *= FNV_PRIME;
+	}
+}
+
+
+void Cache_HashString(const char *str)
+{
+	if (! str)
+		str = "";
+
+	// include the terminating NUL, so "ab","c" != "a","bc"
+	Cache_HashData(str, (int)strlen(str) + 1);
+}
+
+
+void Cache_HashNumber(double value)
+{
+	Cache_HashData(&value, sizeof(value));
+}
+
+
+void Cache_Property(const char *key, const char *value)
+{
+	if (cache_dir)
+		cache_props[std::string(key)] = std::string(value);
+}
+
+
+void Cache_SkipLevel()
+{
+	level_skipped = true;
+}
+
+
+const char * Cache_LevelKey()
+{
+	if (! cache_dir || level_skipped)
+		return NULL;
+
+	Cache_HashString(OBLIGE_VERSION);
+
+	std::map<std::string, std::string>::iterator PI;
+
+	for (PI = cache_props.begin() ; PI != cache_props.end() ; PI++)
+	{
+		Cache_HashString(PI->first.c_str());
+		Cache_HashString(PI->second.c_str());
+	}
+
+	return StringPrintf("%s%s%016llx.olc", cache_dir, DIR_SEP_STR, level_hash);
+}
+
+
+void Cache_UseKey(const char *filename)
+{
+	StringFree(cache_filename);
+
+	cache_filename = filename ? StringDup(filename) : NULL;
+}
+
+
+//------------------------------------------------------------------------
+//  CACHE FILES
+//------------------------------------------------------------------------
+
+static void Cache_FreeRecorded()
+{
+	for (unsigned int i = 0 ; i < recorded.size() ; i++)
+		delete recorded[i];
+
+	recorded.clear();
+}
+
+
+static bool Cache_ReadU32(const byte **pos, const byte *end, u32_t *val)
+{
+	if (*pos + 4 > end)
+		return false;
+
+	u32_t raw;
+	memcpy(&raw, *pos, 4);
+
+	*val = LE_U32(raw);
+	*pos += 4;
+
+	return true;
+}
+
+
+static bool Cache_ParseFile(const byte *data, int length)
+{
+	const byte *pos = data;
+	const byte *end = data + length;
+
+	if (length < 8 || memcmp(pos, CACHE_MAGIC, 8) != 0)
+		return false;
+
+	pos += 8;
+
+	u32_t version, count;
+
+	if (! Cache_ReadU32(&pos, end, &version) || version != CACHE_VERSION)
+		return false;
+
+	if (! Cache_ReadU32(&pos, end, &count))
+		return false;
+
+	for (u32_t i = 0 ; i < count ; i++)
+	{
+		u32_t name_len, data_len;
+
+		if (! Cache_ReadU32(&pos, end, &name_len) || pos + name_len > end)
+			return false;
+
+		cache_entry_c *E = new cache_entry_c("");
+
+		E->name.assign((const char *)pos, name_len);
+		pos += name_len;
+
+		recorded.push_back(E);
+
+		if (! Cache_ReadU32(&pos, end, &data_len) || pos + data_len > end)
+			return false;
+
+		E->data.assign((const char *)pos, data_len);
+		pos += data_len;
+	}
+
+	return true;
+}
+
+
+static void Cache_WriteU32(FILE *fp, u32_t val)
+{
+	u32_t raw = LE_U32(val);
+
+	fwrite(&raw, 4, 1, fp);
+}
+
+
+static bool Cache_WriteFile(const char *filename)
+{
+	// write to a temporary file and rename it, so that another
+	// build using the same cache never sees a partial file.
+#ifdef WIN32
+	char *temp_name = StringPrintf("%s.tmp", filename);
+#else
+	char *temp_name = StringPrintf("%s.%d.tmp", filename, (int)getpid());
+#endif
+
+	FILE *fp = fopen(temp_name, "wb");
+
+	if (! fp)
+	{
+		StringFree(temp_name);
+		return false;
+	}
+
+	fwrite(CACHE_MAGIC, 8, 1, fp);
+
+	Cache_WriteU32(fp, CACHE_VERSION);
+	Cache_WriteU32(fp, (u32_t)recorded.size());
+
+	for (unsigned int i = 0 ; i < recorded.size() ; i++)
+	{
+		cache_entry_c *E = recorded[i];
+
+		Cache_WriteU32(fp, (u32_t)E->name.size());
+		fwrite(E->name.data(), E->name.size(), 1, fp);
+
+		Cache_WriteU32(fp, (u32_t)E->data.size());
+
+		if (E->data.size() > 0)
+			fwrite(E->data.data(), E->data.size(), 1, fp);
+	}
+
+	bool ok = (ferror(fp) == 0);
+
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (ok && FileExists(filename))
+		FileDelete(filename);
+
+	if (ok && ! FileRename(temp_name, filename))
+		ok = false;
+
+	if (! ok)
+		FileDelete(temp_name);
+
+	StringFree(temp_name);
+
+	return ok;
+}
+
+
+//------------------------------------------------------------------------
+//  REPLAY and RECORD
+//------------------------------------------------------------------------
+
+bool Cache_ReplayLevel(cache_write_func_t write_func)
+{
+	Cache_FreeRecorded();
+
+	recorded_func = write_func;
+
+	// deferred output is always recorded, even when not caching
+	recording = defer_output;
+
+	if (! cache_filename)
+		return false;
+
+	recording = false;
+
+	if (FileExists(cache_filename))
+	{
+		int length;
+		byte *data = FileLoad(cache_filename, &length);
+
+		if (data && Cache_ParseFile(data, length))
+		{
+			FileFree(data);
+
+			LogPrintf("Level found in cache: %s\n", FindBaseName(cache_filename));
+
+			if (defer_output)
+				return true;
+
+			for (unsigned int i = 0 ; i < recorded.size() ; i++)
+			{
+				cache_entry_c *E = recorded[i];
+
+				write_func(E->name.c_str(), E->data.data(), (u32_t)E->data.size());
+			}
+
+			Cache_FreeRecorded();
+			return true;
+		}
+
+		LogPrintf("WARNING: ignoring bad cache file: %s\n", cache_filename);
+
+		FileFree(data);
+		Cache_FreeRecorded();
+	}
+
+	recording = true;
+	return false;
+}
+
+
+void Cache_NewEntry(const char *name)
+{
+	if (recording)
+		recorded.push_back(new cache_entry_c(name));
+}
+
+
+void Cache_AppendData(const void *data, int length)
+{
+	if (! recording || length <= 0)
+		return;
+
+	SYS_ASSERT(! recorded.empty());
+
+	recorded.back()->data.append((const char *)data, length);
+}
+
+
+void Cache_PatchData(int offset, const void *data, int length)
+{
+	if (! recording || length <= 0)
+		return;
+
+	SYS_ASSERT(! recorded.empty());
+
+	std::string& buf = recorded.back()->data;
+
+	SYS_ASSERT(offset >= 0 && offset + length <= (int)buf.size());
+
+	buf.replace(offset, length, (const char *)data, length);
+}
+
+
+void Cache_EndLevel()
+{
+	if (recording && cache_filename)
+	{
+		if (! Cache_WriteFile(cache_filename))
+			LogPrintf("WARNING: unable to write cache file: %s\n", cache_filename);
+	}
+
+	recording = false;
+
+	Cache_UseKey(NULL);
+
+	// deferred output is kept for Cache_TakeOutput()
+	if (! defer_output)
+		Cache_FreeRecorded();
+}
+
+
+//------------------------------------------------------------------------
+//  DEFERRED OUTPUT
+//------------------------------------------------------------------------
+
+void Cache_DeferOutput(bool enable)
+{
+	defer_output = enable;
+}
+
+
+bool Cache_OutputDeferred()
+{
+	return defer_output;
+}
+
+
+cache_output_c * Cache_TakeOutput()
+{
+	cache_output_c *out = new cache_output_c;
+
+	out->entries.swap(recorded);
+	out->write_func = recorded_func;
+
+	return out;
+}
+
+
+void Cache_WriteOutput(cache_output_c *out)
+{
+	SYS_ASSERT(! defer_output);
+
+	for (unsigned int i = 0 ; i < out->entries.size() ; i++)
+	{
+		cache_entry_c *E = out->entries[i];
+
+		out->write_func(E->name.c_str(), E->data.data(), (u32_t)E->data.size());
+	}
+
+	delete out;
+}
+
+
+void Cache_FreeOutput(cache_output_c *out)
+{
+	delete out;
+}
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
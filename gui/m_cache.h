@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------
+//  CACHE : Level stage cache
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __OBLIGE_CACHE_H__
+#define __OBLIGE_CACHE_H__
+
+// enables the cache, storing the files in the given directory
+// (which is created when needed).  The cache is off by default.
+void Cache_Init(const char *dir);
+
+bool Cache_Enabled();
+
+
+/* hashing the inputs of a level */
+
+void Cache_BeginLevel();
+
+void Cache_HashData(const void *data, int length);
+void Cache_HashString(const char *str);
+void Cache_HashNumber(double value);
+
+// properties stay in effect across levels, hence they are
+// remembered here and added to the key of every level.
+void Cache_Property(const char *key, const char *value);
+
+// prevents the current level being stored in the cache, used
+// when some input cannot be hashed.
+void Cache_SkipLevel();
+
+// finishes hashing the current level and returns the name of its
+// cache file, or NULL when the level cannot be cached.  The result
+// is passed to Cache_UseKey() before the back-end of the level runs
+// (which may be in another thread).
+const char * Cache_LevelKey();
+
+void Cache_UseKey(const char *filename);
+
+
+/* replaying and recording the output of a level */
+
+typedef void (* cache_write_func_t)(const char *name, const void *data, u32_t length);
+
+// called by the game code at the start of EndLevel().  When the
+// level is in the cache, each stored entry is written using the
+// given function (or kept when the output is deferred) and true is
+// returned.  Otherwise it begins recording the output of the level
+// and returns false.
+bool Cache_ReplayLevel(cache_write_func_t write_func);
+
+// these record the output, they do nothing unless recording
+void Cache_NewEntry(const char *name);
+void Cache_AppendData(const void *data, int length);
+void Cache_PatchData(int offset, const void *data, int length);
+
+// stores what was recorded (if anything) into the cache
+void Cache_EndLevel();
+
+
+/* deferred output, for pipelined builds */
+
+class cache_output_c;
+
+// when enabled, the output of each level built by the calling thread
+// is only recorded, and the game code must not write anything into
+// the output file.  Cache_TakeOutput() then grabs the recorded output
+// (after Cache_EndLevel) so it can be written later.
+void Cache_DeferOutput(bool enable);
+
+bool Cache_OutputDeferred();
+
+cache_output_c * Cache_TakeOutput();
+
+// writes the output using the game's write function, then frees it
+void Cache_WriteOutput(cache_output_c *out);
+void Cache_FreeOutput (cache_output_c *out);
+
+#endif /* __OBLIGE_CACHE_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
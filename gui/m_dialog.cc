@@ -197,6 +197,18 @@ void DLG_ShowError(const char *msg, ...)
 
 	buffer[MSG_BUF_LEN-2] = 0;
 
+	// the build thread cannot show a dialog itself
+	if (Main_InBuildThread())
+	{
+		static ui_message_t error_msg;
+
+		error_msg.kind = UIMSG_Error;
+		StringMaxCopy(error_msg.text, buffer, MSG_BUF_LEN);
+
+		Main_PostMessage(&error_msg);
+		return;
+	}
+
 	LogPrintf("\n%s\n\n", buffer);
 
 	const char *link_title = NULL;
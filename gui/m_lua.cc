@@ -598,8 +598,7 @@ int gui_at_level(lua_State *L)
 
 	Main_ProgStatus(_("Making %s"), name);
 
-	if (main_win)
-		main_win->build_box->Prog_AtLevel(index, total);
+	Main_ProgAtLevel(index, total);
 
 	return 0;
 }
@@ -611,8 +610,7 @@ int gui_prog_step(lua_State *L)
 {
 	const char *name = luaL_checkstring(L,1);
 
-	if (main_win)
-		main_win->build_box->Prog_Step(name);
+	Main_ProgStep(name);
 
 	return 0;
 }
@@ -631,7 +629,7 @@ int gui_ticker(lua_State *L)
 //
 int gui_abort(lua_State *L)
 {
-	int value = (main_action >= MAIN_CANCEL) ? 1 : 0;
+	int value = Main_Aborted() ? 1 : 0;
 
 	Main_Ticker();
 
@@ -734,30 +732,53 @@ int gui_bit_not(lua_State *L)
 }
 
 
+// Note: the minimap functions are called from the build thread,
+//       hence all drawing is sent to the main thread as messages.
+
+static void minimap_parse_color(const char *color_str, ui_message_t *msg)
+{
+	int r = 255;
+	int g = 255;
+	int b = 255;
+
+	sscanf(color_str, "#%2x%2x%2x", &r, &g, &b);
+
+	msg->r = (u8_t)r;
+	msg->g = (u8_t)g;
+	msg->b = (u8_t)b;
+}
+
+
+// LUA: minimap_begin() --> width, height
+//
+// returns nothing when there is no minimap (e.g. batch mode), so the
+// scripts can skip all the drawing.
+//
 int gui_minimap_begin(lua_State *L)
 {
-	// dummy size when running in batch mode
-	int map_W = 50;
-	int map_H = 50;
+	// the size was taken by the main thread (see Build_Cool_Shit)
+	if (minimap_w <= 0)
+		return 0;
 
-	if (main_win)
-	{
-		map_W = main_win->build_box->mini_map->GetWidth();
-		map_H = main_win->build_box->mini_map->GetHeight();
+	static ui_message_t msg;
 
-		main_win->build_box->mini_map->MapBegin();
-	}
+	msg.kind = UIMSG_MapBegin;
+
+	Main_PostMessage(&msg);
 
-	lua_pushinteger(L, map_W);
-	lua_pushinteger(L, map_H);
+	lua_pushinteger(L, minimap_w);
+	lua_pushinteger(L, minimap_h);
 
 	return 2;
 }
 
 int gui_minimap_finish(lua_State *L)
 {
-	if (main_win)
-		main_win->build_box->mini_map->MapFinish();
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_MapFinish;
+
+	Main_PostMessage(&msg);
 
 	return 0;
 }
@@ -772,40 +793,82 @@ int gui_minimap_draw_line(lua_State *L)
 
 	const char *color_str = luaL_checkstring(L, 5);
 
-	int r = 255;
-	int g = 255;
-	int b = 255;
+	if (minimap_w <= 0)
+		return 0;
 
-	sscanf(color_str, "#%2x%2x%2x", &r, &g, &b);
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_MapLine;
+
+	msg.args[0] = x1;  msg.args[1] = y1;
+	msg.args[2] = x2;  msg.args[3] = y2;
 
-	if (main_win)
+	minimap_parse_color(color_str, &msg);
+
+	Main_PostMessage(&msg);
+
+	return 0;
+}
+
+// LUA: minimap_draw_lines(coords, color)
+//
+// draws many lines in one go, 'coords' is a flat list with four
+// values (x1, y1, x2, y2) for each line.
+//
+int gui_minimap_draw_lines(lua_State *L)
+{
+	if (lua_type(L, 1) != LUA_TTABLE)
+		return luaL_argerror(L, 1, "missing table: coords");
+
+	const char *color_str = luaL_checkstring(L, 2);
+
+	if (minimap_w <= 0)
+		return 0;
+
+	int total = (int)lua_objlen(L, 1) / 4;
+
+	if (total == 0)
+		return 0;
+
+	int *coords = new int[total * 4];
+
+	for (int i = 0 ; i < total * 4 ; i++)
 	{
-		main_win->build_box->mini_map->DrawLine(x1,y1, x2,y2, (u8_t)r, (u8_t)g, (u8_t)b);
+		lua_rawgeti(L, 1, i + 1);
+
+		coords[i] = (int)lua_tointeger(L, -1);
+
+		lua_pop(L, 1);
 	}
 
+	static ui_message_t msg;
+
+	msg.kind    = UIMSG_MapLines;
+	msg.coords  = coords;
+	msg.args[0] = total;
+
+	minimap_parse_color(color_str, &msg);
+
+	Main_PostMessage(&msg);
+
 	return 0;
 }
 
 int gui_minimap_fill_box(lua_State *L)
 {
-	int x1 = luaL_checkint(L, 1);
-	int y1 = luaL_checkint(L, 2);
+	static ui_message_t msg;
 
-	int x2 = luaL_checkint(L, 3);
-	int y2 = luaL_checkint(L, 4);
+	msg.kind = UIMSG_MapBox;
 
-	const char *color_str = luaL_checkstring(L, 5);
+	msg.args[0] = luaL_checkint(L, 1);
+	msg.args[1] = luaL_checkint(L, 2);
 
-	int r = 255;
-	int g = 255;
-	int b = 255;
+	msg.args[2] = luaL_checkint(L, 3);
+	msg.args[3] = luaL_checkint(L, 4);
 
-	sscanf(color_str, "#%2x%2x%2x", &r, &g, &b);
+	minimap_parse_color(luaL_checkstring(L, 5), &msg);
 
-	if (main_win)
-	{
-		main_win->build_box->mini_map->DrawBox(x1,y1, x2,y2, (u8_t)r, (u8_t)g, (u8_t)b);
-	}
+	Main_PostMessage(&msg);
 
 	return 0;
 }
@@ -926,6 +989,7 @@ static const luaL_Reg gui_script_funcs[] =
 	{ "minimap_begin",     gui_minimap_begin },
 	{ "minimap_finish",    gui_minimap_finish },
 	{ "minimap_draw_line", gui_minimap_draw_line },
+	{ "minimap_draw_lines", gui_minimap_draw_lines },
 	{ "minimap_fill_box",  gui_minimap_fill_box },
 
 	// Wolf-3D functions
@@ -1291,6 +1355,15 @@ void Script_Close()
 }
 
 
+int Script_MemoryUsage()
+{
+	if (! LUA_ST)
+		return 0;
+
+	return lua_gc(LUA_ST, LUA_GCCOUNT, 0);
+}
+
+
 //------------------------------------------------------------------------
 // WRAPPERS TO LUA FUNCTIONS
 //------------------------------------------------------------------------
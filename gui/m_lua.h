@@ -26,6 +26,9 @@ typedef struct lua_State lua_State;
 void Script_Open();
 void Script_Close();
 
+// size of the Lua heap (in KB)
+int Script_MemoryUsage();
+
 
 #define MAX_COLOR_MAPS  9  // 1 to 9 (from Lua)
 #define MAX_COLORS_PER_MAP  260
@@ -0,0 +1,490 @@
+//------------------------------------------------------------------------
+//  PIPELINE : Overlapping level planning with the back-end
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+//
+//  A pipelined build runs the back-end of each level (CSG, BSP, vis,
+//  lighting, etc) in a separate thread, while the scripts carry on
+//  planning the next level.
+//
+//  The back-end thread only records the output of each level (see
+//  Cache_DeferOutput), and the thread running the scripts writes it
+//  into the output file later, always in level order.  Hence the file
+//  is the same as for a normal build.  Anything else the scripts
+//  write into the output file must call Pipeline_Sync() first.
+//
+//  There is a single back-end thread, since the slow stages already
+//  spread their work over all the CPU cores, and this way the level
+//  properties are applied in the same order as a normal build.  The
+//  log messages of the back-end are kept with each level and logged
+//  when its output is written.
+//
+//  The cost is memory : up to PIPELINE_DEPTH finished levels are held
+//  (plus the one being planned), and the output of each level is kept
+//  in memory instead of being streamed into the file.
+//
+//------------------------------------------------------------------------
+
+#include "headers.h"
+
+#ifndef WIN32
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#include "lib_thread.h"
+#include "lib_util.h"
+
+#include "main.h"
+#include "m_cache.h"
+#include "m_pipeline.h"
+
+#include "csg_main.h"
+
+
+// number of levels which may be in the pipeline (including the
+// one in the back-end)
+#define PIPELINE_DEPTH  2
+
+
+static bool pipe_wanted;
+
+
+void Pipeline_Init(bool enable)
+{
+	pipe_wanted = enable;
+}
+
+
+#ifndef WIN32
+
+typedef enum
+{
+	PIPE_Queued = 0,
+	PIPE_Running,
+	PIPE_Done
+}
+pipe_state_e;
+
+
+class pipe_level_c
+{
+public:
+	// this is deleted by the back-end
+	csg_level_c *lev;
+
+	const char *cache_key;
+
+	pipe_state_e state;
+
+	// what the back-end produced
+	cache_output_c *output;
+
+	std::string log;
+
+public:
+	pipe_level_c(csg_level_c *_lev, const char *_key) :
+		lev(_lev), cache_key(_key ? StringDup(_key) : NULL),
+		state(PIPE_Queued), output(NULL), log()
+	{ }
+
+	~pipe_level_c()
+	{
+		delete lev;
+
+		StringFree(cache_key);
+
+		if (output)
+			Cache_FreeOutput(output);
+	}
+};
+
+
+static thread_handle_t * pipe_thread;
+
+static thread_local bool in_pipe_worker;
+
+// these are never freed, as the back-end thread may still be
+// using them when the program exits after a fatal error.
+static std::mutex * pipe_mutex;
+static std::condition_variable * pipe_cond;
+
+// the following are protected by the mutex.
+// the levels are in order, the oldest is first.
+static std::vector<pipe_level_c *> pipe_levels;
+
+static bool pipe_quit;
+
+static const char * pipe_error;
+
+// only used by the thread running the scripts
+static bool pipe_writing;
+
+
+bool Pipeline_Active()
+{
+	return (pipe_thread != NULL);
+}
+
+
+bool Pipeline_InWorker()
+{
+	return in_pipe_worker;
+}
+
+
+//------------------------------------------------------------------------
+//  BACK-END THREAD
+//------------------------------------------------------------------------
+
+void Pipeline_WorkerError(const char *msg)
+{
+	SYS_ASSERT(in_pipe_worker);
+
+	{
+		std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+		if (! pipe_error)
+			pipe_error = StringDup(msg);
+	}
+
+	pipe_cond->notify_all();
+
+	// the other thread will show the error and quit
+	for (;;)
+		TimeDelay(100);
+}
+
+
+static void Pipeline_RunLevel(pipe_level_c *PL)
+{
+	LogBeginCapture(&PL->log);
+
+	try
+	{
+		CSG_FinishLevel(PL->lev, PL->cache_key);
+	}
+	catch (assert_fail_c err)
+	{
+		Main_FatalError(_("Sorry, an internal error occurred:\n%s"), err.GetMessage());
+	}
+	catch (...)
+	{
+		Main_FatalError(_("An unknown problem occurred (back-end thread)"));
+	}
+
+	// CSG_FinishLevel has freed it
+	PL->lev = NULL;
+
+	PL->output = Cache_TakeOutput();
+
+	LogEndCapture();
+}
+
+
+static pipe_level_c * Pipeline_NextQueued()
+{
+	for (unsigned int i = 0 ; i < pipe_levels.size() ; i++)
+		if (pipe_levels[i]->state == PIPE_Queued)
+			return pipe_levels[i];
+
+	return NULL;
+}
+
+
+static void Pipeline_Worker(void * /* priv_dat */)
+{
+	in_pipe_worker = true;
+
+	// the output is written by the thread running the scripts
+	Cache_DeferOutput(true);
+
+	for (;;)
+	{
+		pipe_level_c *PL;
+
+		{
+			std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+			while (! (PL = Pipeline_NextQueued()) && ! pipe_quit)
+				pipe_cond->wait(lock);
+
+			if (! PL)
+				return;
+
+			PL->state = PIPE_Running;
+		}
+
+		Pipeline_RunLevel(PL);
+
+		{
+			std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+			PL->state = PIPE_Done;
+		}
+
+		pipe_cond->notify_all();
+	}
+}
+
+
+//------------------------------------------------------------------------
+//  SCRIPT THREAD
+//------------------------------------------------------------------------
+
+void Pipeline_Begin()
+{
+	if (! pipe_wanted)
+		return;
+
+	if (! pipe_mutex)
+	{
+		pipe_mutex = new std::mutex;
+		pipe_cond  = new std::condition_variable;
+	}
+
+	pipe_quit = false;
+
+	pipe_thread = Thread_Start(Pipeline_Worker);
+
+	if (pipe_thread)
+		LogPrintf("Pipelined build (back-end runs in its own thread)\n");
+}
+
+
+static void Pipeline_CheckError()
+{
+	// shows an error from the back-end thread, if any
+
+	std::string log;
+
+	const char *msg;
+
+	{
+		std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+		msg = pipe_error;
+
+		for (unsigned int i = 0 ; msg && i < pipe_levels.size() ; i++)
+			if (pipe_levels[i]->state == PIPE_Running)
+				log = pipe_levels[i]->log;
+	}
+
+	if (! msg)
+		return;
+
+	// the log of the failed level is handy for debugging
+	LogPrintf("%s", log.c_str());
+
+	Main_FatalError("%s", msg);
+}
+
+
+static void Pipeline_WriteLevels(bool wait)
+{
+	// writes the output of the finished levels, in order.  When 'wait'
+	// is true, waits for all the queued levels to be finished.
+
+	// the game's write function syncs, don't recurse
+	if (pipe_writing)
+		return;
+
+	for (;;)
+	{
+		Pipeline_CheckError();
+
+		pipe_level_c *PL;
+
+		{
+			std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+			if (pipe_levels.empty())
+				return;
+
+			PL = pipe_levels.front();
+
+			if (PL->state != PIPE_Done)
+			{
+				if (! wait)
+					return;
+
+				if (! pipe_error)
+					pipe_cond->wait(lock);
+
+				continue;
+			}
+
+			pipe_levels.erase(pipe_levels.begin());
+		}
+
+		pipe_writing = true;
+
+		LogPrintf("%s", PL->log.c_str());
+
+		Cache_WriteOutput(PL->output);
+		PL->output = NULL;
+
+		pipe_writing = false;
+
+		delete PL;
+	}
+}
+
+
+void Pipeline_QueueLevel(csg_level_c *lev, const char *cache_key)
+{
+	SYS_ASSERT(pipe_thread);
+
+	pipe_level_c *PL = new pipe_level_c(lev, cache_key);
+
+	for (;;)
+	{
+		// this makes room when the oldest levels are finished
+		Pipeline_WriteLevels(false);
+
+		std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+		if ((int)pipe_levels.size() < PIPELINE_DEPTH)
+		{
+			pipe_levels.push_back(PL);
+
+			pipe_cond->notify_all();
+			return;
+		}
+
+		if (! pipe_error)
+			pipe_cond->wait(lock);
+	}
+}
+
+
+void Pipeline_Sync()
+{
+	if (! pipe_thread || in_pipe_worker)
+		return;
+
+	Pipeline_WriteLevels(true);
+}
+
+
+static void Pipeline_DropLevels()
+{
+	// drops the levels which have not begun, and waits for the one
+	// in the back-end to finish (it stops early when aborted).
+
+	for (;;)
+	{
+		Pipeline_CheckError();
+
+		std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+		bool busy = false;
+
+		for (unsigned int i = 0 ; i < pipe_levels.size() ; )
+		{
+			pipe_level_c *PL = pipe_levels[i];
+
+			if (PL->state == PIPE_Queued)
+			{
+				delete PL;
+				pipe_levels.erase(pipe_levels.begin() + i);
+				continue;
+			}
+
+			if (PL->state == PIPE_Running)
+				busy = true;
+
+			i++;
+		}
+
+		if (! busy)
+		{
+			for (unsigned int k = 0 ; k < pipe_levels.size() ; k++)
+				delete pipe_levels[k];
+
+			pipe_levels.clear();
+			return;
+		}
+
+		if (! pipe_error)
+			pipe_cond->wait(lock);
+	}
+}
+
+
+void Pipeline_Finish(bool build_ok)
+{
+	if (! pipe_thread)
+		return;
+
+	if (build_ok)
+		Pipeline_WriteLevels(true);
+	else
+		Pipeline_DropLevels();
+
+	{
+		std::unique_lock<std::mutex> lock(*pipe_mutex);
+
+		pipe_quit = true;
+	}
+
+	pipe_cond->notify_all();
+
+	Thread_Join(pipe_thread);
+
+	pipe_thread = NULL;
+}
+
+
+#else  // WIN32
+
+// the WIN32 build lacks std::thread, hence builds are never pipelined
+
+void Pipeline_Begin()
+{ }
+
+void Pipeline_Finish(bool build_ok)
+{ }
+
+bool Pipeline_Active()
+{
+	return false;
+}
+
+void Pipeline_QueueLevel(csg_level_c *lev, const char *cache_key)
+{
+	CSG_FinishLevel(lev, cache_key);
+}
+
+void Pipeline_Sync()
+{ }
+
+bool Pipeline_InWorker()
+{
+	return false;
+}
+
+void Pipeline_WorkerError(const char *msg)
+{
+	Main_FatalError("%s", msg);
+}
+
+#endif  // WIN32
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
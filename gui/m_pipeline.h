@@ -0,0 +1,62 @@
+//------------------------------------------------------------------------
+//  PIPELINE : Overlapping level planning with the back-end
+//------------------------------------------------------------------------
+//
+//  Oblige Level Maker
+//
+//  Copyright (C) 2006-2017 Andrew Apted
+//
+//  This program is free software; you can redistribute it and/or
+//  modify it under the terms of the GNU General Public License
+//  as published by the Free Software Foundation; either version 2
+//  of the License, or (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//------------------------------------------------------------------------
+
+#ifndef __OBLIGE_PIPELINE_H__
+#define __OBLIGE_PIPELINE_H__
+
+class csg_level_c;
+
+// enables pipelined builds (off by default)
+void Pipeline_Init(bool enable);
+
+// these are called around each build.  Pipeline_Finish() writes the
+// remaining levels when 'build_ok' is true, otherwise drops them.
+void Pipeline_Begin();
+void Pipeline_Finish(bool build_ok);
+
+// true while a pipelined build is running
+bool Pipeline_Active();
+
+// passes a finished level to the back-end thread, which takes
+// ownership of it.  The cache key may be NULL.  This will wait
+// when too many levels are already in the pipeline.
+void Pipeline_QueueLevel(csg_level_c *lev, const char *cache_key);
+
+// waits for every queued level and writes their output, in order.
+// This must be called before anything else is written into the
+// output file.  Does nothing when the build is not pipelined.
+void Pipeline_Sync();
+
+
+/* for the back-end thread */
+
+bool Pipeline_InWorker();
+
+// used by Main_FatalError() in the back-end thread, the error is
+// shown by the thread running the scripts.  Never returns.
+#ifdef __GNUC__
+__attribute__((noreturn))
+#endif
+void Pipeline_WorkerError(const char *msg);
+
+#endif /* __OBLIGE_PIPELINE_H__ */
+
+//--- editor settings ---
+// vi:ts=4:sw=4:noexpandtab
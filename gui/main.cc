@@ -28,20 +28,31 @@
 #include "lib_argv.h"
 #include "lib_file.h"
 #include "lib_signal.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 
 #include "main.h"
 #include "m_addons.h"
+#include "m_batch.h"
+#include "m_cache.h"
 #include "m_cookie.h"
 #include "m_lua.h"
+#include "m_pipeline.h"
 #include "m_trans.h"
 
 #include "csg_main.h"
 #include "g_nukem.h"
 
+#ifndef WIN32
+#include <atomic>
+#endif
+
 
 #define TICKER_TIME  50 /* ms */
 
+// size of the queue for the build thread (must be a power of two)
+#define UI_QUEUE_SIZE  256
+
 
 const char *home_dir    = NULL;
 const char *install_dir = NULL;
@@ -53,12 +64,16 @@ const char *logging_file = NULL;
 int screen_w;
 int screen_h;
 
+int minimap_w;
+int minimap_h;
+
 int main_action;
 
 double next_rand_seed;
 
 bool batch_mode = false;
 const char *batch_output_file = NULL;
+const char *batch_status_prefix = NULL;
 
 // options
 int  window_size = 0;  /* AUTO */
@@ -69,6 +84,9 @@ bool create_backups = true;
 bool overwrite_warning = true;
 bool debug_messages = false;
 
+// memory limit in KB (zero for none)
+u32_t mem_limit_kb = 0;
+
 
 game_interface_c * game_object = NULL;
 
@@ -95,10 +113,19 @@ static void ShowInfo()
 		"     --log      <file>     Log file to create\n"
 		"\n"
 		"  -b --batch    <output>   Batch mode (no GUI)\n"
+		"     --server   [socket]   Build server, jobs from stdin or socket\n"
+		"\n"
+		"     --batch-count   <num>     Batch mode, build <num> seeds\n"
+		"     --batch-pattern <file>    Output names, e.g. out_%%04d.wad\n"
+		"     --jobs          <num>     Number of builds at the same time\n"
 		"  -a --addon    <file>...  Addon(s) to use\n"
 		"  -l --load     <file>     Load settings from a file\n"
 		"  -k --keep                Keep SEED from loaded settings\n"
 		"\n"
+		"     --mem-limit <MB>      Fail the build if memory use exceeds this\n"
+		"     --cache    <dir>      Reuse unchanged levels from this directory\n"
+		"     --pipeline            Plan the next level during the back-end\n"
+		"\n"
 		"  -d --debug               Enable debugging\n"
 		"  -v --verbose             Print log messages to stdout\n"
 		"  -h --help                Show this help message\n"
@@ -422,25 +449,221 @@ void Main_SetupFLTK()
 }
 
 
+static u32_t step_peak_kb;
+
+
+static void Main_CheckMemory()
+{
+	u32_t cur_kb, peak_kb;
+
+	MemoryGetUsage(&cur_kb, &peak_kb);
+
+	if (step_peak_kb < cur_kb)
+		step_peak_kb = cur_kb;
+
+	// fail cleanly instead of being killed by the OS
+	if (mem_limit_kb > 0 && cur_kb > mem_limit_kb)
+	{
+		Main_FatalError("Memory limit exceeded (using %u MB, limit is %u MB)\n",
+						cur_kb / 1024, mem_limit_kb / 1024);
+	}
+}
+
+
+/* ----- build thread ----------------------------- */
+
+// this is only non-NULL while the build thread is running
+static thread_handle_t * build_thread;
+
+// only set in the build thread itself
+static thread_local bool in_build_thread;
+
+static thread_queue_c * ui_queue;
+
+static bool build_result;
+static bool build_done;
+
+// copy of the cancel state, which the build thread can check
+#ifdef WIN32
+static volatile bool build_aborted;
+#else
+static std::atomic<bool> build_aborted(false);
+#endif
+
+
+bool Main_InBuildThread()
+{
+	return in_build_thread;
+}
+
+
+bool Main_Aborted()
+{
+	return build_aborted;
+}
+
+
+static void Main_SyncAborted()
+{
+	build_aborted = (main_action >= MAIN_CANCEL);
+}
+
+
 void Main_Ticker()
 {
 	// This function is called very frequently.
-	// To prevent a slow-down, we only call Fl::check()
-	// after a certain time has elapsed.
+	// To prevent a slow-down, we only do stuff after
+	// a certain time has elapsed.
+
+	// (the main thread and build thread each need their own)
+	static thread_local u32_t last_millis = 0;
 
-	static u32_t last_millis = 0;
+	// the back-end thread of a pipelined build leaves it to the
+	// thread running the scripts
+	if (Pipeline_InWorker())
+		return;
 
 	u32_t cur_millis = TimeGetMillies();
 
 	if ((cur_millis - last_millis) >= TICKER_TIME)
 	{
-		Fl::check();
+		if (Main_InBuildThread())
+		{
+			// the main thread is handling the events
+			Main_CheckMemory();
+		}
+		else if (! build_thread)
+		{
+			Main_CheckMemory();
+
+			Fl::check();
+
+			Main_SyncAborted();
+		}
 
 		last_millis = cur_millis;
 	}
 }
 
 
+/* ----- build step timing ----------------------------- */
+
+static std::map<std::string, u32_t> step_times;
+
+static std::string cur_step;
+static u32_t cur_step_start;
+
+
+static void Main_BeginStep(const char *step_name)
+{
+	// this accumulates the time spent in the previous step.
+	// A NULL step_name merely finishes the previous step.
+
+	u32_t cur_millis = TimeGetMillies();
+
+	if (! cur_step.empty())
+	{
+		step_times[cur_step] += (cur_millis - cur_step_start);
+
+		Main_CheckMemory();
+
+		u32_t cur_kb, peak_kb;
+
+		MemoryGetUsage(&cur_kb, &peak_kb);
+
+		LogPrintf("  mem: step %s : current %u KB, step peak %u KB, lua %d KB\n",
+				  cur_step.c_str(), cur_kb, step_peak_kb, Script_MemoryUsage());
+	}
+
+	cur_step = step_name ? step_name : "";
+	cur_step_start = cur_millis;
+
+	step_peak_kb = 0;
+}
+
+
+static void Main_ShowStepTimes()
+{
+	Main_BeginStep(NULL);
+
+	LogPrintf("\nStep times:\n");
+
+	std::map<std::string, u32_t>::iterator IT;
+
+	for (IT = step_times.begin() ; IT != step_times.end() ; IT++)
+	{
+		LogPrintf("  step %-8s : %8.3f sec\n", IT->first.c_str(), IT->second / 1000.0);
+	}
+
+	step_times.clear();
+
+	MemTag_Report();
+
+	u32_t cur_kb, peak_kb;
+
+	MemoryGetUsage(&cur_kb, &peak_kb);
+
+	LogPrintf("  mem %-9s : %8d KB\n", "lua_heap", Script_MemoryUsage());
+	LogPrintf("  mem %-9s : %8u KB\n", "peak_rss", peak_kb);
+}
+
+
+void Main_ProgStep(const char *step_name)
+{
+	// the back-end of a pipelined build overlaps the planning of the
+	// next level, so it is not timed (or shown) step by step.
+	if (Pipeline_InWorker())
+		return;
+
+	Main_BeginStep(step_name);
+
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_ProgStep;
+	StringMaxCopy(msg.text, step_name, MSG_BUF_LEN);
+
+	Main_PostMessage(&msg);
+}
+
+
+void Main_ProgAtLevel(int index, int total)
+{
+	Main_BeginStep("Plan");
+
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_ProgAtLevel;
+	msg.args[0] = index;
+	msg.args[1] = total;
+
+	Main_PostMessage(&msg);
+}
+
+
+void Main_ProgInit(int node_perc, const char *extra_steps)
+{
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_ProgInit;
+	msg.args[0] = node_perc;
+	StringMaxCopy(msg.text, extra_steps, MSG_BUF_LEN);
+
+	Main_PostMessage(&msg);
+}
+
+
+void Main_ProgNodes(int pos, int limit)
+{
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_ProgNodes;
+	msg.args[0] = pos;
+	msg.args[1] = limit;
+
+	Main_PostMessage(&msg);
+}
+
+
 void Main_Shutdown(bool error)
 {
 	if (main_win)
@@ -462,7 +685,7 @@ void Main_Shutdown(bool error)
 
 void Main_FatalError(const char *msg, ...)
 {
-	static char buffer[MSG_BUF_LEN];
+	static thread_local char buffer[MSG_BUF_LEN];
 
 	va_list arg_pt;
 
@@ -472,6 +695,27 @@ void Main_FatalError(const char *msg, ...)
 
 	buffer[MSG_BUF_LEN-2] = 0;
 
+	// the thread which called Thread_ParallelFor() handles it
+	if (Thread_InParallel())
+		Thread_ParallelError(buffer);
+
+	if (Pipeline_InWorker())
+		Pipeline_WorkerError(buffer);
+
+	// let the main thread show the error and quit
+	if (Main_InBuildThread())
+	{
+		static ui_message_t fatal_msg;
+
+		fatal_msg.kind = UIMSG_FatalError;
+		StringMaxCopy(fatal_msg.text, buffer, MSG_BUF_LEN);
+
+		Main_PostMessage(&fatal_msg);
+
+		for (;;)
+			TimeDelay(100);
+	}
+
 	DLG_ShowError("%s", buffer);
 
 	Main_Shutdown(true);
@@ -495,14 +739,12 @@ void Main_ProgStatus(const char *msg, ...)
 
 	buffer[MSG_BUF_LEN-2] = 0;
 
-	if (main_win)
-	{
-		main_win->build_box->SetStatus(buffer);
-	}
-	else if (batch_mode)
-	{
-		fprintf(stderr, "%s\n", buffer);
-	}
+	static ui_message_t status_msg;
+
+	status_msg.kind = UIMSG_Status;
+	StringMaxCopy(status_msg.text, buffer, MSG_BUF_LEN);
+
+	Main_PostMessage(&status_msg);
 }
 
 
@@ -573,12 +815,218 @@ static void Module_Defaults()
 
 //------------------------------------------------------------------------
 
+static void Main_HandleMessage(ui_message_t *msg)
+{
+	UI_Build *build_box = main_win ? main_win->build_box : NULL;
+
+	switch (msg->kind)
+	{
+		case UIMSG_Status:
+			if (build_box)
+				build_box->SetStatus(msg->text);
+			else if (batch_mode)
+			{
+				const char *prefix = batch_status_prefix ? batch_status_prefix : "";
+
+				fprintf(stderr, "%s%s\n", prefix, msg->text);
+			}
+			break;
+
+		case UIMSG_Error:
+			DLG_ShowError("%s", msg->text);
+			break;
+
+		case UIMSG_FatalError:
+			Main_FatalError("%s", msg->text);
+			break;
+
+		case UIMSG_ProgInit:
+			if (build_box)
+				build_box->Prog_Init(msg->args[0], msg->text);
+			break;
+
+		case UIMSG_ProgAtLevel:
+			if (build_box)
+				build_box->Prog_AtLevel(msg->args[0], msg->args[1]);
+			break;
+
+		case UIMSG_ProgStep:
+			if (build_box)
+				build_box->Prog_Step(msg->text);
+			break;
+
+		case UIMSG_ProgNodes:
+			if (build_box)
+				build_box->Prog_Nodes(msg->args[0], msg->args[1]);
+			break;
+
+		case UIMSG_MapBegin:
+			if (build_box)
+				build_box->mini_map->MapBegin();
+			break;
+
+		case UIMSG_MapLine:
+			if (build_box)
+				build_box->mini_map->DrawLines(msg->args, 1, msg->r, msg->g, msg->b);
+			break;
+
+		case UIMSG_MapLines:
+			if (build_box)
+				build_box->mini_map->DrawLines(msg->coords, msg->args[0], msg->r, msg->g, msg->b);
+
+			delete[] msg->coords;
+			break;
+
+		case UIMSG_MapBox:
+			if (build_box)
+				build_box->mini_map->DrawBox(msg->args[0], msg->args[1],
+											 msg->args[2], msg->args[3],
+											 msg->r, msg->g, msg->b);
+			break;
+
+		case UIMSG_MapFinish:
+			if (build_box)
+				build_box->mini_map->MapFinish();
+			break;
+
+		case UIMSG_BuildDone:
+			build_done = true;
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+void Main_PostMessage(ui_message_t *msg)
+{
+	// only one thread may push messages into the queue
+	if (Pipeline_InWorker())
+		return;
+
+	if (! Main_InBuildThread())
+	{
+		Main_HandleMessage(msg);
+		return;
+	}
+
+	while (! ui_queue->Push(msg))
+	{
+		// progress updates are not important enough to wait for
+		if (msg->kind == UIMSG_ProgNodes)
+			return;
+
+		TimeDelay(2);
+	}
+}
+
+
+static void Main_DrainMessages()
+{
+	static ui_message_t msg;
+
+	while (ui_queue->Pop(&msg))
+	{
+		Main_HandleMessage(&msg);
+	}
+}
+
+
+static void Main_DoBuild()
+{
+	// this runs the scripts and finishes the output file.
+
+	try
+	{
+		Pipeline_Begin();
+
+		bool was_ok = ob_build_cool_shit();
+
+		// write (or drop) the levels still in the pipeline
+		Pipeline_Finish(was_ok);
+
+		Main_BeginStep("Finish");
+
+		build_result = game_object->Finish(was_ok);
+	}
+	catch (assert_fail_c err)
+	{
+		Main_FatalError(_("Sorry, an internal error occurred:\n%s"), err.GetMessage());
+	}
+	catch (...)
+	{
+		Main_FatalError(_("An unknown problem occurred (build thread)"));
+	}
+}
+
+
+static void Main_BuildThread(void * /* priv_dat */)
+{
+	// all the user interface stuff happens in the main thread
+	in_build_thread = true;
+
+	Main_DoBuild();
+
+	static ui_message_t msg;
+
+	msg.kind = UIMSG_BuildDone;
+
+	Main_PostMessage(&msg);
+}
+
+
+static bool Main_RunBuild()
+{
+	// without a window there is no need for a separate thread
+	if (main_win)
+	{
+		if (! ui_queue)
+			ui_queue = new thread_queue_c(sizeof(ui_message_t), UI_QUEUE_SIZE);
+
+		build_done = false;
+
+		build_thread = Thread_Start(Main_BuildThread);
+	}
+
+	if (! build_thread)
+	{
+		Main_DoBuild();
+		return build_result;
+	}
+
+	// keep the user interface running until the build is done
+	while (! build_done)
+	{
+		Fl::wait(TICKER_TIME / 1000.0);
+
+		Main_DrainMessages();
+		Main_SyncAborted();
+	}
+
+	Thread_Join(build_thread);
+
+	build_thread = NULL;
+
+	return build_result;
+}
+
+
 
 bool Build_Cool_Shit()
 {
+	minimap_w = minimap_h = 0;
+
 	// clear the map
 	if (main_win)
-		main_win->build_box->mini_map->EmptyMap();
+	{
+		UI_MiniMap *mini_map = main_win->build_box->mini_map;
+
+		mini_map->EmptyMap();
+
+		minimap_w = mini_map->w();
+		minimap_h = mini_map->h();
+	}
 
 	const char *format = ob_game_format();
 
@@ -619,8 +1067,17 @@ bool Build_Cool_Shit()
 		main_win->build_box->DisplaySeed(next_rand_seed);
 	}
 
+	Main_SyncAborted();
+
 	u32_t start_time = TimeGetMillies();
 
+	step_times.clear();
+	cur_step.clear();
+
+	MemTag_ResetPeaks();
+
+	Main_BeginStep("Init");
+
 	const char *def_filename = ob_default_filename();
 
 	// this will ask for output filename (among other things)
@@ -633,15 +1090,15 @@ bool Build_Cool_Shit()
 	if (was_ok)
 	{
 		// run the scripts Scotty!
-		was_ok = ob_build_cool_shit();
-
-		was_ok = game_object->Finish(was_ok);
+		was_ok = Main_RunBuild();
 	}
 
 	if (was_ok)
 	{
 		Main_ProgStatus(_("Success"));
 
+		Main_ShowStepTimes();
+
 		u32_t end_time = TimeGetMillies();
 		u32_t total_time = end_time - start_time;
 
@@ -708,6 +1165,93 @@ int main(int argc, char **argv)
 		batch_output_file = arg_list[batch_arg+1];
 	}
 
+	const char *server_socket = NULL;
+
+	int server_arg = ArgvFind(0, "server");
+	if (server_arg >= 0)
+	{
+		if (batch_mode)
+		{
+			fprintf(stderr, "OBLIGE ERROR: cannot use --batch with --server\n");
+			exit(9);
+		}
+
+		// the socket path is optional (default is stdin)
+		if (server_arg+1 < arg_count && ! ArgvIsOption(server_arg+1) &&
+			! strchr(arg_list[server_arg+1], '='))
+		{
+			server_socket = arg_list[server_arg+1];
+		}
+
+		batch_mode = true;
+	}
+
+	int mem_arg = ArgvFind(0, "mem-limit");
+	if (mem_arg >= 0)
+	{
+		if (mem_arg+1 >= arg_count || ArgvIsOption(mem_arg+1) ||
+			atoi(arg_list[mem_arg+1]) <= 0)
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing or bad size for --mem-limit\n");
+			exit(9);
+		}
+
+		mem_limit_kb = (u32_t) atoi(arg_list[mem_arg+1]) * 1024;
+	}
+
+	const char *cache_dir = NULL;
+
+	int cache_arg = ArgvFind(0, "cache");
+	if (cache_arg >= 0)
+	{
+		if (cache_arg+1 >= arg_count || ArgvIsOption(cache_arg+1))
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing directory for --cache\n");
+			exit(9);
+		}
+
+		cache_dir = arg_list[cache_arg+1];
+	}
+
+	int batch_count = 0;
+	int batch_jobs  = 1;
+
+	const char *batch_pattern = NULL;
+
+	int count_arg = ArgvFind(0, "batch-count");
+	if (count_arg >= 0)
+	{
+		if (count_arg+1 >= arg_count || ArgvIsOption(count_arg+1) ||
+			atoi(arg_list[count_arg+1]) <= 0)
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing or bad number for --batch-count\n");
+			exit(9);
+		}
+
+		int pat_arg = ArgvFind(0, "batch-pattern");
+
+		if (pat_arg < 0 || pat_arg+1 >= arg_count || ArgvIsOption(pat_arg+1))
+		{
+			fprintf(stderr, "OBLIGE ERROR: missing filename for --batch-pattern\n");
+			exit(9);
+		}
+
+		if (batch_mode)
+		{
+			fprintf(stderr, "OBLIGE ERROR: --batch-count cannot be used with --batch or --server\n");
+			exit(9);
+		}
+
+		batch_mode  = true;
+		batch_count = atoi(arg_list[count_arg+1]);
+		batch_pattern = arg_list[pat_arg+1];
+
+		int jobs_arg = ArgvFind(0, "jobs");
+
+		if (jobs_arg >= 0 && jobs_arg+1 < arg_count && ! ArgvIsOption(jobs_arg+1))
+			batch_jobs = MAX(1, atoi(arg_list[jobs_arg+1]));
+	}
+
 
 	Determine_WorkingPath(argv[0]);
 	Determine_InstallDir(argv[0]);
@@ -743,6 +1287,12 @@ int main(int argc, char **argv)
 
 	LogEnableDebug(debug_messages);
 
+	if (cache_dir)
+		Cache_Init(cache_dir);
+
+	if (ArgvFind(0, "pipeline") >= 0)
+		Pipeline_Init(true);
+
 	Trans_Init();
 
 	if (! batch_mode)
@@ -798,6 +1348,22 @@ int main(int argc, char **argv)
 
 		Cookie_ParseArguments();
 
+		if (server_arg >= 0)
+		{
+			int result = Batch_Server(server_socket);
+
+			Main_Shutdown(false);
+			return result;
+		}
+
+		if (batch_count > 0)
+		{
+			int result = Batch_MultiSeed(batch_count, batch_pattern, batch_jobs);
+
+			Main_Shutdown(false);
+			return result;
+		}
+
 		Main_SetSeed();
 
 		if (! Build_Cool_Shit())
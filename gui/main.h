@@ -42,8 +42,16 @@ extern bool batch_mode;
 
 extern const char *batch_output_file;
 
+// prefix for the status messages of a batch job (NULL for none)
+extern const char *batch_status_prefix;
+
 extern double next_rand_seed;
 
+// size of the minimap, taken before each build (zero when none).
+// The build thread must not ask the widget itself.
+extern int minimap_w;
+extern int minimap_h;
+
 
 // this records the user action, e.g. Cancel or Quit buttons
 typedef enum
@@ -79,6 +87,68 @@ void Main_ProgStatus(const char *msg, ...);
 bool Main_BackupFile(const char *filename, const char *ext);
 void Main_Ticker();
 
+// true once the user has cancelled the build (or wants to quit).
+// This is cheap, and safe to call from the build thread.
+bool Main_Aborted();
+
+// these update the progress bar (when there is one) and also keep
+// track of how long each step takes.
+void Main_ProgStep(const char *step_name);
+void Main_ProgAtLevel(int index, int total);
+
+void Main_ProgInit(int node_perc, const char *extra_steps);
+void Main_ProgNodes(int pos, int limit);
+
+
+// Messages for the user interface.  While a build is running, the
+// build thread must not touch any widgets, so they are queued and
+// handled by the main thread.  Otherwise they are handled at once.
+typedef enum
+{
+	UIMSG_Status = 0,
+	UIMSG_Error,
+	UIMSG_FatalError,
+
+	UIMSG_ProgInit,
+	UIMSG_ProgAtLevel,
+	UIMSG_ProgStep,
+	UIMSG_ProgNodes,
+
+	UIMSG_MapBegin,
+	UIMSG_MapLine,   // the coordinates are in 'args'
+	UIMSG_MapLines,
+	UIMSG_MapBox,
+	UIMSG_MapFinish,
+
+	UIMSG_BuildDone
+}
+ui_message_kind_e;
+
+typedef struct
+{
+	int kind;
+
+	int args[4];
+
+	byte r, g, b;
+
+	// list of lines for UIMSG_MapLines, freed after use
+	int *coords;
+
+	char text[MSG_BUF_LEN];
+}
+ui_message_t;
+
+void Main_PostMessage(ui_message_t *msg);
+
+// true if called from the build thread
+bool Main_InBuildThread();
+
+void Main_CalcNewSeed();
+void Main_SetSeed();
+
+bool Build_Cool_Shit();
+
 
 // Dialog Windows
 void DLG_ShowError(const char *msg, ...);
@@ -94,6 +164,8 @@ void DLG_ViewLogs(void);
 void DLG_ManageConfig(void);
 
 
+class csg_level_c;
+
 class game_interface_c
 {
 	/* this is an abstract base class */
@@ -132,17 +204,26 @@ public:
 	// being built.  It is called after the CSG2 code sets itself
 	// up and hence could alter some CSG2 parameters, other than
 	// that there is lttle need to do anything here.
-	virtual void BeginLevel() = 0;
+	virtual void BeginLevel(csg_level_c *lev) = 0;
 
 	// called when all the brushes and entities have been added
 	// but before the CSG2 performs a cleanup.  Typically the
 	// game-specific code will call CSG_BSP() and convert
 	// the result to the game-specific level format.
-	virtual void EndLevel() = 0;
-
-	// sets a certain property, especially "level_name" which is
-	// required by most games (like DOOM and QUAKE).  Unknown
-	// properties are ignored.  May be called during startup too.
+	//
+	// the level is the current one (cur_level) of the calling
+	// thread, and its name is in lev->name.  Apart from writing
+	// the output file, the work done here only uses per-thread
+	// state, so it may be called from any thread.  For pipelined
+	// builds the output must only be recorded, which the game code
+	// checks with Cache_OutputDeferred().
+	virtual void EndLevel(csg_level_c *lev) = 0;
+
+	// sets a certain property.  Unknown properties are ignored.
+	// May be called during startup too.  Properties set while a
+	// level is being made are passed just before its EndLevel().
+	// Note that "level_name" and "description" are stored in the
+	// current level instead of being passed here.
 	virtual void Property(const char *key, const char *value) = 0;
 };
 
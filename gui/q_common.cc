@@ -30,6 +30,7 @@
 #include "lib_zip.h"
 
 #include "main.h"
+#include "m_cache.h"
 #include "m_lua.h"
 
 #include "q_common.h"
@@ -80,6 +81,16 @@ void qLump_c::Append(const void *data, u32_t len)
 }
 
 
+u8_t * qLump_c::AppendBlank(u32_t len)
+{
+	u32_t old_size = buffer.size();
+
+	buffer.resize(old_size + len, 0);
+
+	return & buffer[old_size];
+}
+
+
 void qLump_c::Append(qLump_c *other)
 {
 	if (other->buffer.size() > 0)
@@ -107,6 +118,21 @@ void qLump_c::Prepend(const void *data, u32_t len)
 }
 
 
+void qLump_c::Overwrite(u32_t pos, const void *data, u32_t len)
+{
+	SYS_ASSERT(pos + len <= buffer.size());
+
+	if (len > 0)
+		memcpy(& buffer[pos], data, len);
+}
+
+
+void qLump_c::Free()
+{
+	std::vector<u8_t>().swap(buffer);
+}
+
+
 void qLump_c::AddByte(byte value)
 {
 	Append(&value, 1);
@@ -140,7 +166,7 @@ void qLump_c::RawPrintf(const char *str)
 
 void qLump_c::Printf(const char *str, ...)
 {
-	static char msg_buf[MSG_BUF_LEN];
+	static thread_local char msg_buf[MSG_BUF_LEN];
 
 	va_list args;
 
@@ -156,7 +182,7 @@ void qLump_c::Printf(const char *str, ...)
 
 void qLump_c::KeyPair(const char *key, const char *val, ...)
 {
-	static char v_buffer[MSG_BUF_LEN];
+	static thread_local char v_buffer[MSG_BUF_LEN];
 
 	va_list args;
 
@@ -193,28 +219,160 @@ const char *qLump_c::GetName() const
 
 //------------------------------------------------------------------------
 
-#define PLANE_HASH_SIZE  128
+//
+// An open-addressing hash table for finding duplicate records.
+// The table only stores indices into the vector of records, and
+// two records are the same when their raw (on-disk) bytes match.
+//
+template <typename T>
+class qDedupeTable_c
+{
+private:
+	const std::vector<T> *records;
+
+	// index into records, or -1 for an empty slot
+	std::vector<s32_t> slots;
+
+	int used;
+
+public:
+	qDedupeTable_c() : records(NULL), slots(), used(0)
+	{ }
 
-static std::vector<dplane_t> bsp_planes;
+	~qDedupeTable_c()
+	{ }
 
-static std::vector<int> * plane_hashtab[PLANE_HASH_SIZE];
+	void Clear()
+	{
+		slots.clear();
+		used = 0;
+	}
+
+	// 'estimate' is the expected number of records, the table is
+	// sized to keep the load factor below one half.
+	void Reset(const std::vector<T> *_records, int estimate)
+	{
+		records = _records;
+		used = 0;
+
+		int size = 256;
+
+		while (size < estimate * 2)
+			size <<= 1;
+
+		slots.assign(size, -1);
+	}
+
+	// returns the index of a matching record, or -1 when there is
+	// none (and then 'slot_var' is where the new one should go).
+	int Find(const T *rec, u32_t *slot_var) const
+	{
+		SYS_ASSERT(! slots.empty());
+
+		u32_t mask = (u32_t)slots.size() - 1;
+		u32_t slot = Hash(rec) & mask;
+
+		for (;;)
+		{
+			int index = slots[slot];
+
+			if (index < 0)
+			{
+				*slot_var = slot;
+				return -1;
+			}
+
+			if (memcmp(rec, &(*records)[index], sizeof(T)) == 0)
+				return index;
+
+			slot = (slot + 1) & mask;
+		}
+	}
+
+	void Insert(u32_t slot, int index)
+	{
+		slots[slot] = index;
+		used++;
+
+		if (used * 2 > (int)slots.size())
+			Grow();
+	}
+
+private:
+	static u32_t Hash(const T *rec)
+	{
+		// FNV-1a over the raw bytes
+		const byte *p = (const byte *)rec;
+
+		u32_t hash = 2166136261u;
+
+		for (unsigned int i = 0 ; i < sizeof(T) ; i++)
+		{
+			hash ^= p[i];
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	void Grow()
+	{
+		std::vector<s32_t> old_slots;
+
+		old_slots.swap(slots);
+
+		slots.assign(old_slots.size() * 2, -1);
+
+		u32_t mask = (u32_t)slots.size() - 1;
+
+		for (unsigned int k = 0 ; k < old_slots.size() ; k++)
+		{
+			int index = old_slots[k];
+
+			if (index < 0)
+				continue;
+
+			u32_t slot = Hash(&(*records)[index]) & mask;
+
+			while (slots[slot] >= 0)
+				slot = (slot + 1) & mask;
+
+			slots[slot] = index;
+		}
+	}
+};
+
+
+// a rough guess of how many planes etc a level will need,
+// saving the tables from growing too often.
+static int BSP_EstimateCount(int per_brush)
+{
+	return MAX(1024, (int)cur_level->brushes.size() * per_brush);
+}
+
+
+//------------------------------------------------------------------------
+
+static thread_local std::vector<dplane_t> bsp_planes;
+
+static thread_local qDedupeTable_c<dplane_t> plane_table;
 
 
 static void BSP_ClearPlanes()
 {
 	bsp_planes.clear();
 
-	for (int h = 0 ; h < PLANE_HASH_SIZE ; h++)
-	{
-		delete plane_hashtab[h];
-		plane_hashtab[h] = NULL;
-	}
+	plane_table.Clear();
 }
 
 
 static void BSP_PreparePlanes()
 {
 	BSP_ClearPlanes();
+
+	bsp_planes.reserve(BSP_EstimateCount(4));
+
+	plane_table.Reset(&bsp_planes, BSP_EstimateCount(4));
 }
 
 
@@ -234,11 +392,6 @@ static u16_t AddRawPlane(const dplane_t *plane, bool *was_new)
 	if (raw_plane.dist == -0.0f) raw_plane.dist = +0.0f;
 
 
-	int hash = I_ROUND(raw_plane.dist * 1.1);
-
-	hash = hash & (PLANE_HASH_SIZE-1);
-
-
 	// fix endianness
 	raw_plane.normal[0] = LE_Float32(raw_plane.normal[0]);
 	raw_plane.normal[1] = LE_Float32(raw_plane.normal[1]);
@@ -252,21 +405,12 @@ static u16_t AddRawPlane(const dplane_t *plane, bool *was_new)
 
 	*was_new = false;
 
-	if (! plane_hashtab[hash])
-		plane_hashtab[hash] = new std::vector<int>;
-
-	std::vector<int> * hashtab = plane_hashtab[hash];
-
-
-	for (unsigned int i = 0 ; i < hashtab->size() ; i++)
-	{
-		int index = (*hashtab)[i];
+	u32_t slot;
 
-		SYS_ASSERT(index < (int)bsp_planes.size());
+	int index = plane_table.Find(&raw_plane, &slot);
 
-		if (memcmp(&raw_plane, &bsp_planes[index], sizeof(raw_plane)) == 0)
-			return index;  // found it
-	}
+	if (index >= 0)
+		return index;  // found it
 
 
 	// not found, so add new one...
@@ -275,7 +419,7 @@ static u16_t AddRawPlane(const dplane_t *plane, bool *was_new)
 
 	bsp_planes.push_back(raw_plane);
 
-	hashtab->push_back(new_index);
+	plane_table.Insert(slot, new_index);
 
 #if 0  // DEBUG
 fprintf(stderr, "ADDED PLANE #%d : %08x %08x %08x d:%08x tp:%08x\n",
@@ -415,27 +559,23 @@ void BSP_WritePlanes(int lump_num, int max_planes)
 				max_planes);
 
 	BSP_ClearPlanes();
+
+	BSP_FlushLump(lump_num);
 }
 
 
 //------------------------------------------------------------------------
 
-#define VERTEX_HASH_SIZE  512
+static thread_local std::vector<dvertex_t> bsp_vertices;
 
-static std::vector<dvertex_t> bsp_vertices;
-
-static std::vector<int> * vert_hashtab[VERTEX_HASH_SIZE];
+static thread_local qDedupeTable_c<dvertex_t> vert_table;
 
 
 static void BSP_ClearVertices()
 {
 	bsp_vertices.clear();
 
-	for (int h = 0 ; h < VERTEX_HASH_SIZE ; h++)
-	{
-		delete vert_hashtab[h];
-		vert_hashtab[h] = NULL;
-	}
+	vert_table.Clear();
 }
 
 
@@ -443,6 +583,10 @@ static void BSP_PrepareVertices()
 {
 	BSP_ClearVertices();
 
+	bsp_vertices.reserve(BSP_EstimateCount(8));
+
+	vert_table.Reset(&bsp_vertices, BSP_EstimateCount(8));
+
 	// insert dummy vertex #0
 	dvertex_t dummy;
 	memset(&dummy, 0, sizeof(dummy));
@@ -453,11 +597,6 @@ static void BSP_PrepareVertices()
 
 u16_t BSP_AddVertex(float x, float y, float z)
 {
-	int hash = I_ROUND(x * 1.1);
-
-	hash = hash & (VERTEX_HASH_SIZE-1);
-
-
 	// create on-disk vertex, fixing endianness
 	dvertex_t raw_vert;
 
@@ -469,18 +608,12 @@ u16_t BSP_AddVertex(float x, float y, float z)
 	// find existing vertex...
 	// for speed we use a hash-table
 
-	if (! vert_hashtab[hash])
-		vert_hashtab[hash] = new std::vector<int>;
+	u32_t slot;
 
-	std::vector<int> * hashtab = vert_hashtab[hash];
+	int index = vert_table.Find(&raw_vert, &slot);
 
-	for (unsigned int i = 0 ; i < hashtab->size() ; i++)
-	{
-		int index = (*hashtab)[i];
-
-		if (memcmp(&raw_vert, &bsp_vertices[index], sizeof(raw_vert)) == 0)
-			return index;  // found it!
-	}
+	if (index >= 0)
+		return index;  // found it!
 
 
 	// not found, so add new one...
@@ -489,7 +622,7 @@ u16_t BSP_AddVertex(float x, float y, float z)
 
 	bsp_vertices.push_back(raw_vert);
 
-	hashtab->push_back(new_index);
+	vert_table.Insert(slot, new_index);
 
 	return new_index;
 }
@@ -512,20 +645,23 @@ void BSP_WriteVertices(int lump_num, int max_verts)
 	lump->Append(&bsp_vertices[0], bsp_vertices.size() * sizeof(dvertex_t));
 
 	BSP_ClearVertices();
+
+	BSP_FlushLump(lump_num);
 }
 
 
 //------------------------------------------------------------------------
 
-static std::vector<dedge_t> bsp_edges;
+static thread_local std::vector<dedge_t> bsp_edges;
 
-static std::map<u32_t, s32_t> bsp_edge_map;
+static thread_local qDedupeTable_c<dedge_t> edge_table;
 
 
 static void BSP_ClearEdges()
 {
 	bsp_edges.clear();
-	bsp_edge_map.clear();
+
+	edge_table.Clear();
 }
 
 
@@ -533,6 +669,10 @@ static void BSP_PrepareEdges()
 {
 	BSP_ClearEdges();
 
+	bsp_edges.reserve(BSP_EstimateCount(12));
+
+	edge_table.Reset(&bsp_edges, BSP_EstimateCount(12));
+
 	// insert dummy edge #0
 	dedge_t dummy;
 	memset(&dummy, 0, sizeof(dummy));
@@ -553,27 +693,27 @@ s32_t BSP_AddEdge(u16_t start, u16_t end)
 	}
 
 
-	// find existing edge...
-	u32_t key = (u32_t)start + (u32_t)(end << 16);
-
-	if (bsp_edge_map.find(key) != bsp_edge_map.end())
-	{
-		return bsp_edge_map[key] * (flipped ? -1 : 1);
-	}
-
-
-	// not found, so add new one...
 	dedge_t raw_edge;
 
 	raw_edge.v[0] = LE_U16(start);
 	raw_edge.v[1] = LE_U16(end);
 
 
+	// find existing edge...
+	u32_t slot;
+
+	int index = edge_table.Find(&raw_edge, &slot);
+
+	if (index >= 0)
+		return flipped ? -index : index;
+
+
+	// not found, so add new one...
 	int new_index = (int)bsp_edges.size();
 
 	bsp_edges.push_back(raw_edge);
 
-	bsp_edge_map[key] = new_index;
+	edge_table.Insert(slot, new_index);
 
 	return flipped ? -new_index : new_index;
 }
@@ -590,6 +730,8 @@ void BSP_WriteEdges(int lump_num, int max_edges)
 	lump->Append(&bsp_edges[0], bsp_edges.size() * sizeof(dedge_t));
 
 	BSP_ClearEdges();
+
+	BSP_FlushLump(lump_num);
 }
 
 
@@ -597,22 +739,86 @@ void BSP_WriteEdges(int lump_num, int max_edges)
 
 #define HEADER_LUMP_MAX  32
 
-static int bsp_numlumps;
-static int bsp_version;
+// the state of the .BSP file being written is per-thread, though the
+// PAK / PK3 file which it goes into is not.
+
+static thread_local int bsp_numlumps;
+static thread_local int bsp_version;
 
-static qLump_c * bsp_directory[HEADER_LUMP_MAX];
+static thread_local qLump_c * bsp_directory[HEADER_LUMP_MAX];
+
+// where each lump was written in the .BSP file, the length is -1
+// for lumps which have not been written yet.
+static thread_local u32_t bsp_lump_start [HEADER_LUMP_MAX];
+static thread_local s32_t bsp_lump_length[HEADER_LUMP_MAX];
+
+// current size of the .BSP file
+static thread_local u32_t bsp_write_pos;
 
 
 static void BSP_ClearLumps(void)
 {
-	for (int i = 0 ; i < bsp_numlumps ; i++)
+	for (int i = 0 ; i < HEADER_LUMP_MAX ; i++)
 	{
 		if (bsp_directory[i])
 		{
 			delete bsp_directory[i];
 			bsp_directory[i] = NULL;
 		}
+
+		bsp_lump_start [i] = 0;
+		bsp_lump_length[i] = -1;
+	}
+}
+
+
+static void BSP_AppendData(const void *data, int length)
+{
+	Cache_AppendData(data, length);
+
+	if (! Cache_OutputDeferred())
+	{
+		if (qk_game == 3)
+			ZIPF_AppendData(data, length);
+		else
+			PAK_AppendData(data, length);
+	}
+
+	bsp_write_pos += length;
+}
+
+
+static int BSP_HeaderSize()
+{
+	int size = 4 + sizeof(lump_t) * bsp_numlumps;
+
+	if (qk_game >= 2)
+		size += 4;  // ident
+
+	return size;
+}
+
+
+static void BSP_ReserveHeader()
+{
+	// the header is written when the level is closed, since only
+	// then are all the lumps known.
+
+	int size = BSP_HeaderSize();
+
+	std::vector<u8_t> blank(size, 0);
+
+	Cache_AppendData(&blank[0], size);
+
+	if (! Cache_OutputDeferred())
+	{
+		if (qk_game == 3)
+			ZIPF_ReserveData(size);
+		else
+			PAK_ReserveData(size);
 	}
+
+	bsp_write_pos += size;
 }
 
 
@@ -625,26 +831,22 @@ static void BSP_WriteLump(qLump_c *lump)
 	if (len == 0)
 		return;
 
-	if (qk_game == 3)
-	{
-		ZIPF_AppendData(lump->GetBuffer(), len);
+	BSP_AppendData(lump->GetBuffer(), len);
 
-		// no need for padding in PK3 files
+	// no need for padding in PK3 files
+	if (qk_game == 3)
 		return;
-	}
-
-	PAK_AppendData(lump->GetBuffer(), len);
 
 	// pad lumps to a multiple of four bytes
 	u32_t padding = ALIGN_LEN(len) - len;
 
-	SYS_ASSERT(0 <= padding && padding <= 3);
+	SYS_ASSERT(padding <= 3);
 
 	if (padding > 0)
 	{
 		static u8_t zeros[4] = { 0,0,0,0 };
 
-		PAK_AppendData(zeros, padding);
+		BSP_AppendData(zeros, padding);
 	}
 }
 
@@ -653,11 +855,17 @@ bool BSP_OpenLevel(const char *entry_in_pak)
 {
 	// assumes that PAK_OpenWrite() has already been called.
 
-	// begin the .BSP file
-	if (qk_game == 3)
-		ZIPF_NewLump(entry_in_pak);
-	else
-		PAK_NewLump(entry_in_pak);
+	// begin the .BSP file.  For a pipelined build, the output is
+	// only recorded, and is written into the PAK later (in order).
+	if (! Cache_OutputDeferred())
+	{
+		if (qk_game == 3)
+			ZIPF_NewLump(entry_in_pak);
+		else
+			PAK_NewLump(entry_in_pak);
+	}
+
+	Cache_NewEntry(entry_in_pak);
 
 	switch (qk_game)
 	{
@@ -686,6 +894,10 @@ bool BSP_OpenLevel(const char *entry_in_pak)
 
 	BSP_ClearLumps();
 
+	bsp_write_pos = 0;
+
+	BSP_ReserveHeader();
+
 	BSP_PreparePlanes();
 	BSP_PrepareVertices();
 	BSP_PrepareEdges();
@@ -698,64 +910,54 @@ bool BSP_OpenLevel(const char *entry_in_pak)
 
 static void BSP_WriteHeader()
 {
-	u32_t offset = 0;
+	// fills in the space reserved at the start of the .BSP file
+
+	std::vector<u8_t> header;
 
 	if (qk_game == 2)
-	{
-		PAK_AppendData(Q2_IDENT_MAGIC, 4);
-		offset += 4;
-	}
+		header.insert(header.end(), Q2_IDENT_MAGIC, Q2_IDENT_MAGIC + 4);
 	else if (qk_game == 3)
-	{
-		ZIPF_AppendData(Q3_IDENT_MAGIC, 4);
-		offset += 4;
-	}
+		header.insert(header.end(), Q3_IDENT_MAGIC, Q3_IDENT_MAGIC + 4);
 
 	s32_t raw_version = LE_S32(bsp_version);
 
-	if (qk_game == 3)
-		ZIPF_AppendData(&raw_version, 4);
-	else
-		PAK_AppendData(&raw_version, 4);
-
-	offset += 4;
-
-	offset += sizeof(lump_t) * bsp_numlumps;
+	header.insert(header.end(), (u8_t *)&raw_version, (u8_t *)&raw_version + 4);
 
 	for (int i = 0 ; i < bsp_numlumps ; i++)
 	{
 		lump_t raw_info;
 
-		// handle missing lumps : create an empty one
-		if (! bsp_directory[i])
-			bsp_directory[i] = new qLump_c();
+		raw_info.start  = LE_U32(bsp_lump_start[i]);
+		raw_info.length = LE_U32(bsp_lump_length[i]);
 
-		u32_t length = bsp_directory[i]->GetSize();
+		header.insert(header.end(), (u8_t *)&raw_info, (u8_t *)&raw_info + sizeof(raw_info));
+	}
 
-		raw_info.start  = LE_U32(offset);
-		raw_info.length = LE_U32(length);
+	SYS_ASSERT((int)header.size() == BSP_HeaderSize());
 
-		if (qk_game == 3)
-		{
-			ZIPF_AppendData(&raw_info, sizeof(raw_info));
+	Cache_PatchData(0, &header[0], (int)header.size());
 
-			offset += (u32_t)length;
-		}
+	if (! Cache_OutputDeferred())
+	{
+		bool ok;
+
+		if (qk_game == 3)
+			ok = ZIPF_PatchData(0, &header[0], (int)header.size());
 		else
-		{
-			PAK_AppendData(&raw_info, sizeof(raw_info));
+			ok = PAK_PatchData(0, &header[0], (int)header.size());
 
-			offset += (u32_t)ALIGN_LEN(length);
-		}
+		// the build fails when the file is closed
+		if (! ok)
+			LogPrintf("WARNING: unable to write the BSP header\n");
 	}
 }
 
 
 static csg_entity_c *FindObligeWorldspawn()
 {
-	for (unsigned int k = 0 ; k < all_entities.size() ; k++)
+	for (unsigned int k = 0 ; k < cur_level->entities.size() ; k++)
 	{
-		csg_entity_c *E = all_entities[k];
+		csg_entity_c *E = cur_level->entities[k];
 
 		if (strcmp(E->id.c_str(), "oblige_worldspawn") == 0)
 			return E;
@@ -775,7 +977,7 @@ void BSP_WriteEntities(int lump_num, const char *description)
 
 	if (qk_game >= 3)
 		lump->KeyPair("_generated_by", "OBLIGE " OBLIGE_VERSION);
-	else if (description)
+	else if (description && description[0])
 		lump->KeyPair("message", description);
 
 	// TODO : do this via oblige_worldspawn entity
@@ -815,9 +1017,9 @@ void BSP_WriteEntities(int lump_num, const char *description)
 
 	// add everything else
 
-	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->entities.size() ; i++)
 	{
-		csg_entity_c *E = all_entities[i];
+		csg_entity_c *E = cur_level->entities[i];
 
 		const char *name = E->id.c_str();
 
@@ -856,24 +1058,36 @@ void BSP_WriteEntities(int lump_num, const char *description)
 	u8_t zero = 0;
 
 	lump->Append(&zero, 1);
+
+	BSP_FlushLump(lump_num);
 }
 
 
 
 bool BSP_CloseLevel()
 {
-	BSP_WriteHeader();
+	// write all lumps which were not flushed earlier
 
 	for (int i = 0 ; i < bsp_numlumps ; i++)
 	{
-		BSP_WriteLump(bsp_directory[i]);
+		// handle missing lumps : create an empty one
+		if (! bsp_directory[i])
+			bsp_directory[i] = new qLump_c();
+
+		if (bsp_lump_length[i] < 0)
+			BSP_FlushLump(i);
 	}
 
+	BSP_WriteHeader();
+
 	// finish the .BSP file
-	if (qk_game == 3)
-		ZIPF_FinishLump();
-	else
-		PAK_FinishLump();
+	if (! Cache_OutputDeferred())
+	{
+		if (qk_game == 3)
+			ZIPF_FinishLump();
+		else
+			PAK_FinishLump();
+	}
 
 	// free all the memory
 	BSP_ClearLumps();
@@ -885,6 +1099,23 @@ bool BSP_CloseLevel()
 }
 
 
+void BSP_WriteCachedEntry(const char *name, const void *data, u32_t length)
+{
+	if (qk_game == 3)
+	{
+		ZIPF_NewLump(name);
+		ZIPF_AppendData(data, (int)length);
+		ZIPF_FinishLump();
+	}
+	else
+	{
+		PAK_NewLump(name);
+		PAK_AppendData(data, (int)length);
+		PAK_FinishLump();
+	}
+}
+
+
 qLump_c *BSP_NewLump(int entry)
 {
 	SYS_ASSERT(0 <= entry && entry < bsp_numlumps);
@@ -898,6 +1129,26 @@ qLump_c *BSP_NewLump(int entry)
 }
 
 
+void BSP_FlushLump(int entry)
+{
+	SYS_ASSERT(0 <= entry && entry < bsp_numlumps);
+
+	qLump_c *lump = bsp_directory[entry];
+
+	SYS_ASSERT(lump);
+
+	if (bsp_lump_length[entry] >= 0)
+		Main_FatalError("INTERNAL ERROR: BSP_FlushLump: already written entry [%d]\n", entry);
+
+	bsp_lump_start [entry] = bsp_write_pos;
+	bsp_lump_length[entry] = lump->GetSize();
+
+	BSP_WriteLump(lump);
+
+	lump->Free();
+}
+
+
 qLump_c * BSP_CreateInfoLump()
 {
 	qLump_c *L = new qLump_c();
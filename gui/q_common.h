@@ -58,6 +58,13 @@ public:
 
 	void Prepend(const void *data, u32_t len);
 
+	// replaces existing data, which must lie within the lump
+	void Overwrite(u32_t pos, const void *data, u32_t len);
+
+	// adds 'len' zero bytes to the end and returns a pointer to
+	// them, which is valid until the lump is modified again.
+	u8_t * AppendBlank(u32_t len);
+
 	void AddByte(byte value);
 
 	void Printf (const char *str, ...);
@@ -70,6 +77,9 @@ public:
 	void SetName(const char *_name);
 	const char *GetName() const;
 
+	// frees all the data
+	void Free();
+
 private:
 	void RawPrintf(const char *str);
 };
@@ -88,8 +98,16 @@ extern int qk_worldtype;
 bool BSP_OpenLevel(const char *entry_in_pak);
 bool BSP_CloseLevel();
 
+// writes a complete entry (from the level cache) into the PAK or PK3
+void BSP_WriteCachedEntry(const char *name, const void *data, u32_t length);
+
 qLump_c *BSP_NewLump(int entry);
 
+// writes a finished lump into the file now, rather than when the
+// level is closed, and frees its memory.  Nothing may be added to
+// the lump afterwards.
+void BSP_FlushLump(int entry);
+
 void BSP_AddInfoFile();
 qLump_c *BSP_CreateInfoLump();
 
@@ -27,7 +27,10 @@
 #include "hdr_fltk.h"
 #include "hdr_ui.h"
 
+#include <algorithm>
+
 #include "lib_file.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "main.h"
 
@@ -47,7 +50,15 @@
 // 0 = normal, -1 = fast, +1 = best
 static int q_light_quality = 0;
 
-bool q_mono_lighting = false;
+// when true (with the "best" quality), only luxels near shadow
+// edges and steep changes in light are supersampled.
+static bool q_light_adaptive = false;
+
+// difference between neighboring luxels (in the final 0-255 range)
+// which causes the adaptive mode to supersample them.
+#define ADAPTIVE_THRESHOLD  3
+
+thread_local bool q_mono_lighting = false;
 
 
 static int   q_low_light   = 0;
@@ -109,6 +120,7 @@ static liquid_coloring_t q_lava;
 void QLIT_InitProperties()
 {
 	q_light_quality = 0;
+	q_light_adaptive = false;
 	q_mono_lighting = false;
 
 	q3_luxel_size = 12.0;
@@ -166,10 +178,17 @@ bool QLIT_ParseProperty(const char *key, const char *value)
 {
 	if (StringCaseCmp(key, "q_light_quality") == 0)
 	{
+		q_light_adaptive = false;
+
 		if (StringCaseCmp(value, "low") == 0)
 			q_light_quality = -1;
 		else if (StringCaseCmp(value, "high") == 0)
 			q_light_quality = +1;
+		else if (StringCaseCmp(value, "adaptive") == 0)
+		{
+			q_light_quality  = +1;
+			q_light_adaptive = true;
+		}
 		else
 			q_light_quality = 0;
 
@@ -227,6 +246,7 @@ bool QLIT_ParseProperty(const char *key, const char *value)
 
 qLightmap_c::qLightmap_c(int w, int h, int value) :
 	width(w), height(h), num_styles(1), samples(),
+	flat(false), flat_value(0), hash(0),
 	offset(-1), lx(-1), ly(-1)
 {
 	lm_mat = new uv_matrix_c;
@@ -235,6 +255,8 @@ qLightmap_c::qLightmap_c(int w, int h, int value) :
 
 	current_pos = samples;
 
+	MemTag_Add(MEM_Lightmaps, sizeof(qLightmap_c) + width * height * sizeof(rgb_color_t));
+
 	styles[0] = 0;
 	styles[1] = styles[2] = styles[3] = 255;  // unused
 
@@ -244,6 +266,13 @@ qLightmap_c::qLightmap_c(int w, int h, int value) :
 
 qLightmap_c::~qLightmap_c()
 {
+	long size = sizeof(qLightmap_c);
+
+	if (! flat)
+		size += width * height * num_styles * sizeof(rgb_color_t);
+
+	MemTag_Add(MEM_Lightmaps, -size);
+
 	delete lm_mat;
 
 	delete[] samples;
@@ -252,6 +281,9 @@ qLightmap_c::~qLightmap_c()
 
 void qLightmap_c::Fill(rgb_color_t value)
 {
+	if (flat)
+		Expand();
+
 	for (int i = 0 ; i < width*height ; i++)
 		samples[i] = value;
 }
@@ -273,6 +305,9 @@ bool qLightmap_c::AddStyle(byte style)
 	if (num_styles > 4)
 		return false;
 
+	if (flat)
+		Expand();
+
 	styles[num_styles] = style;
 
 	rgb_color_t *new_samples = new rgb_color_t[width * height * (num_styles+1)];
@@ -281,6 +316,8 @@ bool qLightmap_c::AddStyle(byte style)
 
 	num_styles++;
 
+	MemTag_Add(MEM_Lightmaps, width * height * sizeof(rgb_color_t));
+
 	delete[] samples;
 
 	samples = new_samples;
@@ -293,6 +330,12 @@ bool qLightmap_c::AddStyle(byte style)
 
 rgb_color_t qLightmap_c::CalcAverage() const
 {
+	if (flat)
+	{
+		return MAKE_RGBA(RGB_RED(flat_value), RGB_GREEN(flat_value),
+						 RGB_BLUE(flat_value), 255);
+	}
+
 	float avg_r = 0;
 	float avg_g = 0;
 	float avg_b = 0;
@@ -320,11 +363,11 @@ rgb_color_t qLightmap_c::CalcAverage() const
 
 bool qLightmap_c::isDark() const
 {
-	int total = width * height * num_styles;
+	int total = flat ? 1 : width * height * num_styles;
 
 	for (int i = 0 ; i < total ; i++)
 	{
-		const rgb_color_t col = samples[i];
+		const rgb_color_t col = Sample(i);
 
 		if ((int)RGB_RED(col)   > 0) return false;
 		if ((int)RGB_GREEN(col) > 0) return false;
@@ -335,6 +378,63 @@ bool qLightmap_c::isDark() const
 }
 
 
+bool qLightmap_c::SameAs(const qLightmap_c *other) const
+{
+	if (width  != other->width  ||
+		height != other->height ||
+		num_styles != other->num_styles)
+		return false;
+
+	if (flat || other->flat)
+		return (flat && other->flat && flat_value == other->flat_value);
+
+	return memcmp(samples, other->samples,
+				  width * height * num_styles * sizeof(rgb_color_t)) == 0;
+}
+
+
+void qLightmap_c::Compact()
+{
+	// flat lightmaps are very common (large floors, dark areas),
+	// and only need a single value.
+
+	if (flat || num_styles > 1)
+		return;
+
+	int total = width * height;
+
+	for (int i = 1 ; i < total ; i++)
+		if (samples[i] != samples[0])
+			return;
+
+	flat = true;
+	flat_value = samples[0];
+
+	MemTag_Add(MEM_Lightmaps, -(long)(total * sizeof(rgb_color_t)));
+
+	delete[] samples;
+
+	samples = current_pos = NULL;
+}
+
+
+void qLightmap_c::Expand()
+{
+	int total = width * height;
+
+	samples = new rgb_color_t[total];
+
+	for (int i = 0 ; i < total ; i++)
+		samples[i] = flat_value;
+
+	current_pos = samples;
+
+	flat = false;
+
+	MemTag_Add(MEM_Lightmaps, total * sizeof(rgb_color_t));
+}
+
+
 void qLightmap_c::Write(qLump_c *lump)
 {
 	// (this only used for Q1 and Q2, not Q3)
@@ -346,7 +446,7 @@ void qLightmap_c::Write(qLump_c *lump)
 
 	for (int i = 0 ; i < total ; i++)
 	{
-		const rgb_color_t col = samples[i];
+		const rgb_color_t col = Sample(i);
 
 		byte r = RGB_RED(col);
 		byte g = RGB_GREEN(col);
@@ -492,7 +592,7 @@ public:
 };
 
 
-static std::vector< q3_lightmap_block_c * > all_q3_light_blocks;
+static thread_local std::vector< q3_lightmap_block_c * > all_q3_light_blocks;
 
 
 static int Q3_AllocLightBlock(int bw, int bh, int *bx, int *by)
@@ -527,9 +627,12 @@ static int Q3_AllocLightBlock(int bw, int bh, int *bx, int *by)
 
 //------------------------------------------------------------------------
 
-static std::vector<qLightmap_c *> qk_all_lightmaps;
+static thread_local std::vector<qLightmap_c *> qk_all_lightmaps;
 
-static qLump_c *lightmap_lump;
+static thread_local qLump_c *lightmap_lump;
+
+// lightmaps already written (or placed), indexed by their hash
+static thread_local std::map<u32_t, qLightmap_c *> lightmap_twins;
 
 
 void QLIT_FreeLightmaps()
@@ -539,6 +642,8 @@ void QLIT_FreeLightmaps()
 
 	qk_all_lightmaps.clear();
 
+	lightmap_twins.clear();
+
 	if (qk_game >= 3)
 	{
 		for (unsigned int k = 0 ; k < all_q3_light_blocks.size() ; k++)
@@ -559,6 +664,34 @@ static qLightmap_c * QLIT_NewLightmap(int w, int h)
 }
 
 
+static qLightmap_c * QLIT_FindTwin(qLightmap_c *L)
+{
+	// finds an earlier lightmap with exactly the same samples, which
+	// can share its space in the lump.  When none, this lightmap is
+	// remembered for the later ones.
+	//
+	// [ only single-style lightmaps are shared, they are the vast
+	//   majority and the hash is computed in Store() ]
+
+	if (L->num_styles > 1)
+		return NULL;
+
+	std::map<u32_t, qLightmap_c *>::iterator IT = lightmap_twins.find(L->hash);
+
+	if (IT == lightmap_twins.end())
+	{
+		lightmap_twins[L->hash] = L;
+		return NULL;
+	}
+
+	// a hash collision is harmless, the lightmap is merely not shared
+	if (! IT->second->SameAs(L))
+		return NULL;
+
+	return IT->second;
+}
+
+
 static void WriteFlatBlock(int level, int count)
 {
 	byte datum = (byte)level;
@@ -589,12 +722,133 @@ void QLIT_BuildLightingLump(int lump, int max_size)
 
 	// FIXME !!!! : check if lump would overflow, if yes then flatten some maps
 
+	lightmap_twins.clear();
+
+	int shared = 0;
+
 	for (unsigned int k = 0 ; k < qk_all_lightmaps.size() ; k++)
 	{
 		qLightmap_c *L = qk_all_lightmaps[k];
 
+		qLightmap_c *twin = QLIT_FindTwin(L);
+
+		if (twin)
+		{
+			L->offset = twin->offset;
+			shared++;
+			continue;
+		}
+
 		L->Write(lightmap_lump);
 	}
+
+	LogPrintf("Lighting: shared %d of %u lightmaps\n", shared,
+			  (unsigned int)qk_all_lightmaps.size());
+
+	BSP_FlushLump(lump);
+}
+
+
+struct lightmap_size_Compare
+{
+	inline bool operator() (const qLightmap_c *A, const qLightmap_c *B) const
+	{
+		if (A->height != B->height)
+			return A->height > B->height;
+
+		return A->width > B->width;
+	}
+};
+
+
+static void Q3_InitSharedBlock()
+{
+	int bx, by;
+
+	Q3_AllocLightBlock(2, 2, &bx, &by);
+}
+
+
+static void Q3_PackLightmaps()
+{
+	// all the lightmaps are known now, so pack them tallest first,
+	// which leaves a much flatter skyline in each block than when
+	// packing in face order.  The sort is stable, hence the result
+	// only depends on the input.
+
+	Q3_InitSharedBlock();
+
+	std::vector<qLightmap_c *> pending;
+
+	for (unsigned int k = 0 ; k < qk_all_lightmaps.size() ; k++)
+	{
+		// dark lightmaps already use the shared block
+		if (qk_all_lightmaps[k]->offset < 0)
+			pending.push_back(qk_all_lightmaps[k]);
+	}
+
+	std::stable_sort(pending.begin(), pending.end(), lightmap_size_Compare());
+
+	lightmap_twins.clear();
+
+	int shared = 0;
+
+	for (unsigned int k = 0 ; k < pending.size() ; k++)
+	{
+		qLightmap_c *twin = QLIT_FindTwin(pending[k]);
+
+		if (twin)
+			shared++;
+
+		pending[k]->Place(twin);
+	}
+
+	LogPrintf("Lighting: shared %d of %u lightmaps\n", shared,
+			  (unsigned int)pending.size());
+}
+
+
+void qLightmap_c::Place(const qLightmap_c *twin)
+{
+	if (twin)
+	{
+		offset = twin->offset;
+		lx = twin->lx;
+		ly = twin->ly;
+	}
+	else
+	{
+		offset = Q3_AllocLightBlock(width, height, &lx, &ly);
+	}
+
+	SYS_ASSERT(offset >= 0);
+
+	double s1 = (lx + 0.5) / (double)LIGHTMAP_WIDTH;
+	double t1 = (ly + 0.5) / (double)LIGHTMAP_HEIGHT;
+
+	lm_mat->s[3] += s1;
+	lm_mat->t[3] += t1;
+
+	// the samples are already in the block
+	if (twin)
+		return;
+
+	q3_lightmap_block_c *BL = all_q3_light_blocks[offset];
+	SYS_ASSERT(BL);
+
+	// only the first style is used in Q3
+	for (int y = 0 ; y < height ; y++)
+	for (int x = 0 ; x < width  ; x++)
+	{
+		const rgb_color_t col = Sample(y * width + x);
+
+		const int bx = lx + x;
+		const int by = ly + y;
+
+		BL->samples[bx][by][0] = RGB_RED(col);
+		BL->samples[bx][by][1] = RGB_GREEN(col);
+		BL->samples[bx][by][2] = RGB_BLUE(col);
+	}
 }
 
 
@@ -603,6 +857,8 @@ void QLIT_BuildQ3Lighting(int lump, int max_size)
 	// pack individual lightmaps into the 128x128 blocks
 	// [ this is lousy for memory usage.... ]
 
+	Q3_PackLightmaps();
+
 	lightmap_lump = BSP_NewLump(lump);
 
 	for (unsigned int b = 0 ; b < all_q3_light_blocks.size() ; b++)
@@ -620,6 +876,8 @@ void QLIT_BuildQ3Lighting(int lump, int max_size)
 	}
 
 	LogPrintf("created %d LM blocks\n", (int)all_q3_light_blocks.size());
+
+	BSP_FlushLump(lump);
 }
 
 
@@ -641,22 +899,28 @@ typedef struct
 
 // Lighting variables
 
-static quake_face_c *lt_face;
+static thread_local quake_face_c *lt_face;
 
-static double lt_plane_normal[3];
-static double lt_plane_dist;
+static thread_local double lt_plane_normal[3];
+static thread_local double lt_plane_dist;
 
-static quake_bbox_c lt_face_bbox;
+static thread_local quake_bbox_c lt_face_bbox;
 
-static int lt_W, lt_H;
+static thread_local int lt_W, lt_H;
 
-static int lt_current_style;
+static thread_local int lt_current_style;
 
 #define MAX_LM_SIZE  64
 
-static light_point_t lt_points[MAX_LM_SIZE * 2][MAX_LM_SIZE * 2];
+// these arrays are too big to be thread_local themselves, they are
+// allocated by QLIT_LightAllFaces() for the thread lighting the map.
+
+static thread_local light_point_t (* lt_points)[MAX_LM_SIZE * 2];
+
+// which points get traced in the current run over the lights
+static thread_local bool (* lt_trace)[MAX_LM_SIZE * 2];
 
-static int blocklights[MAX_LM_SIZE * 2][MAX_LM_SIZE * 2][3];
+static thread_local int (* blocklights)[MAX_LM_SIZE * 2][3];
 
 
 static void Q1_CalcFaceStuff(quake_face_c *F)
@@ -688,7 +952,7 @@ static void Q1_CalcFaceStuff(quake_face_c *F)
 
 	// calculate a normal to the texture axis.  points can be moved
 	// along this without changing their S/T
-	static quake_plane_c texnormal;
+	static thread_local quake_plane_c texnormal;
 
 	texnormal.nx = UV->s[2] * UV->t[1] - UV->s[1] * UV->t[2];
 	texnormal.ny = UV->s[0] * UV->t[2] - UV->s[2] * UV->t[0];
@@ -1104,6 +1368,9 @@ static void ClearLightBuffer(int level)
 
 void qLightmap_c::Store()
 {
+	if (flat)
+		Expand();
+
 	rgb_color_t *dest = current_pos;
 
 	float scale = q_light_scale / 1024.0;
@@ -1138,42 +1405,23 @@ void qLightmap_c::Store()
 		*dest++ = MAKE_RGBA(r2, g2, b2, 0);
 	}
 
-	if (qk_game >= 3 && isDark())
-	{
-fprintf(stderr, "DARK LIGHTMAP !\n");
-		offset = 0;
-	}
-	else if (qk_game >= 3)
-	{
-		// this is lousy for memory usage...
-		// [ but some stuff is using samples[], like CalcAverage() ]
-
-		offset = Q3_AllocLightBlock(width, height, &lx, &ly);
-		SYS_ASSERT(offset >= 0);
+	Compact();
 
-fprintf(stderr, "LM POSITION: block #%d (%3d %3d)\n", offset, lx, ly);
+	// this is used to find identical lightmaps (see QLIT_FindTwin)
+	hash = IntHash((width << 16) | height);
 
-		double s1 = (lx + 0.5) / (double)LIGHTMAP_WIDTH;
-		double t1 = (ly + 0.5) / (double)LIGHTMAP_HEIGHT;
+	int total = flat ? 1 : width * height;
 
-		lm_mat->s[3] += s1;
-		lm_mat->t[3] += t1;
-
-		q3_lightmap_block_c *BL = all_q3_light_blocks[offset];
-		SYS_ASSERT(BL);
-
-		for (int y = 0 ; y < height ; y++)
-		for (int x = 0 ; x < width  ; x++)
-		{
-			const rgb_color_t col = At(x, y);
+	for (int i = 0 ; i < total ; i++)
+		hash = IntHash(hash ^ Sample(i));
 
-			const int bx = lx + x;
-			const int by = ly + y;
+	// for Q3, non-dark lightmaps are placed into a block later,
+	// once all of them are known (see Q3_PackLightmaps).
 
-			BL->samples[bx][by][0] = RGB_RED(col);
-			BL->samples[bx][by][1] = RGB_GREEN(col);
-			BL->samples[bx][by][2] = RGB_BLUE(col);
-		}
+	if (qk_game >= 3 && isDark())
+	{
+fprintf(stderr, "DARK LIGHTMAP !\n");
+		offset = 0;
 	}
 }
 
@@ -1303,11 +1551,211 @@ static void FilterSuperSamples()
 //------------------------------------------------------------------------
 
 
-std::vector<quake_light_t> qk_all_lights;
+thread_local std::vector<quake_light_t> qk_all_lights;
+
+
+//
+// Sky visibility maps
+//
+// A ray from a luxel to a sun can only reach it by passing through
+// a sky brush, since the sun sits in the solid void above the map.
+// Each sun gets a map of where the sky brushes are as seen from the
+// sun itself (a central projection onto the plane z = sun.z - 1),
+// and a luxel whose ray misses every sky brush is known to be in
+// shadow without needing a trace.  Only the remaining luxels (the
+// ambiguous ones) are traced.
+//
+#define SKY_MAP_SIZE    64
+#define SKY_MAP_MARGIN  2.0
+
+class qSkyMap_c
+{
+private:
+	double sun_x, sun_y, sun_z;
+
+	// the projected bounding rectangle of each sky brush
+	std::vector<float> rects;
+
+	// bounds of all the rectangles
+	float u1, v1, u2, v2;
+
+	// each cell lists the rectangles which touch it
+	std::vector<int> cells[SKY_MAP_SIZE][SKY_MAP_SIZE];
+
+public:
+	qSkyMap_c(const quake_light_t& sun) :
+		sun_x(sun.x), sun_y(sun.y), sun_z(sun.z), rects(),
+		u1(0), v1(0), u2(0), v2(0)
+	{ }
+
+	~qSkyMap_c()
+	{ }
+
+	// returns false if the box is unsuitable (not below the sun)
+	bool AddBox(double x1, double y1, double z1,
+				double x2, double y2, double z2)
+	{
+		if (z2 >= sun_z)
+			return false;
+
+		float ru1 = 0, rv1 = 0, ru2 = 0, rv2 = 0;
+
+		// the projection of a box is the convex hull of its corners
+		for (int c = 0 ; c < 8 ; c++)
+		{
+			double dz = sun_z - ((c & 4) ? z2 : z1);
+
+			float u = (((c & 1) ? x2 : x1) - sun_x) / dz;
+			float v = (((c & 2) ? y2 : y1) - sun_y) / dz;
+
+			if (c == 0 || u < ru1) ru1 = u;
+			if (c == 0 || v < rv1) rv1 = v;
+			if (c == 0 || u > ru2) ru2 = u;
+			if (c == 0 || v > rv2) rv2 = v;
+		}
+
+		if (rects.empty() || ru1 < u1) u1 = ru1;
+		if (rects.empty() || rv1 < v1) v1 = rv1;
+		if (rects.empty() || ru2 > u2) u2 = ru2;
+		if (rects.empty() || rv2 > v2) v2 = rv2;
+
+		rects.push_back(ru1); rects.push_back(rv1);
+		rects.push_back(ru2); rects.push_back(rv2);
+
+		return true;
+	}
+
+	void BuildCells()
+	{
+		for (int i = 0 ; i < (int)rects.size() / 4 ; i++)
+		{
+			const float *R = &rects[i * 4];
+
+			int cx1 = CellU(R[0]);  int cx2 = CellU(R[2]);
+			int cy1 = CellV(R[1]);  int cy2 = CellV(R[3]);
+
+			for (int cx = cx1 ; cx <= cx2 ; cx++)
+			for (int cy = cy1 ; cy <= cy2 ; cy++)
+				cells[cx][cy].push_back(i);
+		}
+	}
+
+	// returns false when the ray from the point to the sun cannot
+	// pass through any sky brush.  Returns true when it might, and
+	// a full trace is needed.
+	bool MaySeeSky(float x, float y, float z) const
+	{
+		if (z >= sun_z)
+			return true;
+
+		float u = (x - sun_x) / (sun_z - z);
+		float v = (y - sun_y) / (sun_z - z);
+
+		if (rects.empty() || u < u1 || u > u2 || v < v1 || v > v2)
+			return false;
+
+		const std::vector<int>& list = cells[CellU(u)][CellV(v)];
+
+		for (unsigned int k = 0 ; k < list.size() ; k++)
+		{
+			const float *R = &rects[list[k] * 4];
+
+			if (R[0] <= u && u <= R[2] && R[1] <= v && v <= R[3])
+				return true;
+		}
+
+		return false;
+	}
+
+private:
+	int CellU(float u) const
+	{
+		int cx = (int)((u - u1) * SKY_MAP_SIZE / MAX(u2 - u1, 1e-6));
+		return CLAMP(0, cx, SKY_MAP_SIZE - 1);
+	}
+
+	int CellV(float v) const
+	{
+		int cy = (int)((v - v1) * SKY_MAP_SIZE / MAX(v2 - v1, 1e-6));
+		return CLAMP(0, cy, SKY_MAP_SIZE - 1);
+	}
+};
+
+
+static qSkyMap_c * QLIT_MakeSkyMap(const quake_light_t& sun)
+{
+	// the shortcut only works when the sun is in the solid void,
+	// otherwise a ray could reach it without going through the sky.
+	if (QVIS_TracePoint(sun.x, sun.y, sun.z))
+		return NULL;
+
+	qSkyMap_c *map = new qSkyMap_c(sun);
+
+	for (unsigned int k = 0 ; k < cur_level->brushes.size() ; k++)
+	{
+		csg_brush_c *B = cur_level->brushes[k];
+
+		if (! (B->bflags & BFLAG_Sky))
+			continue;
+
+		// the margin covers the epsilons used when tracing
+		double x1 = B->min_x - SKY_MAP_MARGIN;
+		double y1 = B->min_y - SKY_MAP_MARGIN;
+		double z1 = B->b.z   - SKY_MAP_MARGIN;
+
+		double x2 = B->max_x + SKY_MAP_MARGIN;
+		double y2 = B->max_y + SKY_MAP_MARGIN;
+		double z2 = B->t.z   + SKY_MAP_MARGIN;
+
+		bool inside = (x1 <= sun.x && sun.x <= x2 &&
+					   y1 <= sun.y && sun.y <= y2 &&
+					   z1 <= sun.z && sun.z <= z2);
+
+		if (inside || ! map->AddBox(x1, y1, z1, x2, y2, z2))
+		{
+			delete map;
+			return NULL;
+		}
+	}
+
+	map->BuildCells();
+
+	return map;
+}
+
+
+static void QLIT_MakeSkyMaps()
+{
+	int total = 0;
+	int count = 0;
+
+	for (unsigned int i = 0 ; i < qk_all_lights.size() ; i++)
+	{
+		quake_light_t& light = qk_all_lights[i];
+
+		if (light.kind != LTK_Sun)
+			continue;
+
+		light.sky_map = QLIT_MakeSkyMap(light);
+
+		total++;
+
+		if (light.sky_map)
+			count++;
+	}
+
+	if (total > 0)
+		LogPrintf("made sky maps for %d of %d suns\n", count, total);
+}
 
 
 static void QLIT_FreeLights()
 {
+	for (unsigned int i = 0 ; i < qk_all_lights.size() ; i++)
+	{
+		delete qk_all_lights[i].sky_map;
+	}
+
 	qk_all_lights.clear();
 }
 
@@ -1316,9 +1764,9 @@ static void QLIT_FindLights()
 {
 	QLIT_FreeLights();
 
-	for (unsigned int i = 0 ; i < all_entities.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->entities.size() ; i++)
 	{
-		csg_entity_c *E = all_entities[i];
+		csg_entity_c *E = cur_level->entities[i];
 
 		quake_light_t light;
 
@@ -1342,6 +1790,8 @@ static void QLIT_FindLights()
 		light.color = QLIT_ParseColorString(E->props.getStr("color"));
 		light.style = E->props.getInt("style", 0);
 
+		light.sky_map = NULL;
+
 		qk_all_lights.push_back(light);
 	}
 }
@@ -1418,6 +1868,12 @@ static void QLIT_ProcessLight(qLightmap_c *lmap, quake_light_t& light, int pass)
 		if (P.medium > MEDIUM_AIR)
 			continue;
 
+		if (! lt_trace[s][t])
+			continue;
+
+		if (light.sky_map && ! light.sky_map->MaySeeSky(P.x, P.y, P.z))
+			continue;
+
 		if (! QVIS_TraceRay(P.x, P.y, P.z, light.x, light.y, light.z))
 			continue;
 
@@ -1504,6 +1960,114 @@ void QLIT_TestingStuff(qLightmap_c *lmap)
 }
 
 
+static void QLIT_ProcessAllLights(qLightmap_c *lmap, int pass)
+{
+	for (unsigned int i = 0 ; i < qk_all_lights.size() ; i++)
+	{
+		QLIT_ProcessLight(lmap, qk_all_lights[i], pass);
+	}
+}
+
+
+static bool Adaptive_NeedRefine(int s, int t, int W, int H)
+{
+	// 's' and 't' are coordinates in the final lightmap, and the
+	// coarse sample is the first point of each 2x2 block.
+
+	const light_point_t & P = lt_points[s*2][t*2];
+
+	// refine when part of the block is off the face, in a solid, etc
+	if (lt_points[s*2 + 1][t*2    ].medium != P.medium ||
+		lt_points[s*2    ][t*2 + 1].medium != P.medium ||
+		lt_points[s*2 + 1][t*2 + 1].medium != P.medium)
+		return true;
+
+	if (P.medium > MEDIUM_AIR)
+		return false;
+
+	int threshold = (int)(ADAPTIVE_THRESHOLD * 1024.0 / MAX(0.01, q_light_scale));
+
+	for (int side = 0 ; side < 4 ; side++)
+	{
+		int ds = (side == 0) ? -1 : (side == 1) ? +1 : 0;
+		int dt = (side == 2) ? -1 : (side == 3) ? +1 : 0;
+
+		if (s + ds < 0 || s + ds >= W) continue;
+		if (t + dt < 0 || t + dt >= H) continue;
+
+		int ns = (s + ds) * 2;
+		int nt = (t + dt) * 2;
+
+		if (lt_points[ns][nt].medium > MEDIUM_AIR)
+			continue;
+
+		for (int c = 0 ; c < 3 ; c++)
+		{
+			if (abs(blocklights[ns][nt][c] - blocklights[s*2][t*2][c]) > threshold)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+
+static void QLIT_AdaptiveLights(qLightmap_c *lmap, int pass)
+{
+	// lights the first point of each 2x2 block, then supersamples
+	// only the blocks which differ from a neighbor (shadow edges and
+	// steep falloff).  The other blocks simply copy the first point,
+	// so that FilterSuperSamples() gives the same value.
+
+	int W = lt_W / 2;
+	int H = lt_H / 2;
+
+	for (int s = 0 ; s < lt_W ; s++)
+	for (int t = 0 ; t < lt_H ; t++)
+	{
+		lt_trace[s][t] = ((s | t) & 1) == 0;
+	}
+
+	QLIT_ProcessAllLights(lmap, pass);
+
+	bool refine[MAX_LM_SIZE][MAX_LM_SIZE];
+
+	bool any_refine = false;
+
+	for (int s = 0 ; s < W ; s++)
+	for (int t = 0 ; t < H ; t++)
+	{
+		refine[s][t] = Adaptive_NeedRefine(s, t, W, H);
+
+		if (refine[s][t])
+			any_refine = true;
+	}
+
+	for (int s = 0 ; s < W ; s++)
+	for (int t = 0 ; t < H ; t++)
+	{
+		for (int k = 1 ; k < 4 ; k++)
+		{
+			int ss = s*2 + (k & 1);
+			int tt = t*2 + (k >> 1);
+
+			lt_trace[ss][tt] = refine[s][t];
+
+			if (! refine[s][t])
+			{
+				for (int c = 0 ; c < 3 ; c++)
+					blocklights[ss][tt][c] = blocklights[s*2][t*2][c];
+			}
+		}
+
+		lt_trace[s*2][t*2] = false;
+	}
+
+	if (any_refine)
+		QLIT_ProcessAllLights(lmap, pass);
+}
+
+
 void QLIT_LightFace(quake_face_c *F)
 {
 	lt_face = F;
@@ -1526,9 +2090,17 @@ void QLIT_LightFace(quake_face_c *F)
 
 		ClearLightBuffer(pass ? 0 : q_low_light);
 
-		for (unsigned int i = 0 ; i < qk_all_lights.size() ; i++)
+		if (q_light_adaptive && q_light_quality > 0)
+		{
+			QLIT_AdaptiveLights(F->lmap, pass);
+		}
+		else
 		{
-			QLIT_ProcessLight(F->lmap, qk_all_lights[i], pass);
+			for (int s = 0 ; s < lt_W ; s++)
+			for (int t = 0 ; t < lt_H ; t++)
+				lt_trace[s][t] = true;
+
+			QLIT_ProcessAllLights(F->lmap, pass);
 		}
 
 		if (pass == 0)
@@ -1676,6 +2248,10 @@ static void Q3_ProcessLightForGrid(quake_light_t& light,
 	if (light.kind != LTK_Sun && dist >= light.radius)
 		return;
 
+	// fast check for suns
+	if (light.sky_map && ! light.sky_map->MaySeeSky(gx, gy, gz))
+		return;
+
 	// slow ray-trace check
 	if (! QVIS_TraceRay(gx, gy, gz, light.x, light.y, light.z))
 		return;
@@ -1691,7 +2267,89 @@ static void Q3_ProcessLightForGrid(quake_light_t& light,
 }
 
 
-static void Q3_VisitGridPoint(float gx, float gy, float gz, dlightgrid3_t *out)
+//
+// The light index is a 2D grid of cells covering the map, where each
+// cell lists the lights which can reach it (in their original order,
+// so that the results are the same as visiting every light).
+//
+#define LIGHT_INDEX_CELL  256.0
+
+class grid_light_index_c
+{
+public:
+	double x1, y1;
+
+	int w, h;
+
+	std::vector< std::vector<int> > cells;
+
+	// the light list of the thread which built the index
+	std::vector<quake_light_t> *lights;
+
+public:
+	grid_light_index_c() : x1(0), y1(0), w(0), h(0), cells(), lights(NULL)
+	{ }
+
+	~grid_light_index_c()
+	{ }
+
+	int CellX(double x) const
+	{
+		int cx = (int)floor((x - x1) / LIGHT_INDEX_CELL);
+		return CLAMP(0, cx, w - 1);
+	}
+
+	int CellY(double y) const
+	{
+		int cy = (int)floor((y - y1) / LIGHT_INDEX_CELL);
+		return CLAMP(0, cy, h - 1);
+	}
+
+	void Build(const float *mins, const float *maxs)
+	{
+		x1 = mins[0];
+		y1 = mins[1];
+
+		w = (int)ceil((maxs[0] - x1) / LIGHT_INDEX_CELL) + 1;
+		h = (int)ceil((maxs[1] - y1) / LIGHT_INDEX_CELL) + 1;
+
+		cells.clear();
+		cells.resize(w * h);
+
+		lights = &qk_all_lights;
+
+		for (unsigned int k = 0 ; k < lights->size() ; k++)
+		{
+			const quake_light_t& light = (*lights)[k];
+
+			int cx1 = 0, cx2 = w - 1;
+			int cy1 = 0, cy2 = h - 1;
+
+			// sun lights reach everywhere
+			if (light.kind != LTK_Sun)
+			{
+				// the extra unit guards against rounding issues
+				double r = light.radius + 1.0;
+
+				cx1 = CellX(light.x - r);  cx2 = CellX(light.x + r);
+				cy1 = CellY(light.y - r);  cy2 = CellY(light.y + r);
+			}
+
+			for (int cy = cy1 ; cy <= cy2 ; cy++)
+			for (int cx = cx1 ; cx <= cx2 ; cx++)
+				cells[cy * w + cx].push_back((int)k);
+		}
+	}
+
+	const std::vector<int>& Lookup(double x, double y) const
+	{
+		return cells[CellY(y) * w + CellX(x)];
+	}
+};
+
+
+static void Q3_VisitGridPoint(float gx, float gy, float gz, dlightgrid3_t *out,
+							  const grid_light_index_c *index)
 {
 	memset(out, 0, sizeof(dlightgrid3_t));
 
@@ -1757,11 +2415,15 @@ static void Q3_VisitGridPoint(float gx, float gy, float gz, dlightgrid3_t *out)
 	int   best_dir_color[3];
 	float best_direction[3];
 
-	for (unsigned int k = 0 ; k < qk_all_lights.size() ; k++)
+	const std::vector<int>& nearby = index->Lookup(gx, gy);
+
+	for (unsigned int n = 0 ; n < nearby.size() ; n++)
 	{
+		quake_light_t& light = (*index->lights)[nearby[n]];
+
 		int r, g, b, ity;
 
-		Q3_ProcessLightForGrid(qk_all_lights[k], gx, gy, gz, &r, &g, &b);
+		Q3_ProcessLightForGrid(light, gx, gy, gz, &r, &g, &b);
 
 		ity = MAX(r, MAX(g, b));
 
@@ -1781,9 +2443,9 @@ static void Q3_VisitGridPoint(float gx, float gy, float gz, dlightgrid3_t *out)
 			best_dir_color[1] = g;
 			best_dir_color[2] = b;
 
-			best_direction[0] = qk_all_lights[k].x - gx;
-			best_direction[1] = qk_all_lights[k].y - gy;
-			best_direction[2] = qk_all_lights[k].z - gz;
+			best_direction[0] = light.x - gx;
+			best_direction[1] = light.y - gy;
+			best_direction[2] = light.z - gz;
 		}
 	}
 
@@ -1806,6 +2468,56 @@ static void Q3_VisitGridPoint(float gx, float gy, float gz, dlightgrid3_t *out)
 
 #define LUMP_Q3_LIGHTGRID	15
 
+typedef struct
+{
+	float g_mins[3];
+	int   g_count[3];
+
+	// start of the lump data, the points are in index order
+	dlightgrid3_t *points;
+
+	grid_light_index_c *index;
+
+	// state of the calling thread, needed by the helper threads
+	csg_level_c  *level;
+	quake_node_c *bsp_root;
+	void *trace_nodes;
+}
+grid_lighting_job_t;
+
+
+static void Q3_GridLightingRow(int row, void *priv_dat)
+{
+	// each row is a line of points along the X axis
+
+	grid_lighting_job_t *job = (grid_lighting_job_t *)priv_dat;
+
+	cur_level   = job->level;
+	qk_bsp_root = job->bsp_root;
+
+	QVIS_ShareTraceNodes(job->trace_nodes);
+
+	int ynum = row % job->g_count[1];
+	int znum = row / job->g_count[1];
+
+	float gy = job->g_mins[1] + ynum *  64.0;
+	float gz = job->g_mins[2] + znum * 128.0;
+
+	dlightgrid3_t *out = job->points + row * job->g_count[0];
+
+	for (int xnum = 0 ; xnum < job->g_count[0] ; xnum++, out++)
+	{
+		float gx = job->g_mins[0] + xnum *  64.0;
+
+		dlightgrid3_t raw_point;
+
+		Q3_VisitGridPoint(gx, gy, gz, &raw_point, job->index);
+
+		memcpy(out, &raw_point, sizeof(raw_point));
+	}
+}
+
+
 static void Q3_GridLighting()
 {
 	// world mins / maxs
@@ -1833,28 +2545,33 @@ static void Q3_GridLighting()
 
 	qLump_c * lump = BSP_NewLump(LUMP_Q3_LIGHTGRID);
 
-	dlightgrid3_t raw_point;
+	int total = g_count[0] * g_count[1] * g_count[2];
 
-	for (int znum = 0 ; znum < g_count[2] ; znum++)
-	for (int ynum = 0 ; ynum < g_count[1] ; ynum++)
-	for (int xnum = 0 ; xnum < g_count[0] ; xnum++)
-	{
-		float gx = g_mins[0] + xnum *  64.0;
-		float gy = g_mins[1] + ynum *  64.0;
-		float gz = g_mins[2] + znum * 128.0;
+	if (total <= 0)
+		return;
+
+	grid_light_index_c index;
+
+	index.Build(w_mins, w_maxs);
 
-		Q3_VisitGridPoint(gx, gy, gz, &raw_point);
+	grid_lighting_job_t job;
 
-		lump->Append(&raw_point, sizeof(raw_point));
+	for (int b = 0 ; b < 3 ; b++)
+	{
+		job.g_mins[b]  = g_mins[b];
+		job.g_count[b] = g_count[b];
 	}
-}
 
+	job.points = (dlightgrid3_t *) lump->AppendBlank(total * sizeof(dlightgrid3_t));
+	job.index  = &index;
 
-void Q3_InitSharedBlock()
-{
-	int bx, by;
+	job.level       = cur_level;
+	job.bsp_root    = qk_bsp_root;
+	job.trace_nodes = QVIS_GetTraceNodes();
 
-	Q3_AllocLightBlock(2, 2, &bx, &by);
+	Thread_ParallelFor(g_count[1] * g_count[2], Q3_GridLightingRow, &job);
+
+	BSP_FlushLump(LUMP_Q3_LIGHTGRID);
 }
 
 
@@ -1864,13 +2581,16 @@ void QLIT_LightAllFaces()
 
 	QLIT_FindLights();
 
-	if (qk_game >= 3)
-		Q3_InitSharedBlock();
-
 	LogPrintf("found %u lights\n", qk_all_lights.size());
 
 	QVIS_MakeTraceNodes();
 
+	QLIT_MakeSkyMaps();
+
+	lt_points   = new light_point_t[MAX_LM_SIZE * 2][MAX_LM_SIZE * 2];
+	lt_trace    = new bool[MAX_LM_SIZE * 2][MAX_LM_SIZE * 2];
+	blocklights = new int[MAX_LM_SIZE * 2][MAX_LM_SIZE * 2][3];
+
 	int lit_faces  = 0;
 	int lit_luxels = 0;
 
@@ -1892,7 +2612,7 @@ void QLIT_LightAllFaces()
 		{
 			Main_Ticker();
 
-			if (main_action >= MAIN_CANCEL)
+			if (Main_Aborted())
 				break;
 
 			// fprintf(stderr, "lit %d faces (of %u)\n", lit_faces, qk_all_faces.size());
@@ -1902,15 +2622,19 @@ void QLIT_LightAllFaces()
 	LogPrintf("lit %d faces (of %u) using %d luxels\n",
 			  lit_faces, qk_all_faces.size(), lit_luxels);
 
+	delete[] lt_points;    lt_points   = NULL;
+	delete[] lt_trace;     lt_trace    = NULL;
+	delete[] blocklights;  blocklights = NULL;
+
 	// for Q3, determine grid lighting
 	if (qk_game >= 3)
 		Q3_GridLighting();
 
 // Todo: Q1/Q2 map models
 #if 0
-	for (unsigned int i = 0 ; i < qk_all_mapmodels.size() ; i++)
+	for (unsigned int i = 0 ; i < cur_level->mapmodels.size() ; i++)
 	{
-		QLIT_LightMapModel(qk_all_mapmodels[i]);
+		QLIT_LightMapModel(cur_level->mapmodels[i]);
 	}
 #endif
 
@@ -40,6 +40,14 @@ public:
 	rgb_color_t * samples;
 	rgb_color_t * current_pos;
 
+	// when every sample is the same (and there is a single style),
+	// only that value is kept and 'samples' is NULL.
+	bool flat;
+	rgb_color_t flat_value;
+
+	// hash of the samples, used to find identical lightmaps
+	u32_t hash;
+
 	// Q1 and Q2 only
 	byte styles[4];
 
@@ -65,6 +73,11 @@ public:
 		return current_pos[t * width + s];
 	}
 
+	inline rgb_color_t Sample(int i) const
+	{
+		return flat ? flat_value : samples[i];
+	}
+
 	bool hasStyle(byte style) const;
 
 	// returns false if too many styles
@@ -75,10 +88,21 @@ public:
 	// true if all samples are zero
 	bool isDark() const;
 
+	// true if the other lightmap has the same size and samples
+	bool SameAs(const qLightmap_c *other) const;
+
 	// transfer from blocklights[] array
 	void Store();
 
+	// Q3 only : allocate space in a light block and copy samples there.
+	// when 'twin' is given (an identical lightmap), use its space.
+	void Place(const qLightmap_c *twin = NULL);
+
 	void Write(qLump_c *lump);
+
+private:
+	void Compact();
+	void Expand();
 };
 
 
@@ -90,6 +114,8 @@ typedef enum
 quake_light_kind_e;
 
 
+class qSkyMap_c;
+
 typedef struct
 {
 	int kind;
@@ -100,6 +126,9 @@ typedef struct
 
 	rgb_color_t color;
 	int style;
+
+	// only used for suns, can be NULL
+	qSkyMap_c *sky_map;
 }
 quake_light_t;
 
@@ -116,9 +145,9 @@ typedef struct
 
 /***** VARIABLES **********/
 
-extern std::vector<quake_light_t> qk_all_lights;
+extern thread_local std::vector<quake_light_t> qk_all_lights;
 
-extern bool q_mono_lighting;
+extern thread_local bool q_mono_lighting;
 
 
 /***** FUNCTIONS **********/
@@ -33,6 +33,7 @@
 #include <algorithm>
 
 #include "lib_file.h"
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "main.h"
 
@@ -56,10 +57,13 @@ public:
 	// normal vector
 	float nx, ny, nz;
 
-	std::vector<float> vertices;
+	u32_t hash;
+
+	// range of this line's vertices in 'tj_vertices'
+	int first, count;
 
 public:
-	infinite_line_c() : vertices()
+	infinite_line_c() : first(0), count(0)
 	{ }
 
 	~infinite_line_c()
@@ -115,9 +119,9 @@ public:
 		nz = 0;
 	}
 
-	int CalcHash() const
+	u32_t CalcHash() const
 	{
-		int hash;
+		u32_t hash;
 
 		hash = IntHash(I_ROUND(x * 1.4));
 		hash = IntHash(I_ROUND(y * 1.4) ^ hash);
@@ -150,59 +154,61 @@ public:
 		return (V.x - x) * nx + (V.y - y) * ny + (V.z - z) * nz;
 	}
 
-	void AddVert(const quake_vertex_c & V)
-	{
-		vertices.push_back(CalcAlong(V));
-	}
-
 	void GetCoord(quake_vertex_c & V, float along) const
 	{
 		V.x = x + nx * along;
 		V.y = y + ny * along;
 		V.z = z + nz * along;
 	}
+};
 
-	void SortVerts()
-	{
-		if (vertices.empty())
-			return;
 
-		std::sort(vertices.begin(), vertices.end());
+static thread_local std::vector<infinite_line_c> infinite_lines;
 
-		// remove any duplicates
+// open-addressing hash table, each slot is an index into the
+// infinite_lines[] vector or -1 when empty.
+static thread_local std::vector<int> inf_line_hashtab;
 
-		unsigned int s = 1;
-		unsigned int d = 1;
-		unsigned int total = vertices.size();
+static thread_local int inf_line_hash_used;
 
-		for ( ; s < total ; s++)
-		{
-			if (fabs(vertices[s] - vertices[s-1]) < ALONG_EPSILON)
-				continue;
 
-			vertices[d++] = vertices[s];
-		}
+// a vertex sitting on an infinite line, only used while collecting
+// the vertices (before they are sorted).
+typedef struct
+{
+	int   line;
+	float along;
 
-		if (d < s)
-			vertices.resize(d);
-	}
-};
+} tj_raw_vert_t;
 
+static thread_local std::vector<tj_raw_vert_t> tj_raw_verts;
 
-#define INF_LINE_HASH_SIZE  1024
+// the sorted vertices of every line, stored contiguously
+static thread_local std::vector<float> tj_vertices;
 
-static std::vector<infinite_line_c> infinite_lines;
+static thread_local int tjunc_count;
 
-static std::vector<int> * inf_line_hashtab[INF_LINE_HASH_SIZE];
 
-static int tjunc_count;
+// the tables used when fixing faces.  These are the tables of the
+// thread which built them, shared (read-only) with helper threads.
+typedef struct
+{
+	const std::vector<infinite_line_c> * lines;
+	const std::vector<int> * hashtab;
+	const std::vector<float> * vertices;
+
+} tj_tables_t;
 
 
 static void TJ_InitHash()
 {
 	infinite_lines.clear();
 
-	memset(inf_line_hashtab, 0, sizeof(inf_line_hashtab));
+	inf_line_hashtab.assign(4096, -1);
+	inf_line_hash_used = 0;
+
+	tj_raw_verts.clear();
+	tj_vertices.clear();
 
 	tjunc_count = 0;
 }
@@ -210,18 +216,64 @@ static void TJ_InitHash()
 
 static void TJ_FreeHash()
 {
-	infinite_lines.clear();
+	std::vector<infinite_line_c>().swap(infinite_lines);
+	std::vector<int>().swap(inf_line_hashtab);
 
-	for (unsigned int i = 0 ; i < INF_LINE_HASH_SIZE ; i++)
+	std::vector<tj_raw_vert_t>().swap(tj_raw_verts);
+	std::vector<float>().swap(tj_vertices);
+}
+
+
+static void TJ_GrowHash()
+{
+	u32_t mask = (u32_t)inf_line_hashtab.size() * 2 - 1;
+
+	inf_line_hashtab.assign(mask + 1, -1);
+
+	for (unsigned int i = 0 ; i < infinite_lines.size() ; i++)
 	{
-		delete inf_line_hashtab[i];
-		inf_line_hashtab[i] = NULL;
+		u32_t slot = infinite_lines[i].hash & mask;
+
+		while (inf_line_hashtab[slot] >= 0)
+			slot = (slot + 1) & mask;
+
+		inf_line_hashtab[slot] = i;
 	}
 }
 
 
-static infinite_line_c * TJ_HashLookup(const quake_vertex_c & A,
-                                       const quake_vertex_c & B)
+static int TJ_HashFind(const tj_tables_t & T, const infinite_line_c & IL,
+                       u32_t *slot_var)
+{
+	// returns index of matching line, or -1 if not found (and then
+	// 'slot_var' is where a new one should be placed).
+
+	const std::vector<int> & hashtab = *T.hashtab;
+
+	u32_t mask = (u32_t)hashtab.size() - 1;
+	u32_t slot = IL.hash & mask;
+
+	for (;;)
+	{
+		int index = hashtab[slot];
+
+		if (index < 0)
+		{
+			*slot_var = slot;
+			return -1;
+		}
+
+		const infinite_line_c *test = &(*T.lines)[index];
+
+		if (test->hash == IL.hash && test->Match(IL))
+			return index;
+
+		slot = (slot + 1) & mask;
+	}
+}
+
+
+static int TJ_HashLookup(const quake_vertex_c & A, const quake_vertex_c & B)
 {
 	// this will create the infinite line when not already present
 
@@ -230,45 +282,77 @@ static infinite_line_c * TJ_HashLookup(const quake_vertex_c & A,
 	IL.Set(A, B);
 	IL.MakeConsistent();
 
-	int hash = IL.CalcHash() & (INF_LINE_HASH_SIZE - 1);
+	IL.hash = IL.CalcHash();
 
-	if (! inf_line_hashtab[hash])
-		inf_line_hashtab[hash] = new std::vector<int>;
+	tj_tables_t T;
 
-	std::vector<int> * hashtab = inf_line_hashtab[hash];
+	T.lines   = &infinite_lines;
+	T.hashtab = &inf_line_hashtab;
 
+	u32_t slot;
 
-	for (unsigned int i = 0 ; i < hashtab->size() ; i++)
-	{
-		int index = (*hashtab)[i];
+	int index = TJ_HashFind(T, IL, &slot);
 
-		infinite_line_c *test = &infinite_lines[index];
-
-		if (test->Match(IL))
-			return test;
-	}
+	if (index >= 0)
+		return index;
 
 	// not found, make new one
 
-/// fprintf(stderr, "INF HASH %04d: (%1.6f %1.6f %1.6f) + (%1.6f %1.6f %1.6f)\n",
-///         hash,  IL.x, IL.y, IL.z,  IL.nx, IL.ny, IL.nz);
-
-	int index = (int)infinite_lines.size();
+	index = (int)infinite_lines.size();
 
 	infinite_lines.push_back(IL);
 
-	hashtab->push_back(index);
+	inf_line_hashtab[slot] = index;
+	inf_line_hash_used++;
+
+	if (inf_line_hash_used * 2 > (int)inf_line_hashtab.size())
+		TJ_GrowHash();
+
+	return index;
+}
+
+
+static const infinite_line_c * TJ_FindLine(const tj_tables_t & T,
+                                           const quake_vertex_c & A,
+                                           const quake_vertex_c & B)
+{
+	// like TJ_HashLookup() but never modifies the table, hence is
+	// safe to use from multiple threads.  Returns NULL when there is
+	// no such line (and hence no vertices which could split it).
+
+	infinite_line_c IL;
+
+	IL.Set(A, B);
+	IL.MakeConsistent();
+
+	IL.hash = IL.CalcHash();
+
+	u32_t slot;
+
+	int index = TJ_HashFind(T, IL, &slot);
 
-	return &infinite_lines.back();
+	if (index < 0)
+		return NULL;
+
+	return &(*T.lines)[index];
 }
 
 
 static void TJ_AddEdge(const quake_vertex_c & A, const quake_vertex_c & B)
 {
-	infinite_line_c * IL = TJ_HashLookup(A, B);
+	int index = TJ_HashLookup(A, B);
+
+	const infinite_line_c *IL = &infinite_lines[index];
+
+	tj_raw_vert_t RV;
+
+	RV.line = index;
 
-	IL->AddVert(A);
-	IL->AddVert(B);
+	RV.along = IL->CalcAlong(A);
+	tj_raw_verts.push_back(RV);
+
+	RV.along = IL->CalcAlong(B);
+	tj_raw_verts.push_back(RV);
 }
 
 
@@ -291,16 +375,54 @@ static void TJ_AddFaces(quake_node_c *node)
 }
 
 
+struct tj_raw_vert_Compare
+{
+	inline bool operator() (const tj_raw_vert_t & A, const tj_raw_vert_t & B) const
+	{
+		if (A.line != B.line)
+			return A.line < B.line;
+
+		return A.along < B.along;
+	}
+};
+
+
 static void TJ_SortVertices()
 {
-	for (unsigned int i = 0 ; i < infinite_lines.size() ; i++)
+	// sort all the vertices at once, grouping them by line, then
+	// copy them into the final array while removing duplicates.
+
+	std::sort(tj_raw_verts.begin(), tj_raw_verts.end(), tj_raw_vert_Compare());
+
+	tj_vertices.reserve(tj_raw_verts.size());
+
+	unsigned int total = tj_raw_verts.size();
+
+	for (unsigned int s = 0 ; s < total ; s++)
 	{
-		infinite_lines[i].SortVerts();    
+		const tj_raw_vert_t & RV = tj_raw_verts[s];
+
+		infinite_line_c *IL = &infinite_lines[RV.line];
+
+		if (s == 0 || tj_raw_verts[s-1].line != RV.line)
+		{
+			IL->first = (int)tj_vertices.size();
+		}
+		else if (fabs(RV.along - tj_raw_verts[s-1].along) < ALONG_EPSILON)
+		{
+			continue;
+		}
+
+		tj_vertices.push_back(RV.along);
+
+		IL->count = (int)tj_vertices.size() - IL->first;
 	}
+
+	std::vector<tj_raw_vert_t>().swap(tj_raw_verts);
 }
 
 
-static bool TJ_FixOneFace(quake_face_c *F)
+static bool TJ_FixOneFace(const tj_tables_t & T, quake_face_c *F, int *count)
 {
 	// returns true if the face is OK, or false if it was modified.
 	// when it was modified we need to repeat the process again,
@@ -315,6 +437,8 @@ static bool TJ_FixOneFace(quake_face_c *F)
 
 	unsigned int numverts = local_verts.size();
 
+	F->verts.reserve(numverts + 4);
+
 	for (unsigned int k = 0 ; k < numverts ; k++)
 	{
 		const quake_vertex_c & A = local_verts[k];
@@ -322,7 +446,10 @@ static bool TJ_FixOneFace(quake_face_c *F)
 
 		F->verts.push_back(A);
 
-		infinite_line_c * IL = TJ_HashLookup(A, B);
+		const infinite_line_c * IL = TJ_FindLine(T, A, B);
+
+		if (! IL || IL->count == 0)
+			continue;
 
 		float along_A = IL->CalcAlong(A);
 		float along_B = IL->CalcAlong(B);
@@ -332,49 +459,91 @@ static bool TJ_FixOneFace(quake_face_c *F)
 			std::swap(along_A, along_B);
 		}
 
-		for (unsigned int n = 0 ; n < IL->vertices.size() ; n++)
-		{
-			float along_N = IL->vertices[n];
+		// find the first vertex past A
+		const float *begin = &(*T.vertices)[IL->first];
+		const float *end   = begin + IL->count;
 
-			if (along_N < along_A + ALONG_EPSILON)
-				continue;
+		const float *pos = std::lower_bound(begin, end, along_A + ALONG_EPSILON);
 
-			if (along_N > along_B - ALONG_EPSILON)
-				break;
+		if (pos == end)
+			continue;
 
-			// we have found a T-junction folks!
-			tjunc_count++;
+		float along_N = *pos;
 
-			quake_vertex_c new_vert;
+		if (along_N > along_B - ALONG_EPSILON)
+			continue;
 
-			IL->GetCoord(new_vert, along_N);
+		// we have found a T-junction folks!
+		(*count)++;
 
-			F->verts.push_back(new_vert);
+		quake_vertex_c new_vert;
 
-			// stop now, as the next intersecting vertex may be in the
-			// wrong order for the face's winding.
-			changed = true;
-			break;
-		}
+		IL->GetCoord(new_vert, along_N);
+
+		F->verts.push_back(new_vert);
+
+		// only add one vertex per edge, as the next intersecting vertex
+		// may be in the wrong order for the face's winding.
+		changed = true;
 	}
 
 	return !changed;  // OK if not changed
 }
 
 
-static void TJ_FixFaces(quake_node_c *node)
+static void TJ_CollectFaces(quake_node_c *node, std::vector<quake_face_c *> & list)
 {
 	for (unsigned int i = 0 ; i < node->faces.size() ; i++)
+		list.push_back(node->faces[i]);
+
+	if (node->front_N) TJ_CollectFaces(node->front_N, list);
+	if (node-> back_N) TJ_CollectFaces(node-> back_N, list);
+}
+
+
+typedef struct
+{
+	tj_tables_t tables;
+
+	std::vector<quake_face_c *> faces;
+
+	// number of T-junctions fixed in each face
+	std::vector<int> counts;
+
+} tj_fix_job_t;
+
+
+static void TJ_FixFaceJob(int index, void *priv_dat)
+{
+	tj_fix_job_t *job = (tj_fix_job_t *) priv_dat;
+
+	for (int loop = 0 ; loop < 16 ; loop++)
 	{
-		for (int loop = 0 ; loop < 16 ; loop++)
-		{
-			if (TJ_FixOneFace(node->faces[i]))
-				break;
-		}
+		if (TJ_FixOneFace(job->tables, job->faces[index], &job->counts[index]))
+			break;
 	}
+}
+
+
+static void TJ_FixFaces()
+{
+	// the line table is read-only now, so faces can be fixed in
+	// parallel (each face only modifies itself).
+
+	tj_fix_job_t job;
+
+	job.tables.lines    = &infinite_lines;
+	job.tables.hashtab  = &inf_line_hashtab;
+	job.tables.vertices = &tj_vertices;
+
+	TJ_CollectFaces(qk_bsp_root, job.faces);
+
+	job.counts.assign(job.faces.size(), 0);
+
+	Thread_ParallelFor((int)job.faces.size(), TJ_FixFaceJob, &job);
 
-	if (node->front_N) TJ_FixFaces(node->front_N);
-	if (node-> back_N) TJ_FixFaces(node-> back_N);
+	for (unsigned int i = 0 ; i < job.counts.size() ; i++)
+		tjunc_count += job.counts[i];
 }
 
 
@@ -383,7 +552,7 @@ void QCOM_Fix_T_Junctions()
 	TJ_InitHash();
 	TJ_AddFaces(qk_bsp_root);
 	TJ_SortVertices();
-	TJ_FixFaces(qk_bsp_root);
+	TJ_FixFaces();
 	TJ_FreeHash();
 
 	LogPrintf("Fixed %d T-Junctions\n", tjunc_count);
@@ -63,7 +63,7 @@ typedef struct
 tnode_t;
 
 
-static tnode_t *trace_nodes;
+static thread_local tnode_t *trace_nodes;
 
 
 static int ConvertTraceLeaf(quake_leaf_c *leaf)
@@ -176,6 +176,21 @@ void QVIS_FreeTraceNodes()
 }
 
 
+void * QVIS_GetTraceNodes()
+{
+	return trace_nodes;
+}
+
+
+void QVIS_ShareTraceNodes(void *nodes)
+{
+	// the nodes remain owned by the thread which made them, so never
+	// call QVIS_FreeTraceNodes() in the thread sharing them.
+
+	trace_nodes = (tnode_t *)nodes;
+}
+
+
 static int RecursiveTestRay(int nodenum,
                             float x1, float y1, float z1,
                             float x2, float y2, float z2)
@@ -424,14 +439,14 @@ bool QVIS_TracePoint(float x, float y, float z)
 
 #define VIS_EPSILON  0.01
 
-int cluster_X;
-int cluster_Y;
-int cluster_W;
-int cluster_H;
+thread_local int cluster_X;
+thread_local int cluster_Y;
+thread_local int cluster_W;
+thread_local int cluster_H;
 
-qCluster_c ** qk_clusters;
+thread_local qCluster_c ** qk_clusters;
 
-static Vis_Buffer * qk_visbuf;
+static thread_local Vis_Buffer * qk_visbuf;
 
 
 qCluster_c::qCluster_c(int _x, int _y) : cx(_x), cy(_y), leafs(),
@@ -603,13 +618,13 @@ static void FloodAmbientSounds()
 //  VISIBILITY
 //------------------------------------------------------------------------
 
-static qLump_c *q_visibility;
+static thread_local qLump_c *q_visibility;
 
-static byte *v_row_buffer;
-static byte *v_compress_buffer;
+static thread_local byte *v_row_buffer;
+static thread_local byte *v_compress_buffer;
 
-static int v_row_bits;  // number of leafs or clusters
-static int v_bytes_per_row;
+static thread_local int v_row_bits;  // number of leafs or clusters
+static thread_local int v_bytes_per_row;
 
 
 // statistic stuff
@@ -657,8 +672,8 @@ typedef struct
 }
 vis_statistics_t;
 
-static vis_statistics_t pvs_stats;
-static vis_statistics_t phs_stats;
+static thread_local vis_statistics_t pvs_stats;
+static thread_local vis_statistics_t phs_stats;
 
 
 static int WriteCompressedRow(bool PHS)
@@ -847,7 +862,7 @@ static void Build_PVS()
 		{
 			Main_Ticker();
 
-			if (main_action >= MAIN_CANCEL)
+			if (Main_Aborted())
 				return;
 		}
 
@@ -856,9 +871,18 @@ static void Build_PVS()
 }
 
 
-static void Q2_PrependOffsets(int num_clusters)
+static int Q2_OffsetsSize(int num_clusters)
 {
-	int header_size = 4 + 8 * num_clusters;
+	return 4 + 8 * num_clusters;
+}
+
+
+static void Q2_WriteOffsets(int num_clusters)
+{
+	// the space for these was reserved at the start of the lump,
+	// hence the offsets already include the header size.
+
+	int header_size = Q2_OffsetsSize(num_clusters);
 
 	s32_t *header = new s32_t[1 + num_clusters * 2];
 
@@ -869,16 +893,16 @@ static void Q2_PrependOffsets(int num_clusters)
 		qCluster_c *cluster = qk_clusters[i];
 
 		// dummy offset for unused clusters
-		if (cluster->visofs  < 0) cluster->visofs  = 0;
-		if (cluster->hearofs < 0) cluster->hearofs = 0;
+		if (cluster->visofs  < 0) cluster->visofs  = header_size;
+		if (cluster->hearofs < 0) cluster->hearofs = header_size;
 
 		// fix endianness too
 
-		header[i*2 + 1] = LE_S32(header_size + cluster->visofs);
-		header[i*2 + 2] = LE_S32(header_size + cluster->hearofs);
+		header[i*2 + 1] = LE_S32(cluster->visofs);
+		header[i*2 + 2] = LE_S32(cluster->hearofs);
 	}
 
-	q_visibility->Prepend(header, header_size);
+	q_visibility->Overwrite(0, header, header_size);
 
 	delete[] header;
 }
@@ -954,21 +978,27 @@ void QVIS_Visibility(int lump, int max_size, int numleafs)
 		q_visibility->Append(&raw_count, sizeof(raw_count));
 		q_visibility->Append(&raw_size,  sizeof(raw_size));
 	}
+	else if (qk_game == 2)
+	{
+		q_visibility->AppendBlank(Q2_OffsetsSize(num_clusters));
+	}
 
 	Build_PVS();
 
-	if (! (main_action >= MAIN_CANCEL))
+	if (! Main_Aborted())
 	{
 		ShowVisStats();
 
 		if (qk_game == 2)
-			Q2_PrependOffsets(num_clusters);
+			Q2_WriteOffsets(num_clusters);
 
 		// TODO: handle overflow: store visdata in memory, and "merge" the
 		//       clusters into pairs or 2x2 contiguous pieces.
 
 		if (q_visibility->GetSize() >= max_size)
 			Main_FatalError("Quake build failure: exceeded VISIBILITY limit\n");
+
+		BSP_FlushLump(lump);
 	}
 
 	delete[] v_row_buffer;
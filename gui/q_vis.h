@@ -62,10 +62,10 @@ public:
 
 /***** VARIABLES **********/
 
-extern int cluster_X, cluster_Y;
-extern int cluster_W, cluster_H;
+extern thread_local int cluster_X, cluster_Y;
+extern thread_local int cluster_W, cluster_H;
 
-extern qCluster_c ** qk_clusters;
+extern thread_local qCluster_c ** qk_clusters;
 
 
 /***** FUNCTIONS **********/
@@ -73,6 +73,11 @@ extern qCluster_c ** qk_clusters;
 void QVIS_MakeTraceNodes();
 void QVIS_FreeTraceNodes();
 
+// the trace nodes are per-thread.  These let a helper thread trace
+// rays using the nodes made by another thread.
+void * QVIS_GetTraceNodes();
+void   QVIS_ShareTraceNodes(void *nodes);
+
 // returns true if OK, false if blocked
 bool QVIS_TraceRay(float x1, float y1, float z1,
                    float x2, float y2, float z2);
@@ -22,6 +22,10 @@
 #include "main.h"
 #include "lib_util.h"
 
+#ifndef WIN32
+#include <atomic>
+#endif
+
 
 #define DEBUG_BUF_LEN  20000
 
@@ -32,6 +36,8 @@ static char *log_filename = NULL;
 static bool debugging = false;
 static bool terminal  = false;
 
+static thread_local std::string * log_capture;
+
 
 bool LogInit(const char *filename)
 {
@@ -85,8 +91,51 @@ void LogClose(void)
 }
 
 
+bool LogReopen(const char *filename)
+{
+	if (! log_file)
+		return true;
+
+	fclose(log_file);
+	log_file = NULL;
+
+	StringFree(log_filename);
+	log_filename = NULL;
+
+	return LogInit(filename);
+}
+
+
+void LogBeginCapture(std::string *buffer)
+{
+	log_capture = buffer;
+}
+
+
+void LogEndCapture()
+{
+	log_capture = NULL;
+}
+
+
 void LogPrintf(const char *str, ...)
 {
+	if (log_capture)
+	{
+		static thread_local char buffer[DEBUG_BUF_LEN];
+
+		va_list args;
+
+		va_start(args, str);
+		vsnprintf(buffer, DEBUG_BUF_LEN-1, str, args);
+		va_end(args);
+
+		buffer[DEBUG_BUF_LEN-2] = 0;
+
+		log_capture->append(buffer);
+		return;
+	}
+
 	if (log_file)
 	{
 		va_list args;
@@ -114,7 +163,7 @@ void DebugPrintf(const char *str, ...)
 {
 	if (debugging)
 	{
-		static char buffer[DEBUG_BUF_LEN];
+		static thread_local char buffer[DEBUG_BUF_LEN];
 
 		va_list args;
 
@@ -143,6 +192,71 @@ void DebugPrintf(const char *str, ...)
 }
 
 
+//------------------------------------------------------------------------
+//  MEMORY ACCOUNTING
+//------------------------------------------------------------------------
+
+static const char * mem_tag_names[MEM_NUM_TAGS] =
+{
+	"brushes", "entities", "regions", "q_faces", "lightmaps", "vis_bufs"
+};
+
+// several levels can be built at once, so these are updated from
+// multiple threads.
+#ifdef WIN32
+static volatile long mem_tag_current[MEM_NUM_TAGS];
+static volatile long mem_tag_peak   [MEM_NUM_TAGS];
+#else
+static std::atomic<long> mem_tag_current[MEM_NUM_TAGS];
+static std::atomic<long> mem_tag_peak   [MEM_NUM_TAGS];
+#endif
+
+
+void MemTag_Add(int tag, long bytes)
+{
+	SYS_ASSERT(0 <= tag && tag < MEM_NUM_TAGS);
+
+#ifdef WIN32
+	long now = (mem_tag_current[tag] += bytes);
+
+	if (mem_tag_peak[tag] < now)
+		mem_tag_peak[tag] = now;
+#else
+	long now  = mem_tag_current[tag].fetch_add(bytes) + bytes;
+	long peak = mem_tag_peak[tag].load();
+
+	while (peak < now && ! mem_tag_peak[tag].compare_exchange_weak(peak, now))
+	{ }
+#endif
+}
+
+
+void MemTag_ResetPeaks()
+{
+	for (int tag = 0 ; tag < MEM_NUM_TAGS ; tag++)
+	{
+		long current = mem_tag_current[tag];
+
+		mem_tag_peak[tag] = current;
+	}
+}
+
+
+void MemTag_Report()
+{
+	LogPrintf("\nMemory usage (current / peak):\n");
+
+	for (int tag = 0 ; tag < MEM_NUM_TAGS ; tag++)
+	{
+		long current = mem_tag_current[tag];
+		long peak    = mem_tag_peak[tag];
+
+		LogPrintf("  mem %-9s : %8.1f KB / %8.1f KB\n", mem_tag_names[tag],
+				  current / 1024.0, peak / 1024.0);
+	}
+}
+
+
 void LogReadLines(log_display_func_t display_func, void *priv_data)
 {
 	if (! log_file)
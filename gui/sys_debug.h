@@ -24,16 +24,47 @@
 bool LogInit(const char *filename);  // NULL for none
 void LogClose(void);
 
+// when logging to a file, switches to a different one (used by the
+// forked batch jobs, which cannot share a log file).
+bool LogReopen(const char *filename);
+
 void LogEnableDebug(bool enable);
 void LogEnableTerminal(bool enable);
 
 void   LogPrintf(const char *str, ...);
 void DebugPrintf(const char *str, ...);
 
+// while capturing, the log messages of the calling thread are added
+// to the given string instead (to be logged later in a sane order).
+void LogBeginCapture(std::string *buffer);
+void LogEndCapture();
+
 typedef void (* log_display_func_t)(const char *line, void *priv_data);
 
 void LogReadLines(log_display_func_t display_func, void *priv_data);
 
+
+/* memory accounting */
+
+typedef enum
+{
+	MEM_Brushes = 0,   // CSG brushes and their vertices
+	MEM_Entities,
+	MEM_Regions,       // BSP regions and snags
+	MEM_QuakeFaces,
+	MEM_Lightmaps,     // lightmap samples (Quake games)
+	MEM_VisBuffers,    // Vis_Buffer grids (spot finding)
+
+	MEM_NUM_TAGS
+}
+mem_tag_e;
+
+// adds (or subtracts when negative) from the usage of a subsystem
+void MemTag_Add(int tag, long bytes);
+
+void MemTag_ResetPeaks();
+void MemTag_Report();
+
 #endif /* __SYS_DEBUG_H__ */
 
 //--- editor settings ---
@@ -36,6 +36,7 @@
 
 #include "headers.h"
 
+#include "lib_thread.h"
 #include "lib_util.h"
 #include "aj_random.h"
 
@@ -49,8 +50,9 @@ static aj_Random_c ss_twist;
 
 
 /* Definitions used to address real and imaginary parts in a two-dimensional
-   array of complex numbers as stored by fourn(). */
+   array of complex numbers (indexed from one, as fourn() used to do). */
 
+static std::vector<float> mesh_buf;
 static float *mesh_a;
 static int meshsize;
 
@@ -60,11 +62,16 @@ static int meshsize;
 
 static void create_mesh(int width)
 {
+	// the memory is kept between calls
+
 	meshsize = width;
 
 	int total_elem = (meshsize * meshsize + 1) * 2;
 
-	mesh_a = new float[total_elem];
+	if ((int)mesh_buf.size() < total_elem)
+		mesh_buf.resize(total_elem);
+
+	mesh_a = &mesh_buf[0];
 
 	// clear it to zeros
 	memset(mesh_a, 0, total_elem * sizeof(float));
@@ -72,103 +79,184 @@ static void create_mesh(int width)
 
 static void free_mesh(void)
 {
-	delete[] mesh_a ; mesh_a = NULL;
+	mesh_a = NULL;
 }
 
 
-/*  FOURN  --  Multi-dimensional fast Fourier transform
+/*  FFT  --  Two dimensional fast Fourier transform
+
+    This performs exactly the same arithmetic as the fourn() function
+    from Press et al., "Numerical Recipes In C", Section 12.11, which
+    was used previously, hence the results are bit-for-bit identical.
+    However each row and column is transformed separately (which keeps
+    the data in the cache), the twiddle factors are computed once per
+    size, and for large sizes the work is spread over several threads.
+*/
+
+// the twiddle factors for each pass, where the pass with 'mmax'
+// butterflies uses the entries at [mmax-1 .. 2*mmax-2].
+static std::vector<double> fft_twiddle_r;
+static std::vector<double> fft_twiddle_i;
 
-    Called with arguments:
+static int fft_size;
+static int fft_sign;
 
-       data   A  one-dimensional  array  of  floats  (NOTE!!!  NOT
-              DOUBLES!!), indexed from one (NOTE!!! NOT  ZERO!!),
-              containing  pairs of numbers representing the complex
-              valued samples.  The Fourier transformed results  are
-              returned in the same array.
 
-       nn     An  array specifying the edge size in each dimension.
-              THIS ARRAY IS INDEXED FROM  ONE,  AND  ALL  THE  EDGE
-              SIZES MUST BE POWERS OF TWO!!!
+static void fft_init_twiddles(int n, int isign)
+{
+	if (fft_size == n && fft_sign == isign)
+		return;
 
-       ndim   Number of dimensions of FFT to perform.  Set to 2 for
-              two dimensional FFT.
+	fft_size = n;
+	fft_sign = isign;
 
-       isign  If 1, a Fourier transform is done; if -1 the  inverse
-              transformation is performed.
+	fft_twiddle_r.resize(n);
+	fft_twiddle_i.resize(n);
+
+	for (int mmax = 1 ; mmax < n ; mmax <<= 1)
+	{
+		double theta = isign * (M_PI * 2) / (mmax * 2);
+
+		double wtemp = sin(0.5 * theta);
+		double wpr = -2.0 * wtemp * wtemp;
+		double wpi = sin(theta);
+
+		double wr = 1.0;
+		double wi = 0.0;
+
+		for (int m = 0 ; m < mmax ; m++)
+		{
+			fft_twiddle_r[mmax - 1 + m] = wr;
+			fft_twiddle_i[mmax - 1 + m] = wi;
+
+			wr = (wtemp = wr) * wpr - wi * wpi + wr;
+			wi = wi * wpr + wtemp * wpi + wi;
+		}
+	}
+}
 
-    This function is essentially as given in Press et al., "Numerical
-    Recipes In C", Section 12.11, pp. 467-470.
-*/
 
-static void fourn(float data[], int nn[], int ndim, int isign)
+static void fft_line(float *data, int n)
 {
-	int i1, i2, i3;
-	int i2rev, i3rev, ip1, ip2, ip3, ifp1, ifp2;
-	int ibit, idim, k1, k2, n, nprev, nrem, ntot;
-	float tempi, tempr;
-	double theta, wi, wpi, wpr, wr, wtemp;
+	// 'data' contains 'n' complex numbers (real, imag pairs)
+
+	float tempr, tempi;
 
 #define FN_SWAP(a,b) tempr=(a); (a) = (b); (b) = tempr
 
-	ntot = 1;
-	for (idim = 1; idim <= ndim; idim++)
-		ntot *= nn[idim];
-	nprev = 1;
-	for (idim = ndim; idim >= 1; idim--) {
-		n = nn[idim];
-		nrem = ntot / (n * nprev);
-		ip1 = nprev << 1;
-		ip2 = ip1 * n;
-		ip3 = ip2 * nrem;
-		i2rev = 1;
-		for (i2 = 1; i2 <= ip2; i2 += ip1) {
-			if (i2 < i2rev) {
-				for (i1 = i2; i1 <= i2 + ip1 - 2; i1 += 2) {
-					for (i3 = i1; i3 <= ip3; i3 += ip2) {
-						i3rev = i2rev + i3 - i2;
-						FN_SWAP(data[i3], data[i3rev]);
-						FN_SWAP(data[i3 + 1], data[i3rev + 1]);
-					}
-				}
-			}
-			ibit = ip2 >> 1;
-			while (ibit >= ip1 && i2rev > ibit) {
-				i2rev -= ibit;
-				ibit >>= 1;
-			}
-			i2rev += ibit;
+	// bit reversal
+	int j = 0;
+
+	for (int i = 0 ; i < n ; i++)
+	{
+		if (i < j)
+		{
+			FN_SWAP(data[i*2],     data[j*2]);
+			FN_SWAP(data[i*2 + 1], data[j*2 + 1]);
+		}
+
+		int m = n >> 1;
+
+		while (m >= 1 && j >= m)
+		{
+			j -= m;
+			m >>= 1;
 		}
-		ifp1 = ip1;
-		while (ifp1 < ip2) {
-			ifp2 = ifp1 << 1;
-			theta = isign * (M_PI * 2) / (ifp2 / ip1);
-			wtemp = sin(0.5 * theta);
-			wpr = -2.0 * wtemp * wtemp;
-			wpi = sin(theta);
-			wr = 1.0;
-			wi = 0.0;
-			for (i3 = 1; i3 <= ifp1; i3 += ip1) {
-				for (i1 = i3; i1 <= i3 + ip1 - 2; i1 += 2) {
-					for (i2 = i1; i2 <= ip3; i2 += ifp2) {
-						k1 = i2;
-						k2 = k1 + ifp1;
-						tempr = wr * data[k2] - wi * data[k2 + 1];
-						tempi = wr * data[k2 + 1] + wi * data[k2];
-						data[k2] = data[k1] - tempr;
-						data[k2 + 1] = data[k1 + 1] - tempi;
-						data[k1] += tempr;
-						data[k1 + 1] += tempi;
-					}
-				}
-				wr = (wtemp = wr) * wpr - wi * wpi + wr;
-				wi = wi * wpr + wtemp * wpi + wi;
+
+		j += m;
+	}
+
+#undef FN_SWAP
+
+	// butterflies
+	for (int mmax = 1 ; mmax < n ; mmax <<= 1)
+	{
+		const double *tw_r = &fft_twiddle_r[mmax - 1];
+		const double *tw_i = &fft_twiddle_i[mmax - 1];
+
+		for (int m = 0 ; m < mmax ; m++)
+		{
+			double wr = tw_r[m];
+			double wi = tw_i[m];
+
+			for (int i = m ; i < n ; i += mmax * 2)
+			{
+				float *k1 = &data[i * 2];
+				float *k2 = &data[(i + mmax) * 2];
+
+				tempr = wr * k2[0] - wi * k2[1];
+				tempi = wr * k2[1] + wi * k2[0];
+
+				k2[0] = k1[0] - tempr;
+				k2[1] = k1[1] - tempi;
+				k1[0] += tempr;
+				k1[1] += tempi;
 			}
-			ifp1 = ifp2;
 		}
-		nprev *= n;
 	}
 }
-#undef FN_SWAP
+
+
+static void fft_row_job(int row, void *priv_dat)
+{
+	fft_line(&Real(row, 0), meshsize);
+}
+
+
+#define FFT_COLUMN_GROUP  16
+
+static void fft_column_job(int group, void *priv_dat)
+{
+	int n = meshsize;
+
+	std::vector<float> line(n * 2);
+
+	int col_end = MIN(n, (group + 1) * FFT_COLUMN_GROUP);
+
+	for (int col = group * FFT_COLUMN_GROUP ; col < col_end ; col++)
+	{
+		for (int k = 0 ; k < n ; k++)
+		{
+			line[k*2]     = Real(k, col);
+			line[k*2 + 1] = Imag(k, col);
+		}
+
+		fft_line(&line[0], n);
+
+		for (int k = 0 ; k < n ; k++)
+		{
+			Real(k, col) = line[k*2];
+			Imag(k, col) = line[k*2 + 1];
+		}
+	}
+}
+
+
+// below this size the threads are not worth their overhead
+#define FFT_THREAD_SIZE  256
+
+static void fft_2d(int isign)
+{
+	int n = meshsize;
+
+	fft_init_twiddles(n, isign);
+
+	int groups = (n + FFT_COLUMN_GROUP - 1) / FFT_COLUMN_GROUP;
+
+	if (n >= FFT_THREAD_SIZE)
+	{
+		Thread_ParallelFor(n, fft_row_job);
+		Thread_ParallelFor(groups, fft_column_job);
+	}
+	else
+	{
+		for (int row = 0 ; row < n ; row++)
+			fft_row_job(row, NULL);
+
+		for (int g = 0 ; g < groups ; g++)
+			fft_column_job(g, NULL);
+	}
+}
 
 
 /*  INITGAUSS  --  Initialize random number generators.  As given in
@@ -254,12 +342,7 @@ static void spectral_synth(int n, double h)
 		Imag(n - i, j) = - rsin;
 	}
 
-	int nsize[3];
-
-	nsize[0] = 0;
-	nsize[1] = nsize[2] = n;   /* Dimension of frequency domain array */
-
-	fourn(mesh_a, nsize, 2, -1);     /* Take inverse 2D Fourier transform */
+	fft_2d(-1);     /* Take inverse 2D Fourier transform */
 }
 
 
@@ -28,22 +28,22 @@
 
 UI_MiniMap::UI_MiniMap(int x, int y, int w, int h, const char *label) :
 	Fl_Box(x, y, w, h, label),
-	pixels(NULL), cur_image(NULL)
+	map_W(0), map_H(0),
+	pixels(NULL), base_pixels(NULL)
 {
 	box(FL_NO_BOX);
+
+	dirty_x1 = blit_x1 = 0;
+	dirty_y1 = blit_y1 = 0;
+	dirty_x2 = blit_x2 = -1;
+	dirty_y2 = blit_y2 = -1;
 }
 
 
 UI_MiniMap::~UI_MiniMap()
 {
-	if (cur_image)
-	{
-		image(NULL);
-		delete cur_image;
-	}
-
-	if (pixels)
-		delete[] pixels;
+	delete[] pixels;
+	delete[] base_pixels;
 }
 
 
@@ -56,28 +56,37 @@ void UI_MiniMap::EmptyMap()
 
 void UI_MiniMap::MapBegin()
 {
-	map_W = w();
-	map_H = h();
-
-	if (pixels)
+	// only need to create the buffers when the size changes
+	if (! pixels || map_W != w() || map_H != h())
+	{
 		delete[] pixels;
+		delete[] base_pixels;
 
-	pixels = new u8_t[map_W * map_H * 3];
+		map_W = w();
+		map_H = h();
 
-	MapClear();
+		pixels      = new u8_t[map_W * map_H * 3];
+		base_pixels = new u8_t[map_W * map_H * 3];
+
+		MapClear();
+	}
+
+	memcpy(pixels, base_pixels, map_W * map_H * 3);
+
+	MarkDirty(0, 0, map_W-1, map_H-1);
 }
 
 
 void UI_MiniMap::MapClear()
 {
-	memset(pixels, 0, map_W * map_H * 3);
+	memset(base_pixels, 0, map_W * map_H * 3);
 
 	// draw the grid
 
 	for (int py = 0 ; py < map_H ; py++)
 	for (int px = 0 ; px < map_W ; px++)
 	{
-		u8_t *pix = pixels + (py*map_W + px) * 3;
+		u8_t *pix = base_pixels + (py*map_W + px) * 3;
 
 		if ((px % 10) == 5 || (py % 10) == 5)
 		{
@@ -100,16 +109,81 @@ void UI_MiniMap::MapFinish()
 		MapCorner(map_W-1, map_H-1, -1, -1);
 	}
 
-	if (cur_image)
+	// nothing changed?
+	if (dirty_x1 > dirty_x2)
+		return;
+
+	// merge into the area which still needs to be blitted
+	if (blit_x1 > blit_x2)
+	{
+		blit_x1 = dirty_x1;  blit_y1 = dirty_y1;
+		blit_x2 = dirty_x2;  blit_y2 = dirty_y2;
+	}
+	else
+	{
+		blit_x1 = MIN(blit_x1, dirty_x1);  blit_y1 = MIN(blit_y1, dirty_y1);
+		blit_x2 = MAX(blit_x2, dirty_x2);  blit_y2 = MAX(blit_y2, dirty_y2);
+	}
+
+	damage(FL_DAMAGE_USER1, x() + blit_x1, y() + blit_y1,
+	       blit_x2 - blit_x1 + 1, blit_y2 - blit_y1 + 1);
+
+	dirty_x1 = 0;  dirty_x2 = -1;
+	dirty_y1 = 0;  dirty_y2 = -1;
+}
+
+
+void UI_MiniMap::draw()
+{
+	if (! pixels)
+		return;
+
+	if (damage() & ~FL_DAMAGE_USER1)
 	{
-		image(NULL);
-		delete cur_image;
+		// a full redraw (e.g. window was exposed)
+		fl_draw_image(pixels, x(), y(), map_W, map_H, 3);
 	}
+	else if (blit_x1 <= blit_x2)
+	{
+		// only blit the part which has changed
+		const u8_t *src = pixels + (blit_y1 * map_W + blit_x1) * 3;
 
-	cur_image = new Fl_RGB_Image(pixels, map_W, map_H);
+		fl_draw_image(src, x() + blit_x1, y() + blit_y1,
+		              blit_x2 - blit_x1 + 1, blit_y2 - blit_y1 + 1,
+		              3, map_W * 3);
+	}
 
-	image(cur_image);
-	redraw();
+	blit_x1 = 0;  blit_x2 = -1;
+	blit_y1 = 0;  blit_y2 = -1;
+}
+
+
+void UI_MiniMap::MarkDirty(int x1, int y1, int x2, int y2)
+{
+	// convert to rows of the buffer (which are upside down)
+	int row1 = map_H-1 - MAX(y1, y2);
+	int row2 = map_H-1 - MIN(y1, y2);
+
+	if (x1 > x2)
+	{
+		int tmp = x1; x1 = x2; x2 = tmp;
+	}
+
+	x1   = MAX(x1, 0);  x2   = MIN(x2, map_W-1);
+	row1 = MAX(row1, 0);  row2 = MIN(row2, map_H-1);
+
+	if (x1 > x2 || row1 > row2)
+		return;
+
+	if (dirty_x1 > dirty_x2)
+	{
+		dirty_x1 = x1;  dirty_y1 = row1;
+		dirty_x2 = x2;  dirty_y2 = row2;
+		return;
+	}
+
+	dirty_x1 = MIN(dirty_x1, x1);  dirty_y1 = MIN(dirty_y1, row1);
+	dirty_x2 = MAX(dirty_x2, x2);  dirty_y2 = MAX(dirty_y2, row2);
 }
 
 
@@ -124,6 +198,8 @@ void UI_MiniMap::MapCorner(int x, int y, int dx, int dy)
 
 	Fl::get_color(nearby_bg, r, g, b);
 
+	MarkDirty(x, y, x+dx*3, y+dy*3);
+
 	RawPixel(x+dx*0, y+dy*0, r, g, b);
 	RawPixel(x+dx*1, y+dy*1, r, g, b);
 
@@ -142,6 +218,8 @@ void UI_MiniMap::DrawPixel(int x, int y, byte r, byte g, byte b)
 	if (x < 0 || x >= map_W || y < 0 || y >= map_H)
 		return;
 
+	MarkDirty(x, y, x, y);
+
 	RawPixel(x, y, r, g, b);
 }
 
@@ -159,6 +237,8 @@ void UI_MiniMap::DrawBox(int x1, int y1, int x2, int y2,
 	if (x1 > x2 || y1 > y2)
 		return;
 
+	MarkDirty(x1, y1, x2, y2);
+
 	for (int y = y1; y <= y2; y++)
 		for (int x = x1; x <= x2; x++)
 			RawPixel(x, y, r, g, b);
@@ -186,6 +266,8 @@ void UI_MiniMap::DrawLine(int x1, int y1, int x2, int y2,
 		x1 = MAX(0, x1);
 		x2 = MIN(map_W-1, x2);
 
+		MarkDirty(x1, y1, x2, y1);
+
 		for (; x1 <= x2; x1++)
 			RawPixel(x1, y1, r, g, b);
 
@@ -202,6 +284,8 @@ void UI_MiniMap::DrawLine(int x1, int y1, int x2, int y2,
 		y1 = MAX(0, y1);
 		y2 = MIN(map_H-1, y2);
 
+		MarkDirty(x1, y1, x1, y2);
+
 		for (; y1 <= y2; y1++)
 			RawPixel(x1, y1, r, g, b);
 
@@ -273,6 +357,8 @@ void UI_MiniMap::DrawLine(int x1, int y1, int x2, int y2,
 	}
 
 
+	MarkDirty(x1, y1, x2, y2);
+
 	// this is the Bresenham line drawing algorithm
 	// (based on code from am_map.c in the GPL DOOM source)
 
@@ -336,6 +422,8 @@ void UI_MiniMap::DrawEntity(int x, int y, byte r, byte g, byte b)
 	if (x < 1 || x > map_W-2 || y < 1 || y > map_H-2)
 		return;
 
+	MarkDirty(x-1, y-1, x+1, y+1);
+
 	RawPixel(x, y, r, g, b);
 
 	r = (r / 4) * 3;
@@ -349,5 +437,15 @@ void UI_MiniMap::DrawEntity(int x, int y, byte r, byte g, byte b)
 }
 
 
+void UI_MiniMap::DrawLines(const int *coords, int count,
+                           byte r, byte g, byte b)
+{
+	for (int i = 0 ; i < count ; i++, coords += 4)
+	{
+		DrawLine(coords[0], coords[1], coords[2], coords[3], r, g, b);
+	}
+}
+
+
 //--- editor settings ---
 // vi:ts=4:sw=4:noexpandtab
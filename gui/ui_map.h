@@ -28,7 +28,17 @@ private:
 
 	u8_t *pixels;
 
-	Fl_RGB_Image *cur_image;
+	// the empty map (with the grid), copied by MapBegin()
+	u8_t *base_pixels;
+
+	// part of the pixels changed since the last MapFinish(), as
+	// rows and columns of the buffer.  empty when x1 > x2.
+	int dirty_x1, dirty_y1;
+	int dirty_x2, dirty_y2;
+
+	// part which draw() needs to blit to the screen
+	int blit_x1, blit_y1;
+	int blit_x2, blit_y2;
 
 public:
 	UI_MiniMap(int x, int y, int w, int h, const char *label = NULL);
@@ -48,10 +58,20 @@ public:
 	void DrawLine (int x1, int y1, int x2, int y2, byte r, byte g, byte b);
 	void DrawEntity(int x, int y, byte r, byte g, byte b);
 
+	// draws a list of lines in a single color, 'coords' contains
+	// four values (x1, y1, x2, y2) for each line.
+	void DrawLines(const int *coords, int count, byte r, byte g, byte b);
+
+	// FLTK virtual method for drawing
+	void draw();
+
 private:
 	void MapClear();
 	void MapCorner(int x, int y, int dx, int dy);
 
+	// marks part of the map as changed, using map coordinates
+	void MarkDirty(int x1, int y1, int x2, int y2);
+
 	inline void RawPixel(int x, int y, byte r, byte g, byte b)
 	{
 		u8_t *pos = pixels + ((map_H-1 - y)*map_W + x) * 3;
@@ -31,11 +31,15 @@ Vis_Buffer::Vis_Buffer(int width, int height) :
 {
 	data = new short[W * H];
 
+	MemTag_Add(MEM_VisBuffers, sizeof(short) * W * H);
+
 	Clear();
 }
 
 Vis_Buffer::~Vis_Buffer()
 {
+	MemTag_Add(MEM_VisBuffers, -(long)(sizeof(short) * W * H));
+
 	delete[] data;
 }
 
@@ -0,0 +1,204 @@
+#!/bin/bash
+#
+# Deterministic benchmark : builds a fixed set of seeds x games x sizes
+# in batch mode, and records the step times, peak memory, output size
+# and checksum of each build into a CSV report.
+#
+# The checksums prove that an optimisation did not change the generated
+# maps, and the compare mode flags builds which got slower or bigger.
+#
+
+if [ "$1" == "--help" ] || [ "$1" == "-h" ]
+then
+	echo "USAGE: bench-it  [report.csv]  [oblige_options...]"
+	echo "       bench-it  --compare  old.csv  new.csv  [threshold_percent]"
+	echo ""
+	echo "Environment variables (with defaults):"
+	echo "   SEEDS=\"1 2 3\""
+	echo "   GAMES=\"doom2 heretic\""
+	echo "   SIZES=\"small regular large\""
+	echo "   LENGTH=single"
+	exit
+fi
+
+
+#
+# Compare mode
+#
+if [ "$1" == "--compare" ]
+then
+	if [ $# -lt 3 ]
+	then
+		echo "Missing filenames for --compare"
+		exit 1
+	fi
+
+	threshold=${4:-10}
+
+	awk -F, -v thr=$threshold '
+		FNR == 1 {
+			# map column names to indices
+			for (i = 1 ; i <= NF ; i++) col[FILENAME, $i] = i
+			next
+		}
+
+		FILENAME == ARGV[1] {
+			key = $1 "," $2 "," $3
+			old_time[key] = $(col[FILENAME, "total_sec"])
+			old_rss [key] = $(col[FILENAME, "peak_rss_kb"])
+			old_sum [key] = $(col[FILENAME, "checksum"])
+			next
+		}
+
+		{
+			key = $1 "," $2 "," $3
+
+			if (! (key in old_time))
+			{
+				printf("NEW       %s\n", key)
+				next
+			}
+
+			new_time = $(col[FILENAME, "total_sec"])
+			new_rss  = $(col[FILENAME, "peak_rss_kb"])
+			new_sum  = $(col[FILENAME, "checksum"])
+
+			if (new_sum != old_sum[key])
+			{
+				printf("CHANGED   %s : output checksum differs\n", key)
+				bad++
+			}
+
+			if (old_time[key] > 0 && new_time > old_time[key] * (1 + thr / 100.0))
+			{
+				printf("SLOWER    %s : %.2f -> %.2f sec\n", key, old_time[key], new_time)
+				bad++
+			}
+
+			if (old_rss[key] > 0 && new_rss > old_rss[key] * (1 + thr / 100.0))
+			{
+				printf("MEMORY    %s : %d -> %d KB\n", key, old_rss[key], new_rss)
+				bad++
+			}
+
+			total_old += old_time[key]
+			total_new += new_time
+		}
+
+		END {
+			printf("\nTotal time: %.2f -> %.2f sec\n", total_old, total_new)
+			printf("%d regression(s) past %d%%\n", bad, thr)
+
+			exit (bad > 0) ? 1 : 0
+		}
+	' "$2" "$3"
+
+	exit $?
+fi
+
+
+if [ ! -d lua_src ]
+then
+	echo "Run this script from the top level."
+	exit 1
+fi
+
+if [ ! -x ./Oblige ]
+then
+	echo "Missing ./Oblige executable (run make first)."
+	exit 1
+fi
+
+report=bench_report.csv
+
+if [ $# -gt 0 ] && [ "${1:0:1}" != "-" ] && [ "${1/=/}" == "$1" ]
+then
+	report=$1
+	shift
+fi
+
+SEEDS=${SEEDS:-"1 2 3"}
+GAMES=${GAMES:-"doom2 heretic"}
+SIZES=${SIZES:-"small regular large"}
+LENGTH=${LENGTH:-single}
+
+STEPS="Init Plan Mons CSG BSP Hull Vis Light Nodes Finish"
+
+work=bench_work
+mkdir -p $work
+
+# GNU time gives us the peak memory usage (including glBSP)
+time_cmd=""
+if [ -x /usr/bin/time ]
+then
+	time_cmd="/usr/bin/time -f %M -o $work/rss.txt"
+fi
+
+header="game,size,seed,result,total_sec"
+for step in $STEPS
+do
+	header="$header,$step"
+done
+header="$header,peak_rss_kb,output_bytes,checksum"
+
+echo $header > $report
+
+for game in $GAMES
+do
+	for size in $SIZES
+	do
+		for seed in $SEEDS
+		do
+			base="$work/${game}_${size}_${seed}"
+
+			echo "Building: game=$game size=$size seed=$seed"
+
+			rm -f $base.out $work/rss.txt
+
+			$time_cmd ./Oblige seed=$seed game=$game size=$size length=$LENGTH \
+				"$@" -b $base.out --log $base.log > /dev/null 2>&1
+
+			if [ $? -eq 0 ]
+			then
+				result=ok
+			else
+				result=FAILED
+			fi
+
+			total=$(awk '/^TOTAL TIME:/ { print $3 }' $base.log)
+
+			line="$game,$size,$seed,$result,${total:-0}"
+
+			for step in $STEPS
+			do
+				t=$(awk -v s=$step '$1 == "step" && $2 == s { print $4 }' $base.log)
+				line="$line,${t:-0}"
+			done
+
+			# otherwise use the value which Oblige logs itself
+			if [ -f $work/rss.txt ]
+			then
+				rss=$(tail -n 1 $work/rss.txt)
+			else
+				rss=$(awk '$1 == "mem" && $2 == "peak_rss" { print $4 }' $base.log)
+			fi
+			rss=${rss:-0}
+
+			bytes=0
+			sum="-"
+			if [ -f $base.out ]
+			then
+				bytes=$(wc -c < $base.out)
+				sum=$(md5sum < $base.out | cut -d ' ' -f 1)
+			fi
+
+			echo "$line,$rss,$bytes,$sum" >> $report
+		done
+	done
+done
+
+echo ""
+echo "Report written to: $report"
+
+# --- editor settings ---
+# vi:ts=4:sw=4:noexpandtab
@@ -957,6 +957,9 @@ function Seed_draw_minimap()
   local ofs_x = (size -  width) / 2
   local ofs_y = (size - height) / 2
 
+  -- lines are collected per color, then drawn with a single call
+  local lines = {}
+
 
   local function draw_edge(S, dir, color)
     local x1,y1, x2,y2 = S:line_coords(dir)
@@ -967,7 +970,12 @@ function Seed_draw_minimap()
     y1 = (y1 - min_y + ofs_y) * map_H / size
     y2 = (y2 - min_y + ofs_y) * map_H / size
 
-    gui.minimap_draw_line(x1,y1, x2,y2, color)
+    if not lines[color] then lines[color] = {} end
+
+    local list = lines[color]
+
+    table.insert(list, x1) ; table.insert(list, y1)
+    table.insert(list, x2) ; table.insert(list, y2)
   end
 
 
@@ -1018,6 +1026,9 @@ function Seed_draw_minimap()
 
   map_W, map_H = gui.minimap_begin()
 
+  -- no minimap (e.g. batch mode) ?
+  if not map_W then return end
+
   for x = 1, SEED_W do
   for y = 1, SEED_H do
     local S = SEEDS[x][y]
@@ -1029,6 +1040,13 @@ function Seed_draw_minimap()
   end
   end
 
+  -- area boundaries first, so room edges are drawn over them
+  each color in { "#aaaaaa", "#ffffff", "#11aaff", "#ff9933" } do
+    if lines[color] then
+      gui.minimap_draw_lines(lines[color], color)
+    end
+  end
+
   gui.minimap_finish()
   gui.ticker()
 end